@@ -33,10 +33,29 @@
 // accelerators/bvh.cpp*
 #include "stdafx.h"
 #include "accelerators/bvh.h"
+#include "shapes/trianglemesh.h"
 #include "probes.h"
 #include "paramset.h"
+#include "parallel.h"
+#include "timer.h"
+#include "intersection.h"
+#include "stats.h"
+#ifdef PBRT_HAS_SSE
+#include <xmmintrin.h>
+#endif
+#if !defined(PBRT_IS_WINDOWS)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 // BVHAccel Local Declarations
+STAT_INT_DISTRIBUTION("BVH/Nodes visited per ray", bvhNodesVisited);
+STAT_INT_DISTRIBUTION("BVH/Nodes visited per ray packet", bvhPacketNodesVisited);
+STAT_COUNTER("BVH/Primitive intersection tests", bvhPrimitiveTests);
+STAT_MEMORY_COUNTER("Memory/BVH nodes", bvhNodeBytes);
 struct BVHPrimitiveInfo {
     BVHPrimitiveInfo() { }
     BVHPrimitiveInfo(int pn, const BBox &b)
@@ -70,6 +89,25 @@ struct BVHBuildNode {
 };
 
 
+static inline bool PackableFace(const Primitive *prim) {
+    // Only faces of meshes without alpha textures can be resolved in a pack
+    const MeshFacePrimitive *face =
+        dynamic_cast<const MeshFacePrimitive *>(prim);
+    return face && !face->GetMesh()->HasAlphaTexture();
+}
+
+
+static bool AllTriangles(const vector<Reference<Primitive> > &primitives,
+        const vector<BVHPrimitiveInfo> &buildData, uint32_t start,
+        uint32_t end) {
+    // Return whether leaf primitives can be packed into SIMD triangle tests
+    for (uint32_t i = start; i < end; ++i)
+        if (!PackableFace(primitives[buildData[i].primitiveNumber].GetPtr()))
+            return false;
+    return true;
+}
+
+
 struct CompareToMid {
     CompareToMid(int d, float m) { dim = d; mid = m; }
     int dim;
@@ -110,6 +148,371 @@ bool CompareToBucket::operator()(const BVHPrimitiveInfo &p) const {
 }
 
 
+struct CompareTreeletToBucket {
+    CompareTreeletToBucket(int split, int num, int d, const BBox &b)
+        : centroidBounds(b)
+    { splitBucket = split; nBuckets = num; dim = d; }
+    bool operator()(const BVHBuildNode *node) const {
+        float centroid = .5f * node->bounds.pMin[dim] +
+                         .5f * node->bounds.pMax[dim];
+        int b = nBuckets * ((centroid - centroidBounds.pMin[dim]) /
+                (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+        if (b == nBuckets) b = nBuckets-1;
+        Assert(b >= 0 && b < nBuckets);
+        return b <= splitBucket;
+    }
+
+    int splitBucket, nBuckets, dim;
+    const BBox &centroidBounds;
+};
+
+
+struct BucketInfo {
+    BucketInfo() { count = 0; }
+    int count;
+    BBox bounds;
+};
+
+
+static const int nBuckets = 12;
+
+// Ranges with at least this many primitives have their bounds and SAH
+// buckets computed by _BVHRangeTask_s during the parallel build
+static const uint32_t parallelRangeMinPrims = 65536;
+
+static void BVHRangeBounds(const vector<BVHPrimitiveInfo> &buildData,
+        uint32_t start, uint32_t end, BBox *bounds, BBox *centroidBounds) {
+    for (uint32_t i = start; i < end; ++i) {
+        *bounds = Union(*bounds, buildData[i].bounds);
+        *centroidBounds = Union(*centroidBounds, buildData[i].centroid);
+    }
+}
+
+
+static void BVHRangeBuckets(const vector<BVHPrimitiveInfo> &buildData,
+        uint32_t start, uint32_t end, int dim, const BBox &centroidBounds,
+        BucketInfo buckets[nBuckets]) {
+    for (uint32_t i = start; i < end; ++i) {
+        int b = nBuckets *
+            ((buildData[i].centroid[dim] - centroidBounds.pMin[dim]) /
+             (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+        if (b == nBuckets) b = nBuckets-1;
+        Assert(b >= 0 && b < nBuckets);
+        buckets[b].count++;
+        buckets[b].bounds = Union(buckets[b].bounds, buildData[i].bounds);
+    }
+}
+
+
+class BVHPrimitiveInfoTask : public Task {
+public:
+    BVHPrimitiveInfoTask(const vector<Reference<Primitive> > &p,
+                         vector<BVHPrimitiveInfo> &bd, uint32_t s, uint32_t e)
+        : primitives(p), buildData(bd), start(s), end(e) { }
+    void Run() {
+        for (uint32_t i = start; i < end; ++i)
+            buildData[i] = BVHPrimitiveInfo(i, primitives[i]->WorldBound());
+    }
+
+private:
+    const vector<Reference<Primitive> > &primitives;
+    vector<BVHPrimitiveInfo> &buildData;
+    uint32_t start, end;
+};
+
+
+class BVHRangeTask : public Task {
+public:
+    // BVHRangeTask computes either bounds or SAH buckets for a chunk
+    BVHRangeTask(const vector<BVHPrimitiveInfo> &bd, uint32_t s, uint32_t e)
+        : buildData(bd), start(s), end(e), dim(-1) { }
+    BVHRangeTask(const vector<BVHPrimitiveInfo> &bd, uint32_t s, uint32_t e,
+                 int d, const BBox &cb)
+        : buildData(bd), start(s), end(e), dim(d), centroidBounds(cb) { }
+    void Run() {
+        if (dim == -1)
+            BVHRangeBounds(buildData, start, end, &bounds, &centroidBounds);
+        else
+            BVHRangeBuckets(buildData, start, end, dim, centroidBounds,
+                            buckets);
+    }
+
+    const vector<BVHPrimitiveInfo> &buildData;
+    uint32_t start, end;
+    int dim;
+    BBox bounds, centroidBounds;
+    BucketInfo buckets[nBuckets];
+};
+
+
+static void ParallelRangeTasks(const vector<BVHPrimitiveInfo> &buildData,
+        uint32_t start, uint32_t end, int dim, const BBox &centroidBounds,
+        vector<BVHRangeTask *> &tasks) {
+    uint32_t nTasks = 4 * NumSystemCores();
+    uint32_t chunkSize = (end - start + nTasks - 1) / nTasks;
+    for (uint32_t s = start; s < end; s += chunkSize) {
+        uint32_t e = min(s + chunkSize, end);
+        if (dim == -1)
+            tasks.push_back(new BVHRangeTask(buildData, s, e));
+        else
+            tasks.push_back(new BVHRangeTask(buildData, s, e, dim,
+                                             centroidBounds));
+    }
+    EnqueueTasks(vector<Task *>(tasks.begin(), tasks.end()));
+    WaitForAllTasks();
+}
+
+
+class BVHSubtreeTask : public Task {
+public:
+    BVHSubtreeTask(BVHAccel *b, BVHBuildNode *n,
+                   vector<BVHPrimitiveInfo> &bd, uint32_t s, uint32_t e,
+                   vector<Reference<Primitive> > &op)
+        : bvh(b), node(n), buildData(bd), start(s), end(e),
+          orderedPrims(op), totalNodes(0) { }
+    void Run() {
+        // Build subtree and move its root into the placeholder _node_
+        BVHBuildNode *root = bvh->recursiveBuild(buildArena, buildData,
+            start, end, &totalNodes, orderedPrims);
+        *node = *root;
+        --totalNodes;
+    }
+
+    BVHAccel *bvh;
+    BVHBuildNode *node;
+    vector<BVHPrimitiveInfo> &buildData;
+    uint32_t start, end;
+    vector<Reference<Primitive> > &orderedPrims;
+    MemoryArena buildArena;
+    uint32_t totalNodes;
+};
+
+
+struct MortonPrimitive {
+    uint32_t primitiveIndex;
+    uint32_t mortonCode;
+};
+
+
+static inline uint32_t LeftShift3(uint32_t x) {
+    Assert(x <= (1 << 10));
+    if (x == (1 << 10)) --x;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+
+static inline uint32_t EncodeMorton3(const BBox &centroidBounds,
+                                     const Point &p) {
+    // Quantize centroid to 10 bits per axis within _centroidBounds_
+    const int mortonScale = 1 << 10;
+    uint32_t q[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = centroidBounds.pMax[axis] - centroidBounds.pMin[axis];
+        float o = extent > 0.f ? (p[axis] - centroidBounds.pMin[axis]) / extent
+                               : 0.f;
+        q[axis] = uint32_t(Clamp(o * mortonScale, 0.f, float(mortonScale)));
+    }
+    return (LeftShift3(q[2]) << 2) | (LeftShift3(q[1]) << 1) |
+            LeftShift3(q[0]);
+}
+
+
+class MortonCodeTask : public Task {
+public:
+    MortonCodeTask(const vector<BVHPrimitiveInfo> &bd, const BBox &cb,
+                   MortonPrimitive *mp, uint32_t s, uint32_t e)
+        : buildData(bd), centroidBounds(cb), mortonPrims(mp),
+          start(s), end(e) { }
+    void Run() {
+        for (uint32_t i = start; i < end; ++i) {
+            mortonPrims[i].primitiveIndex = buildData[i].primitiveNumber;
+            mortonPrims[i].mortonCode =
+                EncodeMorton3(centroidBounds, buildData[i].centroid);
+        }
+    }
+private:
+    const vector<BVHPrimitiveInfo> &buildData;
+    const BBox &centroidBounds;
+    MortonPrimitive *mortonPrims;
+    uint32_t start, end;
+};
+
+
+// Radix sort of Morton codes, 6 bits per pass; each task histograms and
+// then scatters its own chunk, which keeps the sort stable
+static const int radixBitsPerPass = 6;
+static const int radixBuckets = 1 << radixBitsPerPass;
+
+class RadixSortTask : public Task {
+public:
+    RadixSortTask(uint32_t s, uint32_t e) : start(s), end(e) { }
+    void Run() {
+        int bitMask = (1 << radixBitsPerPass) - 1;
+        if (scatter) {
+            for (uint32_t i = start; i < end; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                out[offsets[bucket]++] = in[i];
+            }
+        }
+        else {
+            for (int b = 0; b < radixBuckets; ++b)
+                offsets[b] = 0;
+            for (uint32_t i = start; i < end; ++i)
+                ++offsets[(in[i].mortonCode >> lowBit) & bitMask];
+        }
+    }
+
+    uint32_t start, end;
+    int lowBit;
+    bool scatter;
+    const MortonPrimitive *in;
+    MortonPrimitive *out;
+    uint32_t offsets[radixBuckets];
+};
+
+
+static void RadixSort(vector<MortonPrimitive> *v, uint32_t nChunks) {
+    vector<MortonPrimitive> tempVector(v->size());
+    uint32_t chunkSize = (v->size() + nChunks - 1) / nChunks;
+    vector<Task *> tasks;
+    for (uint32_t i = 0; i < v->size(); i += chunkSize)
+        tasks.push_back(new RadixSortTask(i, min(i + chunkSize,
+                                                 uint32_t(v->size()))));
+    const int nBits = 30;
+    Assert((nBits % radixBitsPerPass) == 0);
+    const int nPasses = nBits / radixBitsPerPass;
+    for (int pass = 0; pass < nPasses; ++pass) {
+        // Perform one pass of radix sort, sorting _radixBitsPerPass_ bits
+        int lowBit = pass * radixBitsPerPass;
+        const MortonPrimitive *in = (pass & 1) ? &tempVector[0] : &(*v)[0];
+        MortonPrimitive *out = (pass & 1) ? &(*v)[0] : &tempVector[0];
+
+        // Count number of zero bits in array for current radix sort bit
+        for (uint32_t i = 0; i < tasks.size(); ++i) {
+            RadixSortTask *task = (RadixSortTask *)tasks[i];
+            task->lowBit = lowBit;
+            task->scatter = false;
+            task->in = in;
+            task->out = out;
+        }
+        EnqueueTasks(tasks);
+        WaitForAllTasks();
+
+        // Compute starting index in output array for each chunk and bucket
+        uint32_t offset = 0;
+        for (int b = 0; b < radixBuckets; ++b) {
+            for (uint32_t i = 0; i < tasks.size(); ++i) {
+                RadixSortTask *task = (RadixSortTask *)tasks[i];
+                uint32_t count = task->offsets[b];
+                task->offsets[b] = offset;
+                offset += count;
+            }
+        }
+        Assert(offset == v->size());
+
+        // Store sorted values in output array
+        for (uint32_t i = 0; i < tasks.size(); ++i)
+            ((RadixSortTask *)tasks[i])->scatter = true;
+        EnqueueTasks(tasks);
+        WaitForAllTasks();
+    }
+    // Copy final result from _tempVector_, if needed
+    if (nPasses & 1)
+        std::swap(*v, tempVector);
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+}
+
+
+class LBVHTreeletTask : public Task {
+public:
+    LBVHTreeletTask(BVHAccel *b, const vector<BVHPrimitiveInfo> &bd,
+                    const MortonPrimitive *mp, uint32_t s, uint32_t e,
+                    vector<Reference<Primitive> > &op)
+        : bvh(b), buildData(bd), mortonPrims(mp), start(s), end(e),
+          orderedPrims(op), totalNodes(0), root(NULL) { }
+    void Run() {
+        // Generate treelet, splitting on the bits below the treelet prefix
+        const int firstBitIndex = 29 - 12;
+        root = bvh->emitLBVH(buildArena, buildData, mortonPrims, start, end,
+                             &totalNodes, orderedPrims, firstBitIndex);
+    }
+
+    BVHAccel *bvh;
+    const vector<BVHPrimitiveInfo> &buildData;
+    const MortonPrimitive *mortonPrims;
+    uint32_t start, end;
+    vector<Reference<Primitive> > &orderedPrims;
+    MemoryArena buildArena;
+    uint32_t totalNodes;
+    BVHBuildNode *root;
+};
+
+
+struct BVHReference {
+    BVHReference() { }
+    BVHReference(uint32_t pn, const BBox &b)
+        : primitiveNumber(pn), bounds(b) { }
+    uint32_t primitiveNumber;
+    BBox bounds;
+};
+
+
+struct SBVHBuildState {
+    float minOverlapArea;
+    uint32_t nReferences, maxReferences;
+};
+
+
+struct RefLess {
+    bool operator()(const Reference<Primitive> &a,
+                    const Reference<Primitive> &b) const {
+        return a.GetPtr() < b.GetPtr();
+    }
+};
+
+
+struct RefEqual {
+    bool operator()(const Reference<Primitive> &a,
+                    const Reference<Primitive> &b) const {
+        return a.GetPtr() == b.GetPtr();
+    }
+};
+
+
+static const int nSpatialBins = 16;
+static const int maxSpatialSplitDepth = 48;
+
+
+static BBox ClipReferenceBounds(const Primitive *prim, const BBox &clip) {
+    BBox b = prim->ClippedWorldBound(clip);
+    if (b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z)
+        return clip;
+    // Pad clipped bounds to cover round-off error in clipping
+    for (int axis = 0; axis < 3; ++axis) {
+        float pad = 1e-6f * max(fabsf(b.pMin[axis]), fabsf(b.pMax[axis]));
+        b.pMin[axis] -= pad;
+        b.pMax[axis] += pad;
+    }
+    return ::Intersect(b, clip);
+}
+
+
+static void SplitReference(const Primitive *prim, const BVHReference &ref,
+        int axis, float pos, BVHReference *left, BVHReference *right) {
+    BBox leftClip = ref.bounds, rightClip = ref.bounds;
+    leftClip.pMax[axis] = pos;
+    rightClip.pMin[axis] = pos;
+    left->primitiveNumber = right->primitiveNumber = ref.primitiveNumber;
+    left->bounds = ClipReferenceBounds(prim, leftClip);
+    right->bounds = ClipReferenceBounds(prim, rightClip);
+}
+
+
 struct LinearBVHNode {
     BBox bounds;
     union {
@@ -123,6 +526,195 @@ struct LinearBVHNode {
 };
 
 
+#ifdef PBRT_HAS_SSE
+// BVHTrianglePack Declarations
+class BVHTrianglePack : public Aggregate {
+public:
+    // BVHTrianglePack Public Methods
+    BVHTrianglePack(const Reference<Primitive> *p, int n) {
+        nPrims = n;
+        for (int i = 0; i < nPrims; ++i)
+            prims[i] = p[i];
+        init();
+    }
+    BBox WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, Intersection *isect) const;
+    bool IntersectP(const Ray &ray) const;
+    void GetPrimitives(vector<Reference<Primitive> > &p) const {
+        for (int i = 0; i < nPrims; ++i)
+            p.push_back(prims[i]);
+    }
+private:
+    // BVHTrianglePack Private Methods
+    void init();
+    int hits(const Ray &ray, __m128 *tHit, __m128 *b1, __m128 *b2) const;
+
+    // BVHTrianglePack Private Data
+    float p0[3][4], e1[3][4], e2[3][4];
+    Reference<Primitive> prims[4];
+    int nPrims;
+    BBox bounds;
+};
+
+
+void BVHTrianglePack::init() {
+    // Store triangle vertices and edges in SoA form for SSE tests
+    bounds = BBox();
+    for (int i = 0; i < 4; ++i) {
+        Point p[3];
+        if (i < nPrims)
+            prims[i]->GetTriangleVertices(p);
+        for (int axis = 0; axis < 3; ++axis) {
+            // Unused entries are degenerate triangles that are never hit
+            p0[axis][i] = i < nPrims ? p[0][axis] : 0.f;
+            e1[axis][i] = i < nPrims ? p[1][axis] - p[0][axis] : 0.f;
+            e2[axis][i] = i < nPrims ? p[2][axis] - p[0][axis] : 0.f;
+        }
+        if (i < nPrims)
+            bounds = Union(bounds, prims[i]->WorldBound());
+    }
+}
+
+
+int BVHTrianglePack::hits(const Ray &ray, __m128 *tHit, __m128 *b1,
+                          __m128 *b2) const {
+    // Intersect _ray_ with all four triangles
+    __m128 dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y);
+    __m128 dz = _mm_set1_ps(ray.d.z);
+    __m128 e1x = _mm_loadu_ps(e1[0]), e1y = _mm_loadu_ps(e1[1]);
+    __m128 e1z = _mm_loadu_ps(e1[2]);
+    __m128 e2x = _mm_loadu_ps(e2[0]), e2y = _mm_loadu_ps(e2[1]);
+    __m128 e2z = _mm_loadu_ps(e2[2]);
+    __m128 s1x = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 s1y = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 s1z = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 divisor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s1x, e1x),
+        _mm_mul_ps(s1y, e1y)), _mm_mul_ps(s1z, e1z));
+    __m128 invDivisor = _mm_div_ps(_mm_set1_ps(1.f), divisor);
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_loadu_ps(p0[0]));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_loadu_ps(p0[1]));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_loadu_ps(p0[2]));
+    *b1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, s1x),
+        _mm_mul_ps(sy, s1y)), _mm_mul_ps(sz, s1z)), invDivisor);
+    __m128 s2x = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 s2y = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 s2z = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    *b2 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, s2x),
+        _mm_mul_ps(dy, s2y)), _mm_mul_ps(dz, s2z)), invDivisor);
+    *tHit = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, s2x),
+        _mm_mul_ps(e2y, s2y)), _mm_mul_ps(e2z, s2z)), invDivisor);
+
+    // Apply the same tests as _TriangleMesh::IntersectFace()_
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    __m128 hit = _mm_and_ps(_mm_cmpneq_ps(divisor, zero),
+        _mm_and_ps(_mm_cmpge_ps(*b1, zero), _mm_cmpge_ps(*b2, zero)));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(*b1, *b2), one));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(*tHit, _mm_set1_ps(ray.mint)));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(*tHit, _mm_set1_ps(ray.maxt)));
+    *tHit = _mm_or_ps(_mm_and_ps(hit, *tHit),
+                      _mm_andnot_ps(hit, _mm_set1_ps(INFINITY)));
+    return _mm_movemask_ps(hit) & ((1 << nPrims) - 1);
+}
+
+
+bool BVHTrianglePack::Intersect(const Ray &ray, Intersection *isect) const {
+    __m128 tHit, b1, b2;
+    int mask = hits(ray, &tHit, &b1, &b2);
+    if (!mask) return false;
+    // Find closest hit by reducing _tHit_ to its minimum in every lane
+    __m128 tMin = _mm_min_ps(tHit,
+        _mm_shuffle_ps(tHit, tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm_min_ps(tMin, _mm_shuffle_ps(tMin, tMin,
+                                           _MM_SHUFFLE(1, 0, 3, 2)));
+    mask &= _mm_movemask_ps(_mm_cmpeq_ps(tHit, tMin));
+    int closest = 0;
+    while (!(mask & (1 << closest))) ++closest;
+
+    // Record hit for closest triangle's mesh face
+    float t[4], params[2][4];
+    _mm_storeu_ps(t, tHit);
+    _mm_storeu_ps(params[0], b1);
+    _mm_storeu_ps(params[1], b2);
+    float faceParams[2] = { params[0][closest], params[1][closest] };
+    ((const MeshFacePrimitive *)prims[closest].GetPtr())->RecordHit(ray,
+        t[closest], faceParams, isect);
+    return true;
+}
+
+
+bool BVHTrianglePack::IntersectP(const Ray &ray) const {
+    __m128 tHit, b1, b2;
+    return hits(ray, &tHit, &b1, &b2) != 0;
+}
+#endif // PBRT_HAS_SSE
+
+
+static Primitive *MakeTrianglePack(const Reference<Primitive> *prims, int n) {
+#ifdef PBRT_HAS_SSE
+    // Pack primitives only if they are all mesh faces
+    for (int i = 0; i < n; ++i)
+        if (!PackableFace(prims[i].GetPtr())) return NULL;
+    return new BVHTrianglePack(prims, n);
+#else
+    return NULL;
+#endif
+}
+
+
+static bool UnpackTriangles(const Reference<Primitive> &prim,
+                            vector<Reference<Primitive> > &prims) {
+#ifdef PBRT_HAS_SSE
+    const BVHTrianglePack *pack =
+        dynamic_cast<const BVHTrianglePack *>(prim.GetPtr());
+    if (pack) {
+        pack->GetPrimitives(prims);
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+static inline void RefitNode(LinearBVHNode *nodes, uint32_t i,
+        const vector<Reference<Primitive> > &primitives) {
+    LinearBVHNode *node = &nodes[i];
+    if (node->nPrimitives > 0) {
+        node->bounds = BBox();
+        for (uint32_t j = 0; j < node->nPrimitives; ++j)
+            node->bounds = Union(node->bounds,
+                primitives[node->primitivesOffset + j]->WorldBound());
+    }
+    else
+        node->bounds = Union(nodes[i + 1].bounds,
+                             nodes[node->secondChildOffset].bounds);
+}
+
+
+static inline uint32_t SubtreeEnd(const LinearBVHNode *nodes, uint32_t i) {
+    // Follow second children to the last node of depth-first subtree _i_
+    while (nodes[i].nPrimitives == 0)
+        i = nodes[i].secondChildOffset;
+    return i + 1;
+}
+
+
+class BVHRefitTask : public Task {
+public:
+    BVHRefitTask(LinearBVHNode *n, const vector<Reference<Primitive> > &p,
+                 uint32_t s, uint32_t e)
+        : nodes(n), primitives(p), start(s), end(e) { }
+    void Run() {
+        // Children follow their parents, so refit subtree nodes in reverse
+        for (uint32_t i = end; i > start; --i)
+            RefitNode(nodes, i - 1, primitives);
+    }
+
+    LinearBVHNode *nodes;
+    const vector<Reference<Primitive> > &primitives;
+    uint32_t start, end;
+};
+
+
 static inline bool IntersectP(const BBox &bounds, const Ray &ray,
         const Vector &invDir, const uint32_t dirIsNeg[3]) {
     // Check for ray intersection against $x$ and $y$ slabs
@@ -149,102 +741,759 @@ static inline bool IntersectP(const BBox &bounds, const Ray &ray,
 
 
 
+struct QBVHNode {
+    // Child bounds in SoA form, indexed by [min/max][axis][child]
+    float bounds[2][3][4];
+    uint32_t children[4];     // interior: node offset; leaf: primitivesOffset
+    uint8_t nPrimitives[4];   // 0 -> interior node
+    uint8_t axis[3];          // split axes of the two collapsed BVH levels
+    uint8_t pad[9];           // ensure 128 byte total size
+};
+
+
+struct QuantizedBVHNode {
+    // Child bounds quantized to 8 bits relative to the decoded bounds of
+    // this node, indexed by [child][min/max][axis]; a _min_ value counts up
+    // from the node's _pMin_ and a _max_ value counts down from its _pMax_
+    uint8_t bounds[2][2][3];  // leaf: bounds[0][0][0] is nPrimitives
+    uint32_t offset;          // top two bits: axis, or 3 for leaf nodes
+};
+
+
+static const uint32_t quantizedLeafFlag = 3u << 30;
+static const uint32_t quantizedOffsetMask = (1u << 30) - 1;
+
+
+static inline BBox DequantizeBounds(const BBox &box, const uint8_t q[2][3]) {
+    BBox b;
+    for (int axis = 0; axis < 3; ++axis) {
+        float scale = (box.pMax[axis] - box.pMin[axis]) * (1.f / 255.f);
+        b.pMin[axis] = box.pMin[axis] + q[0][axis] * scale;
+        b.pMax[axis] = box.pMax[axis] - q[1][axis] * scale;
+    }
+    return b;
+}
+
+
+static void QuantizeBounds(const BBox &box, const BBox &b, uint8_t q[2][3]) {
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = box.pMax[axis] - box.pMin[axis];
+        int qMin = 0, qMax = 0;
+        if (extent > 0.f) {
+            qMin = Clamp(Floor2Int(255.f * (b.pMin[axis] - box.pMin[axis]) /
+                                   extent), 0, 255);
+            qMax = Clamp(Floor2Int(255.f * (box.pMax[axis] - b.pMax[axis]) /
+                                   extent), 0, 255);
+        }
+        // Round quantized bounds outward until they enclose _b_
+        float scale = extent * (1.f / 255.f);
+        while (qMin > 0 && box.pMin[axis] + qMin * scale > b.pMin[axis])
+            --qMin;
+        while (qMax > 0 && box.pMax[axis] - qMax * scale < b.pMax[axis])
+            --qMax;
+        q[0][axis] = qMin;
+        q[1][axis] = qMax;
+    }
+}
+
+
+struct QuantizedTodo {
+    uint32_t nodeNum;
+    BBox bounds;
+};
+
+
+struct QBVHTodo {
+    uint32_t offset;
+    uint32_t nPrimitives;
+    float tMin;
+};
+
+
+struct QBVHRay {
+    QBVHRay(const Ray &ray) {
+        Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+        for (int axis = 0; axis < 3; ++axis) {
+            dirIsNeg[axis] = invDir[axis] < 0;
+#ifdef PBRT_HAS_SSE
+            o[axis] = _mm_set1_ps(ray.o[axis]);
+            this->invDir[axis] = _mm_set1_ps(invDir[axis]);
+#else
+            o[axis] = ray.o[axis];
+            this->invDir[axis] = invDir[axis];
+#endif
+        }
+    }
+#ifdef PBRT_HAS_SSE
+    __m128 o[3], invDir[3];
+#else
+    float o[3], invDir[3];
+#endif
+    uint32_t dirIsNeg[3];
+};
+
+
+struct BVHRayPacket {
+    BVHRayPacket(const Ray *const *r, int n, Vector *id, uint32_t *neg)
+        : rays(r), nRays(n), invDir(id), dirIsNeg(neg) {
+        // Compute per-ray slab test data and interval bounds for the packet
+        coherent = true;
+        tMin = INFINITY;
+        tMax = -INFINITY;
+        for (int i = 0; i < nRays; ++i) {
+            const Ray &ray = *rays[i];
+            invDir[i] = Vector(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+            for (int axis = 0; axis < 3; ++axis) {
+                dirIsNeg[3*i+axis] = invDir[i][axis] < 0;
+                if (ray.d[axis] == 0.f || isinf(invDir[i][axis]) ||
+                    dirIsNeg[3*i+axis] != dirIsNeg[axis])
+                    coherent = false;
+                if (i == 0 || ray.o[axis] < oMin[axis]) oMin[axis] = ray.o[axis];
+                if (i == 0 || ray.o[axis] > oMax[axis]) oMax[axis] = ray.o[axis];
+                if (i == 0 || invDir[i][axis] < iMin[axis]) iMin[axis] = invDir[i][axis];
+                if (i == 0 || invDir[i][axis] > iMax[axis]) iMax[axis] = invDir[i][axis];
+            }
+            tMin = min(tMin, ray.mint);
+            tMax = max(tMax, ray.maxt);
+        }
+    }
+    bool MayHit(const BBox &bounds) const {
+        // Conservatively test whether any ray in the packet can hit _bounds_
+        float t0 = tMin, t1 = tMax;
+        for (int axis = 0; axis < 3; ++axis) {
+            float nearPlane = bounds[  dirIsNeg[axis]][axis];
+            float farPlane =  bounds[1-dirIsNeg[axis]][axis];
+            float n0 = nearPlane - oMax[axis], n1 = nearPlane - oMin[axis];
+            float f0 = farPlane - oMax[axis],  f1 = farPlane - oMin[axis];
+            float tNear = min(min(n0 * iMin[axis], n0 * iMax[axis]),
+                              min(n1 * iMin[axis], n1 * iMax[axis]));
+            float tFar = max(max(f0 * iMin[axis], f0 * iMax[axis]),
+                             max(f1 * iMin[axis], f1 * iMax[axis]));
+            t0 = max(t0, tNear);
+            t1 = min(t1, tFar);
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+    bool IntersectP(const BBox &bounds, int i) const {
+        return ::IntersectP(bounds, *rays[i], invDir[i], &dirIsNeg[3*i]);
+    }
+
+    const Ray *const *rays;
+    int nRays;
+    Vector *invDir;
+    uint32_t *dirIsNeg;
+    // Interval bounds over all rays, used only if _coherent_
+    bool coherent;
+    float oMin[3], oMax[3], iMin[3], iMax[3];
+    float tMin, tMax;
+};
+
+
+// Returns a bitmask of the children of _node_ whose bounds _ray_ overlaps
+static inline int IntersectQBVHNode(const QBVHNode &node, const Ray &ray,
+        const QBVHRay &qray, float tNear[4]) {
+#ifdef PBRT_HAS_SSE
+    __m128 tMin = _mm_set1_ps(ray.mint), tMax = _mm_set1_ps(ray.maxt);
+    for (int axis = 0; axis < 3; ++axis) {
+        // Intersect ray with all four children's slabs for _axis_
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(
+            _mm_load_ps(node.bounds[qray.dirIsNeg[axis]][axis]), qray.o[axis]),
+            qray.invDir[axis]);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(
+            _mm_load_ps(node.bounds[1-qray.dirIsNeg[axis]][axis]), qray.o[axis]),
+            qray.invDir[axis]);
+        // _t0_ and _t1_ go first so that NaNs from $0 \cdot \infty$ are ignored
+        tMin = _mm_max_ps(t0, tMin);
+        tMax = _mm_min_ps(t1, tMax);
+    }
+    _mm_storeu_ps(tNear, tMin);
+    return _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+#else
+    int hitMask = 0;
+    for (int child = 0; child < 4; ++child) {
+        float tMin = ray.mint, tMax = ray.maxt;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t0 = (node.bounds[qray.dirIsNeg[axis]][axis][child] -
+                        qray.o[axis]) * qray.invDir[axis];
+            float t1 = (node.bounds[1-qray.dirIsNeg[axis]][axis][child] -
+                        qray.o[axis]) * qray.invDir[axis];
+            if (t0 > tMin) tMin = t0;
+            if (t1 < tMax) tMax = t1;
+        }
+        tNear[child] = tMin;
+        if (tMin <= tMax) hitMask |= (1 << child);
+    }
+    return hitMask;
+#endif
+}
+
+
+static inline void QBVHChildOrder(const QBVHNode &node,
+        const uint32_t dirIsNeg[3], int order[4]) {
+    // Order children front-to-back using the split axes of _node_
+    int firstPair = dirIsNeg[node.axis[0]] ? 2 : 0;
+    order[0] = firstPair + dirIsNeg[node.axis[1 + firstPair/2]];
+    order[1] = firstPair + 1 - dirIsNeg[node.axis[1 + firstPair/2]];
+    int secondPair = 2 - firstPair;
+    order[2] = secondPair + dirIsNeg[node.axis[1 + secondPair/2]];
+    order[3] = secondPair + 1 - dirIsNeg[node.axis[1 + secondPair/2]];
+}
+
+
+static void QBVHChildren(BVHBuildNode *node, BVHBuildNode *children[4],
+                         uint8_t axis[3]) {
+    // Collapse two levels of the binary BVH below _node_
+    for (int i = 0; i < 4; ++i)
+        children[i] = NULL;
+    axis[0] = axis[1] = axis[2] = 0;
+    if (node->nPrimitives > 0) {
+        children[0] = node;
+        return;
+    }
+    axis[0] = node->splitAxis;
+    for (int side = 0; side < 2; ++side) {
+        BVHBuildNode *c = node->children[side];
+        if (c->nPrimitives == 0) {
+            children[2*side] = c->children[0];
+            children[2*side+1] = c->children[1];
+            axis[1+side] = c->splitAxis;
+        }
+        else
+            children[2*side] = c;
+    }
+}
+
+
+static uint32_t CountQBVHNodes(BVHBuildNode *node) {
+    BVHBuildNode *children[4];
+    uint8_t axis[3];
+    QBVHChildren(node, children, axis);
+    uint32_t count = 1;
+    for (int i = 0; i < 4; ++i)
+        if (children[i] && children[i]->nPrimitives == 0)
+            count += CountQBVHNodes(children[i]);
+    return count;
+}
+
+
+// BVH cache file layout: header, primitive index of each reference in the
+// ordered primitives padded to a multiple of 64 bytes, then the flattened
+// node array
+struct BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeFormat;
+    uint32_t keyLow, keyHigh;
+    uint32_t nReferences;
+    uint32_t totalNodes;
+    float bounds[6];
+    uint32_t nOrderEntries;
+    uint32_t pad;          // ensure 64 byte total size
+};
+
+
+static const char bvhCacheMagic[8] = { 'p', 'b', 'r', 't', 'B', 'V', 'H', 0 };
+static const uint32_t bvhCacheVersion = 3;
+static const uint32_t bvhCachePackFlag = 0x80000000;
+
+
+static inline void HashBytes(uint64_t *hash, const void *data, size_t size) {
+    // Accumulate FNV-1a hash of _data_
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+        *hash ^= bytes[i];
+        *hash *= 1099511628211ull;
+    }
+}
+
+
+static inline size_t BVHCacheNodeOffset(uint32_t nReferences) {
+    return sizeof(BVHCacheHeader) +
+           ((nReferences * sizeof(uint32_t) + 63) & ~size_t(63));
+}
+
+
+static void *MapBVHCacheFile(const string &filename, size_t *size) {
+#if defined(PBRT_IS_WINDOWS)
+    // Read cache file into memory
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0) { fclose(f); return NULL; }
+    void *mem = AllocAligned(len);
+    if (fread(mem, 1, len, f) != size_t(len)) {
+        fclose(f);
+        FreeAligned(mem);
+        return NULL;
+    }
+    fclose(f);
+    *size = len;
+    return mem;
+#else
+    // Map cache file copy-on-write so nodes may be updated in place
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return NULL;
+    *size = st.st_size;
+    return mem;
+#endif
+}
+
+
+static void UnmapBVHCacheFile(void *mem, size_t size) {
+#if defined(PBRT_IS_WINDOWS)
+    FreeAligned(mem);
+#else
+    munmap(mem, size);
+#endif
+}
+
+
+static uint64_t BVHCacheKey(const vector<Reference<Primitive> > &prims,
+        const vector<BVHPrimitiveInfo> &buildData,
+        uint32_t maxPrimsInNode, uint32_t splitMethod, uint32_t nodeFormat,
+        float duplicationBudget, bool packTriangles, bool clipsTriangles) {
+    // The BVH depends on primitive bounds and the build parameters, and
+    // on triangles' vertices when it's built from their clipped bounds
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t params[6] = { bvhCacheVersion, uint32_t(buildData.size()),
+                           maxPrimsInNode, splitMethod, nodeFormat,
+                           uint32_t(packTriangles) };
+    HashBytes(&hash, params, sizeof(params));
+    HashBytes(&hash, &duplicationBudget, sizeof(duplicationBudget));
+    for (uint32_t i = 0; i < buildData.size(); ++i) {
+        const BBox &b = buildData[i].bounds;
+        float v[6] = { b.pMin.x, b.pMin.y, b.pMin.z,
+                       b.pMax.x, b.pMax.y, b.pMax.z };
+        HashBytes(&hash, v, sizeof(v));
+        Point p[3];
+        if (clipsTriangles &&
+            prims[buildData[i].primitiveNumber]->GetTriangleVertices(p))
+            HashBytes(&hash, p, sizeof(p));
+    }
+    return hash;
+}
+
+
 // BVHAccel Method Definitions
+static const char *nodeFormatNames[] = { "binary", "qbvh", "quantized" };
+static const size_t nodeFormatSizes[] = { sizeof(LinearBVHNode),
+    sizeof(QBVHNode), sizeof(QuantizedBVHNode) };
 BVHAccel::BVHAccel(const vector<Reference<Primitive> > &p,
-                   uint32_t mp, const string &sm) {
+                   uint32_t mp, const string &sm, const string &nf,
+                   const string &cacheDir, float db, float rt, bool pt) {
     maxPrimsInNode = min(255u, mp);
+    duplicationBudget = max(0.f, db);
     for (uint32_t i = 0; i < p.size(); ++i)
         p[i]->FullyRefine(primitives);
     if (sm == "sah")         splitMethod = SPLIT_SAH;
     else if (sm == "middle") splitMethod = SPLIT_MIDDLE;
     else if (sm == "equal")  splitMethod = SPLIT_EQUAL_COUNTS;
+    else if (sm == "hlbvh")  splitMethod = SPLIT_HLBVH;
+    else if (sm == "sbvh")   splitMethod = SPLIT_SBVH;
     else {
         Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
                 sm.c_str());
         splitMethod = SPLIT_SAH;
     }
+    if (nf == "binary")         nodeFormat = NODES_BINARY;
+    else if (nf == "qbvh")      nodeFormat = NODES_QBVH;
+    else if (nf == "quantized") nodeFormat = NODES_QUANTIZED;
+    else {
+        Warning("BVH node format \"%s\" unknown.  Using \"binary\".",
+                nf.c_str());
+        nodeFormat = NODES_BINARY;
+    }
+
+    nodes = NULL;
+    qnodes = NULL;
+    quantizedNodes = NULL;
+    cacheMemory = NULL;
+    cacheMemorySize = 0;
+    nNodes = 0;
+    rebuildThreshold = rt;
+#ifdef PBRT_HAS_SSE
+    packTriangles = pt;
+#else
+    packTriangles = false;
+#endif
+    buildCost = 0.f;
+    refitTime0 = -INFINITY;
+    refitTime1 = INFINITY;
+    buildTree(cacheDir);
+}
 
-    if (primitives.size() == 0) {
-        nodes = NULL;
+
+void BVHAccel::buildTree(const string &cacheDir) {
+    if (primitives.size() == 0)
         return;
-    }
     // Build BVH from _primitives_
     PBRT_BVH_STARTED_CONSTRUCTION(this, primitives.size());
+    Timer buildTimer;
+    buildTimer.Start();
+    int nCores = NumSystemCores();
+    bool parallelBuild = (nCores > 1 && primitives.size() >= 4096);
 
     // Initialize _buildData_ array for primitives
-    vector<BVHPrimitiveInfo> buildData;
-    buildData.reserve(primitives.size());
-    for (uint32_t i = 0; i < primitives.size(); ++i) {
-        BBox bbox = primitives[i]->WorldBound();
-        buildData.push_back(BVHPrimitiveInfo(i, bbox));
+    vector<BVHPrimitiveInfo> buildData(primitives.size());
+    if (parallelBuild) {
+        vector<Task *> infoTasks;
+        uint32_t chunkSize = (primitives.size() + 4*nCores - 1) / (4*nCores);
+        for (uint32_t i = 0; i < primitives.size(); i += chunkSize)
+            infoTasks.push_back(new BVHPrimitiveInfoTask(primitives, buildData,
+                i, min(i + chunkSize, uint32_t(primitives.size()))));
+        EnqueueTasks(infoTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < infoTasks.size(); ++i)
+            delete infoTasks[i];
+    }
+    else {
+        for (uint32_t i = 0; i < primitives.size(); ++i)
+            buildData[i] = BVHPrimitiveInfo(i, primitives[i]->WorldBound());
+    }
+
+    // Use cached BVH for the same primitives and parameters if present
+    string cacheFile;
+    uint64_t cacheKey = 0;
+    if (cacheDir != "") {
+        cacheKey = BVHCacheKey(primitives, buildData, maxPrimsInNode,
+                               splitMethod, nodeFormat,
+                               splitMethod == SPLIT_SBVH ?
+                               duplicationBudget : 0.f, packTriangles,
+                               splitMethod == SPLIT_SBVH);
+        char name[64];
+        sprintf(name, "bvh-%08x%08x.cache", uint32_t(cacheKey >> 32),
+                uint32_t(cacheKey));
+        cacheFile = cacheDir + "/" + name;
+        if (loadCache(cacheFile, cacheKey)) {
+            buildCost = nodes ? sahCost() : 0.f;
+            Info("BVH loaded from \"%s\" for %d primitives in %.3fs",
+                 cacheFile.c_str(), (int)buildData.size(), buildTimer.Time());
+            PBRT_BVH_FINISHED_CONSTRUCTION(this);
+            return;
+        }
     }
 
     // Recursively build BVH tree for primitives
     MemoryArena buildArena;
     uint32_t totalNodes = 0;
-    vector<Reference<Primitive> > orderedPrims;
-    orderedPrims.reserve(primitives.size());
-    BVHBuildNode *root = recursiveBuild(buildArena, buildData, 0,
-                                        primitives.size(), &totalNodes,
-                                        orderedPrims);
+    vector<Reference<Primitive> > orderedPrims(primitives.size());
+    BVHBuildNode *root;
+    vector<Task *> subtreeTasks;
+    int nThreads = 1;
+    if (splitMethod == SPLIT_HLBVH) {
+        root = HLBVHBuild(buildArena, buildData, &totalNodes, orderedPrims,
+                          subtreeTasks);
+        nThreads = nCores;
+    }
+    else if (splitMethod == SPLIT_SBVH) {
+        // Build BVH with spatial splits over references to _primitives_
+        vector<BVHReference> refs(primitives.size());
+        BBox rootBounds;
+        for (uint32_t i = 0; i < primitives.size(); ++i) {
+            refs[i] = BVHReference(i, buildData[i].bounds);
+            rootBounds = Union(rootBounds, buildData[i].bounds);
+        }
+        SBVHBuildState state;
+        state.minOverlapArea = 1e-5f * rootBounds.SurfaceArea();
+        state.nReferences = primitives.size();
+        state.maxReferences = uint32_t(primitives.size() *
+                                       (1.f + duplicationBudget));
+        orderedPrims.clear();
+        root = SBVHBuild(buildArena, refs, &totalNodes, orderedPrims, state, 0);
+    }
+    else if (parallelBuild) {
+        // Build top of BVH serially, deferring subtrees to _BVHSubtreeTask_s
+        uint32_t subtreeMaxPrims = max(1024u,
+            uint32_t(primitives.size() / (8 * nCores)));
+        root = recursiveBuild(buildArena, buildData, 0, primitives.size(),
+                              &totalNodes, orderedPrims, &subtreeTasks,
+                              subtreeMaxPrims);
+        EnqueueTasks(subtreeTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < subtreeTasks.size(); ++i)
+            totalNodes += ((BVHSubtreeTask *)subtreeTasks[i])->totalNodes;
+        nThreads = nCores;
+    }
+    else
+        root = recursiveBuild(buildArena, buildData, 0, primitives.size(),
+                              &totalNodes, orderedPrims);
+
+    // Record primitive order for BVH cache before reordering _primitives_
+    vector<uint32_t> primOrder;
+    if (cacheFile != "") {
+        vector<std::pair<const Primitive *, uint32_t> >
+            primIndex(primitives.size());
+        for (uint32_t i = 0; i < primitives.size(); ++i)
+            primIndex[i] = std::make_pair(primitives[i].GetPtr(), i);
+        std::sort(primIndex.begin(), primIndex.end());
+        primOrder.resize(orderedPrims.size());
+        for (uint32_t i = 0; i < orderedPrims.size(); ++i)
+            primOrder[i] = std::lower_bound(primIndex.begin(), primIndex.end(),
+                std::make_pair(orderedPrims[i].GetPtr(), 0u))->second;
+    }
+    uint32_t nPrims = primitives.size();
     primitives.swap(orderedPrims);
-        Info("BVH created with %d nodes for %d primitives (%.2f MB)", totalNodes,
-             (int)primitives.size(), float(totalNodes * sizeof(LinearBVHNode))/(1024.f*1024.f));
+    uint32_t nReferences = primitives.size(), nPacks = 0;
+    if (packTriangles) {
+        // Replace triangles in leaves with _BVHTrianglePack_s
+        vector<Reference<Primitive> > packedPrims;
+        vector<uint32_t> packedOrder;
+        packedPrims.reserve(primitives.size());
+        nPacks = packLeafTriangles(root, packedPrims, primOrder, packedOrder);
+        primitives.swap(packedPrims);
+        primOrder.swap(packedOrder);
+    }
 
     // Compute representation of depth-first traversal of BVH tree
-    nodes = AllocAligned<LinearBVHNode>(totalNodes);
-    for (uint32_t i = 0; i < totalNodes; ++i)
-        new (&nodes[i]) LinearBVHNode;
-    uint32_t offset = 0;
-    flattenBVHTree(root, &offset);
+    bounds = root->bounds;
+    uint32_t offset = 0, nodeBytes;
+    if (nodeFormat == NODES_QUANTIZED) {
+        bool finite = true;
+        for (int axis = 0; axis < 3; ++axis)
+            if (isinf(bounds.pMin[axis]) || isinf(bounds.pMax[axis]))
+                finite = false;
+        if (!finite || totalNodes > quantizedOffsetMask ||
+            primitives.size() > quantizedOffsetMask) {
+            Warning("Unable to use \"quantized\" BVH node format for this "
+                    "scene.  Using \"binary\".");
+            nodeFormat = NODES_BINARY;
+            cacheFile = "";
+        }
+    }
+    if (nodeFormat == NODES_QUANTIZED) {
+        quantizedNodes = AllocAligned<QuantizedBVHNode>(totalNodes);
+        NumaInterleave(quantizedNodes, totalNodes * sizeof(QuantizedBVHNode));
+        flattenQuantizedTree(root, bounds, &offset);
+        nodeBytes = totalNodes * sizeof(QuantizedBVHNode);
+    }
+    else if (nodeFormat == NODES_QBVH) {
+        totalNodes = CountQBVHNodes(root);
+        qnodes = AllocAligned<QBVHNode>(totalNodes);
+        NumaInterleave(qnodes, totalNodes * sizeof(QBVHNode));
+        for (uint32_t i = 0; i < totalNodes; ++i)
+            new (&qnodes[i]) QBVHNode;
+        flattenQBVHTree(root, &offset);
+        nodeBytes = totalNodes * sizeof(QBVHNode);
+    }
+    else {
+        nodes = AllocAligned<LinearBVHNode>(totalNodes);
+        NumaInterleave(nodes, totalNodes * sizeof(LinearBVHNode));
+        for (uint32_t i = 0; i < totalNodes; ++i)
+            new (&nodes[i]) LinearBVHNode;
+        flattenBVHTree(root, &offset);
+        nodeBytes = totalNodes * sizeof(LinearBVHNode);
+    }
     Assert(offset == totalNodes);
+    nNodes = totalNodes;
+    STAT_ADD(bvhNodeBytes, nodeBytes);
+    for (uint32_t i = 0; i < subtreeTasks.size(); ++i)
+        delete subtreeTasks[i];
+    buildCost = nodes ? sahCost() : 0.f;
+    Info("BVH created with %d %s nodes for %d primitives (%.2f MB, %.1f "
+         "bytes/primitive) in %.3fs using %d thread(s)", totalNodes,
+         nodeFormatNames[nodeFormat], (int)nPrims,
+         float(nodeBytes)/(1024.f*1024.f), float(nodeBytes)/float(nPrims),
+         buildTimer.Time(), nThreads);
+    if (nodes)
+        Info("BVH SAH cost %.2f", buildCost);
+    if (nReferences > nPrims)
+        Info("BVH spatial splits added %d primitive references (%.1f%%)",
+             int(nReferences - nPrims), 100.f * (nReferences - nPrims) / nPrims);
+    if (nPacks > 0)
+        Info("BVH packed %d triangles into %d four-wide leaf primitives",
+             int(nReferences - primitives.size() + nPacks), int(nPacks));
+    if (cacheFile != "")
+        writeCache(cacheFile, cacheKey, primOrder, totalNodes);
     PBRT_BVH_FINISHED_CONSTRUCTION(this);
 }
 
 
+bool BVHAccel::loadCache(const string &filename, uint64_t key) {
+    size_t size;
+    void *mem = MapBVHCacheFile(filename, &size);
+    if (!mem) return false;
+
+    // Validate cache file contents against current primitives
+    if (size < sizeof(BVHCacheHeader)) {
+        Warning("Ignoring invalid BVH cache file \"%s\".", filename.c_str());
+        UnmapBVHCacheFile(mem, size);
+        return false;
+    }
+    const BVHCacheHeader *header = (const BVHCacheHeader *)mem;
+    uint32_t nPrims = primitives.size();
+    bool valid =
+        memcmp(header->magic, bvhCacheMagic, sizeof(bvhCacheMagic)) == 0 &&
+        header->version == bvhCacheVersion &&
+        header->nodeFormat == uint32_t(nodeFormat) &&
+        header->keyLow == uint32_t(key) &&
+        header->keyHigh == uint32_t(key >> 32) &&
+        header->totalNodes > 0 &&
+        header->nReferences <= header->nOrderEntries;
+    size_t nodeOffset = valid ? BVHCacheNodeOffset(header->nOrderEntries) : 0;
+    valid = valid && size == nodeOffset +
+        size_t(header->totalNodes) * nodeFormatSizes[nodeFormat];
+    const uint32_t *order =
+        (const uint32_t *)((const char *)mem + sizeof(BVHCacheHeader));
+
+    // Reorder _primitives_, recreating packed triangles
+    vector<Reference<Primitive> > orderedPrims;
+    if (valid) orderedPrims.reserve(header->nReferences);
+    for (uint32_t i = 0; valid && i < header->nOrderEntries; ++i) {
+        if (order[i] & bvhCachePackFlag) {
+            uint32_t n = order[i] & ~bvhCachePackFlag;
+            valid = packTriangles && n >= 2 && n <= 4 &&
+                    i + n < header->nOrderEntries;
+            Reference<Primitive> packed[4];
+            for (uint32_t j = 0; valid && j < n; ++j) {
+                valid = order[i + 1 + j] < nPrims;
+                if (valid) packed[j] = primitives[order[i + 1 + j]];
+            }
+            Primitive *pack = valid ? MakeTrianglePack(packed, n) : NULL;
+            valid = pack != NULL;
+            if (valid) orderedPrims.push_back(pack);
+            i += n;
+        }
+        else {
+            valid = order[i] < nPrims;
+            if (valid) orderedPrims.push_back(primitives[order[i]]);
+        }
+    }
+    if (!valid || orderedPrims.size() != header->nReferences) {
+        Warning("Ignoring invalid BVH cache file \"%s\".", filename.c_str());
+        UnmapBVHCacheFile(mem, size);
+        return false;
+    }
+    primitives.swap(orderedPrims);
+    bounds = BBox(Point(header->bounds[0], header->bounds[1], header->bounds[2]),
+                  Point(header->bounds[3], header->bounds[4], header->bounds[5]));
+    if (nodeFormat == NODES_QUANTIZED)
+        quantizedNodes = (QuantizedBVHNode *)((char *)mem + nodeOffset);
+    else if (nodeFormat == NODES_QBVH)
+        qnodes = (QBVHNode *)((char *)mem + nodeOffset);
+    else
+        nodes = (LinearBVHNode *)((char *)mem + nodeOffset);
+    nNodes = header->totalNodes;
+    cacheMemory = mem;
+    cacheMemorySize = size;
+    return true;
+}
+
+
+void BVHAccel::writeCache(const string &filename, uint64_t key,
+        const vector<uint32_t> &primOrder, uint32_t totalNodes) const {
+    // Initialize _BVHCacheHeader_ for BVH
+    BVHCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+    header.version = bvhCacheVersion;
+    header.nodeFormat = nodeFormat;
+    header.keyLow = uint32_t(key);
+    header.keyHigh = uint32_t(key >> 32);
+    header.nReferences = primitives.size();
+    header.totalNodes = totalNodes;
+    header.nOrderEntries = primOrder.size();
+    for (int i = 0; i < 3; ++i) {
+        header.bounds[i] = bounds.pMin[i];
+        header.bounds[3+i] = bounds.pMax[i];
+    }
+    vector<uint32_t> orderData((BVHCacheNodeOffset(primOrder.size()) -
+                                sizeof(header)) / sizeof(uint32_t), 0);
+    std::copy(primOrder.begin(), primOrder.end(), orderData.begin());
+    const void *nodeData = nodes;
+    if (qnodes) nodeData = qnodes;
+    if (quantizedNodes) nodeData = quantizedNodes;
+    size_t nodeBytes = totalNodes * nodeFormatSizes[nodeFormat];
+
+    // Write cache to temporary file and move it into place
+    string tmpName = filename + ".tmp";
+    FILE *f = fopen(tmpName.c_str(), "wb");
+    if (!f) {
+        Warning("Unable to create BVH cache file \"%s\".", tmpName.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(&orderData[0], sizeof(uint32_t), orderData.size(), f) ==
+            orderData.size() &&
+        fwrite(nodeData, 1, nodeBytes, f) == nodeBytes;
+    if (fclose(f) != 0) ok = false;
+#if defined(PBRT_IS_WINDOWS)
+    if (ok) remove(filename.c_str());
+#endif
+    if (!ok || rename(tmpName.c_str(), filename.c_str()) != 0) {
+        Warning("Unable to write BVH cache file \"%s\".", filename.c_str());
+        remove(tmpName.c_str());
+    }
+}
+
+
 BBox BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : BBox();
+    return bounds;
 }
 
 
 BVHBuildNode *BVHAccel::recursiveBuild(MemoryArena &buildArena,
         vector<BVHPrimitiveInfo> &buildData, uint32_t start,
         uint32_t end, uint32_t *totalNodes,
-        vector<Reference<Primitive> > &orderedPrims) {
+        vector<Reference<Primitive> > &orderedPrims,
+        vector<Task *> *subtreeTasks, uint32_t subtreeMaxPrims) {
     Assert(start != end);
     (*totalNodes)++;
     BVHBuildNode *node = buildArena.Alloc<BVHBuildNode>();
-    // Compute bounds of all primitives in BVH node
-    BBox bbox;
-    for (uint32_t i = start; i < end; ++i)
-        bbox = Union(bbox, buildData[i].bounds);
+    // Compute bounds of all primitives and centroids in BVH node
+    BBox bbox, centroidBounds;
     uint32_t nPrimitives = end - start;
+    if (subtreeTasks && nPrimitives >= parallelRangeMinPrims) {
+        vector<BVHRangeTask *> rangeTasks;
+        ParallelRangeTasks(buildData, start, end, -1, BBox(), rangeTasks);
+        for (uint32_t i = 0; i < rangeTasks.size(); ++i) {
+            bbox = Union(bbox, rangeTasks[i]->bounds);
+            centroidBounds = Union(centroidBounds,
+                                   rangeTasks[i]->centroidBounds);
+            delete rangeTasks[i];
+        }
+    }
+    else
+        BVHRangeBounds(buildData, start, end, &bbox, &centroidBounds);
+    if (subtreeTasks && nPrimitives <= subtreeMaxPrims) {
+        // Defer construction of subtree to a _BVHSubtreeTask_
+        node->bounds = bbox;
+        subtreeTasks->push_back(new BVHSubtreeTask(this, node, buildData,
+                                                   start, end, orderedPrims));
+        return node;
+    }
     if (nPrimitives == 1) {
         // Create leaf _BVHBuildNode_
-        uint32_t firstPrimOffset = orderedPrims.size();
         for (uint32_t i = start; i < end; ++i) {
             uint32_t primNum = buildData[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            orderedPrims[i] = primitives[primNum];
         }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bbox);
+        node->InitLeaf(start, nPrimitives, bbox);
     }
     else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        BBox centroidBounds;
-        for (uint32_t i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, buildData[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         uint32_t mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            uint32_t firstPrimOffset = orderedPrims.size();
             for (uint32_t i = start; i < end; ++i) {
                 uint32_t primNum = buildData[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
+                orderedPrims[i] = primitives[primNum];
             }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bbox);
+            node->InitLeaf(start, nPrimitives, bbox);
             return node;
         }
 
@@ -272,32 +1521,33 @@ BVHBuildNode *BVHAccel::recursiveBuild(MemoryArena &buildArena,
         }
         case SPLIT_SAH: default: {
             // Partition primitives using approximate SAH
-            if (nPrimitives <= 4) {
+            bool packLeaf = packTriangles && nPrimitives <= maxPrimsInNode &&
+                AllTriangles(primitives, buildData, start, end);
+            if (nPrimitives <= 4 && !packLeaf) {
                 // Partition primitives into equally-sized subsets
                 mid = (start + end) / 2;
                 std::nth_element(&buildData[start], &buildData[mid],
                                  &buildData[end-1]+1, ComparePoints(dim));
             }
             else {
-                // Allocate _BucketInfo_ for SAH partition buckets
-                const int nBuckets = 12;
-                struct BucketInfo {
-                    BucketInfo() { count = 0; }
-                    int count;
-                    BBox bounds;
-                };
-                BucketInfo buckets[nBuckets];
-
                 // Initialize _BucketInfo_ for SAH partition buckets
-                for (uint32_t i = start; i < end; ++i) {
-                    int b = nBuckets *
-                        ((buildData[i].centroid[dim] - centroidBounds.pMin[dim]) /
-                         (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
-                    if (b == nBuckets) b = nBuckets-1;
-                    Assert(b >= 0 && b < nBuckets);
-                    buckets[b].count++;
-                    buckets[b].bounds = Union(buckets[b].bounds, buildData[i].bounds);
+                BucketInfo buckets[nBuckets];
+                if (subtreeTasks && nPrimitives >= parallelRangeMinPrims) {
+                    vector<BVHRangeTask *> rangeTasks;
+                    ParallelRangeTasks(buildData, start, end, dim,
+                                       centroidBounds, rangeTasks);
+                    for (uint32_t i = 0; i < rangeTasks.size(); ++i) {
+                        for (int b = 0; b < nBuckets; ++b) {
+                            buckets[b].count += rangeTasks[i]->buckets[b].count;
+                            buckets[b].bounds = Union(buckets[b].bounds,
+                                rangeTasks[i]->buckets[b].bounds);
+                        }
+                        delete rangeTasks[i];
+                    }
                 }
+                else
+                    BVHRangeBuckets(buildData, start, end, dim,
+                                    centroidBounds, buckets);
 
                 // Compute costs for splitting after each bucket
                 float cost[nBuckets-1];
@@ -327,8 +1577,9 @@ BVHBuildNode *BVHAccel::recursiveBuild(MemoryArena &buildArena,
                 }
 
                 // Either create leaf or split primitives at selected SAH bucket
-                if (nPrimitives > maxPrimsInNode ||
-                    minCost < nPrimitives) {
+                float leafCost = packLeaf ? float((nPrimitives + 3) / 4) :
+                                            float(nPrimitives);
+                if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
                     BVHPrimitiveInfo *pmid = std::partition(&buildData[start],
                         &buildData[end-1]+1,
                         CompareToBucket(minCostSplit, nBuckets, dim, centroidBounds));
@@ -337,12 +1588,11 @@ BVHBuildNode *BVHAccel::recursiveBuild(MemoryArena &buildArena,
                 
                 else {
                     // Create leaf _BVHBuildNode_
-                    uint32_t firstPrimOffset = orderedPrims.size();
                     for (uint32_t i = start; i < end; ++i) {
                         uint32_t primNum = buildData[i].primitiveNumber;
-                        orderedPrims.push_back(primitives[primNum]);
+                        orderedPrims[i] = primitives[primNum];
                     }
-                    node->InitLeaf(firstPrimOffset, nPrimitives, bbox);
+                    node->InitLeaf(start, nPrimitives, bbox);
                     return node;
                 }
             }
@@ -351,10 +1601,438 @@ BVHBuildNode *BVHAccel::recursiveBuild(MemoryArena &buildArena,
         }
         node->InitInterior(dim,
                            recursiveBuild(buildArena, buildData, start, mid,
-                                          totalNodes, orderedPrims),
+                                          totalNodes, orderedPrims,
+                                          subtreeTasks, subtreeMaxPrims),
                            recursiveBuild(buildArena, buildData, mid, end,
-                                          totalNodes, orderedPrims));
+                                          totalNodes, orderedPrims,
+                                          subtreeTasks, subtreeMaxPrims));
+    }
+    return node;
+}
+
+
+BVHBuildNode *BVHAccel::SBVHBuild(MemoryArena &buildArena,
+        vector<BVHReference> &refs, uint32_t *totalNodes,
+        vector<Reference<Primitive> > &orderedPrims, SBVHBuildState &state,
+        int depth) {
+    (*totalNodes)++;
+    BVHBuildNode *node = buildArena.Alloc<BVHBuildNode>();
+    // Compute bounds of all references and centroids in BVH node
+    uint32_t nRefs = refs.size();
+    BBox bbox, centroidBounds;
+    for (uint32_t i = 0; i < nRefs; ++i) {
+        bbox = Union(bbox, refs[i].bounds);
+        centroidBounds = Union(centroidBounds,
+            .5f * refs[i].bounds.pMin + .5f * refs[i].bounds.pMax);
+    }
+    float invArea = 1.f / bbox.SurfaceArea();
+
+    // Find SAH object split with lowest cost over all axes
+    float objectCost = INFINITY;
+    int objectAxis = -1, objectSplit = 0;
+    BBox objectBounds[2];
+    for (int axis = 0; axis < 3 && nRefs > 1; ++axis) {
+        float cMin = centroidBounds.pMin[axis], cMax = centroidBounds.pMax[axis];
+        if (cMax == cMin) continue;
+        BucketInfo buckets[nBuckets];
+        for (uint32_t i = 0; i < nRefs; ++i) {
+            float c = .5f * (refs[i].bounds.pMin[axis] +
+                             refs[i].bounds.pMax[axis]);
+            int b = min(int(nBuckets * ((c - cMin) / (cMax - cMin))),
+                        nBuckets - 1);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, refs[i].bounds);
+        }
+        BBox rightBounds[nBuckets-1], b0;
+        int rightCount[nBuckets-1], count0 = 0, count1 = 0;
+        for (int i = nBuckets-1; i > 0; --i) {
+            b0 = Union(b0, buckets[i].bounds);
+            count1 += buckets[i].count;
+            rightBounds[i-1] = b0;
+            rightCount[i-1] = count1;
+        }
+        b0 = BBox();
+        for (int i = 0; i < nBuckets-1; ++i) {
+            b0 = Union(b0, buckets[i].bounds);
+            count0 += buckets[i].count;
+            if (count0 == 0 || rightCount[i] == 0) continue;
+            float cost = .125f + (count0 * b0.SurfaceArea() +
+                rightCount[i] * rightBounds[i].SurfaceArea()) * invArea;
+            if (cost < objectCost) {
+                objectCost = cost;
+                objectAxis = axis;
+                objectSplit = i;
+                objectBounds[0] = b0;
+                objectBounds[1] = rightBounds[i];
+            }
+        }
+    }
+
+    // Find spatial split with lowest cost if object split children overlap
+    float spatialCost = INFINITY;
+    int spatialAxis = -1, spatialSplit = 0;
+    BBox spatialBounds[2];
+    int spatialCount[2];
+    float overlapArea = INFINITY;
+    if (objectAxis >= 0) {
+        BBox overlap = ::Intersect(objectBounds[0], objectBounds[1]);
+        overlapArea = (overlap.pMin.x <= overlap.pMax.x &&
+                       overlap.pMin.y <= overlap.pMax.y &&
+                       overlap.pMin.z <= overlap.pMax.z) ?
+            overlap.SurfaceArea() : 0.f;
+    }
+    if (nRefs > 1 && overlapArea > state.minOverlapArea &&
+        depth < maxSpatialSplitDepth &&
+        state.nReferences < state.maxReferences) {
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = bbox.pMin[axis], hi = bbox.pMax[axis];
+            if (!(hi > lo)) continue;
+            // Clip references into spatial bins along _axis_
+            float binWidth = (hi - lo) / nSpatialBins;
+            BBox binBounds[nSpatialBins];
+            int entries[nSpatialBins], exits[nSpatialBins];
+            for (int b = 0; b < nSpatialBins; ++b)
+                entries[b] = exits[b] = 0;
+            for (uint32_t i = 0; i < nRefs; ++i) {
+                const BVHReference &ref = refs[i];
+                int first = Clamp(Float2Int((ref.bounds.pMin[axis] - lo) /
+                                            binWidth), 0, nSpatialBins-1);
+                int last = Clamp(Float2Int((ref.bounds.pMax[axis] - lo) /
+                                           binWidth), first, nSpatialBins-1);
+                BVHReference cur = ref;
+                for (int b = first; b < last; ++b) {
+                    BVHReference left, right;
+                    SplitReference(primitives[ref.primitiveNumber].GetPtr(),
+                                   cur, axis, lo + (b + 1) * binWidth,
+                                   &left, &right);
+                    binBounds[b] = Union(binBounds[b], left.bounds);
+                    cur = right;
+                }
+                binBounds[last] = Union(binBounds[last], cur.bounds);
+                entries[first]++;
+                exits[last]++;
+            }
+
+            // Compute costs for splitting at each bin boundary
+            BBox rightBounds[nSpatialBins-1], b0;
+            int rightCount[nSpatialBins-1], count0 = 0, count1 = 0;
+            for (int b = nSpatialBins-1; b > 0; --b) {
+                b0 = Union(b0, binBounds[b]);
+                count1 += exits[b];
+                rightBounds[b-1] = b0;
+                rightCount[b-1] = count1;
+            }
+            b0 = BBox();
+            for (int b = 0; b < nSpatialBins-1; ++b) {
+                b0 = Union(b0, binBounds[b]);
+                count0 += entries[b];
+                if (count0 == 0 || rightCount[b] == 0) continue;
+                float cost = .125f + (count0 * b0.SurfaceArea() +
+                    rightCount[b] * rightBounds[b].SurfaceArea()) * invArea;
+                if (cost < spatialCost) {
+                    spatialCost = cost;
+                    spatialAxis = axis;
+                    spatialSplit = b + 1;
+                    spatialBounds[0] = b0;
+                    spatialBounds[1] = rightBounds[b];
+                    spatialCount[0] = count0;
+                    spatialCount[1] = rightCount[b];
+                }
+            }
+        }
+    }
+
+    // Create leaf _BVHBuildNode_ if splitting isn't worthwhile
+    float minCost = min(objectCost, spatialCost);
+    bool forceSplit = nRefs > maxPrimsInNode;
+    if (nRefs == 1 || (!forceSplit && minCost >= nRefs)) {
+        uint32_t firstPrimOffset = orderedPrims.size();
+        for (uint32_t i = 0; i < nRefs; ++i)
+            orderedPrims.push_back(primitives[refs[i].primitiveNumber]);
+        node->InitLeaf(firstPrimOffset, nRefs, bbox);
+        return node;
+    }
+
+    // Partition references into two sets
+    vector<BVHReference> left, right;
+    int axis = -1;
+    if (spatialAxis >= 0 && spatialCost < objectCost) {
+        // Split references at spatial split plane, unsplitting where cheaper
+        axis = spatialAxis;
+        float lo = bbox.pMin[axis];
+        float binWidth = (bbox.pMax[axis] - lo) / nSpatialBins;
+        float pos = lo + spatialSplit * binWidth;
+        BBox leftBounds = spatialBounds[0], rightBounds = spatialBounds[1];
+        int nLeft = spatialCount[0], nRight = spatialCount[1];
+        for (uint32_t i = 0; i < nRefs; ++i) {
+            const BVHReference &ref = refs[i];
+            if (ref.bounds.pMax[axis] <= pos)
+                left.push_back(ref);
+            else if (ref.bounds.pMin[axis] >= pos)
+                right.push_back(ref);
+            else {
+                float splitCost = leftBounds.SurfaceArea() * nLeft +
+                                  rightBounds.SurfaceArea() * nRight;
+                float leftCost = Union(leftBounds, ref.bounds).SurfaceArea() *
+                    nLeft + rightBounds.SurfaceArea() * (nRight - 1);
+                float rightCost = leftBounds.SurfaceArea() * (nLeft - 1) +
+                    Union(rightBounds, ref.bounds).SurfaceArea() * nRight;
+                if (state.nReferences >= state.maxReferences)
+                    splitCost = INFINITY;
+                if (leftCost < splitCost && leftCost <= rightCost) {
+                    left.push_back(ref);
+                    leftBounds = Union(leftBounds, ref.bounds);
+                    --nRight;
+                }
+                else if (rightCost < splitCost) {
+                    right.push_back(ref);
+                    rightBounds = Union(rightBounds, ref.bounds);
+                    --nLeft;
+                }
+                else {
+                    BVHReference l, r;
+                    SplitReference(primitives[ref.primitiveNumber].GetPtr(),
+                                   ref, axis, pos, &l, &r);
+                    left.push_back(l);
+                    right.push_back(r);
+                    state.nReferences++;
+                }
+            }
+        }
+        if (left.size() == 0 || right.size() == 0) {
+            axis = -1;
+            left.clear();
+            right.clear();
+        }
+    }
+    if (axis < 0 && objectAxis >= 0) {
+        // Partition references at SAH object split bucket
+        axis = objectAxis;
+        float cMin = centroidBounds.pMin[axis], cMax = centroidBounds.pMax[axis];
+        for (uint32_t i = 0; i < nRefs; ++i) {
+            float c = .5f * (refs[i].bounds.pMin[axis] +
+                             refs[i].bounds.pMax[axis]);
+            int b = min(int(nBuckets * ((c - cMin) / (cMax - cMin))),
+                        nBuckets - 1);
+            if (b <= objectSplit) left.push_back(refs[i]);
+            else                  right.push_back(refs[i]);
+        }
+    }
+    if (axis < 0) {
+        // Partition references into equally-sized subsets
+        axis = bbox.MaximumExtent();
+        left.assign(refs.begin(), refs.begin() + nRefs / 2);
+        right.assign(refs.begin() + nRefs / 2, refs.end());
+    }
+    vector<BVHReference>().swap(refs);
+    BVHBuildNode *c0 = SBVHBuild(buildArena, left, totalNodes, orderedPrims,
+                                 state, depth + 1);
+    BVHBuildNode *c1 = SBVHBuild(buildArena, right, totalNodes, orderedPrims,
+                                 state, depth + 1);
+    node->InitInterior(axis, c0, c1);
+    return node;
+}
+
+
+BVHBuildNode *BVHAccel::HLBVHBuild(MemoryArena &buildArena,
+        const vector<BVHPrimitiveInfo> &buildData, uint32_t *totalNodes,
+        vector<Reference<Primitive> > &orderedPrims,
+        vector<Task *> &treeletTasks) {
+    // Compute bounding box of all primitive centroids
+    BBox bounds;
+    for (uint32_t i = 0; i < buildData.size(); ++i)
+        bounds = Union(bounds, buildData[i].centroid);
+
+    // Compute Morton indices of primitives
+    uint32_t nChunks = max(1u, min(uint32_t(4 * NumSystemCores()),
+                                   uint32_t(buildData.size() / 1024)));
+    uint32_t chunkSize = (buildData.size() + nChunks - 1) / nChunks;
+    vector<MortonPrimitive> mortonPrims(buildData.size());
+    vector<Task *> mortonTasks;
+    for (uint32_t i = 0; i < buildData.size(); i += chunkSize)
+        mortonTasks.push_back(new MortonCodeTask(buildData, bounds,
+            &mortonPrims[0], i, min(i + chunkSize, uint32_t(buildData.size()))));
+    EnqueueTasks(mortonTasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < mortonTasks.size(); ++i)
+        delete mortonTasks[i];
+
+    // Radix sort primitive Morton indices
+    RadixSort(&mortonPrims, nChunks);
+
+    // Create LBVH treelets at bottom of BVH
+    // Find intervals of primitives for each treelet
+    for (uint32_t start = 0, end = 1; end <= mortonPrims.size(); ++end) {
+        uint32_t mask = 0x3ffc0000;
+        if (end == mortonPrims.size() ||
+            ((mortonPrims[start].mortonCode & mask) !=
+             (mortonPrims[end].mortonCode & mask))) {
+            // Add entry to _treeletTasks_ for this treelet
+            treeletTasks.push_back(new LBVHTreeletTask(this, buildData,
+                &mortonPrims[0], start, end, orderedPrims));
+            start = end;
+        }
+    }
+
+    // Create LBVHs for treelets in parallel
+    EnqueueTasks(treeletTasks);
+    WaitForAllTasks();
+
+    // Create and return SAH BVH from LBVH treelets
+    vector<BVHBuildNode *> finishedTreelets;
+    finishedTreelets.reserve(treeletTasks.size());
+    for (uint32_t i = 0; i < treeletTasks.size(); ++i) {
+        LBVHTreeletTask *task = (LBVHTreeletTask *)treeletTasks[i];
+        finishedTreelets.push_back(task->root);
+        *totalNodes += task->totalNodes;
+    }
+    return buildUpperSAH(buildArena, finishedTreelets, 0,
+                         finishedTreelets.size(), totalNodes);
+}
+
+
+BVHBuildNode *BVHAccel::emitLBVH(MemoryArena &buildArena,
+        const vector<BVHPrimitiveInfo> &buildData,
+        const MortonPrimitive *mortonPrims, uint32_t start, uint32_t end,
+        uint32_t *totalNodes, vector<Reference<Primitive> > &orderedPrims,
+        int bitIndex) {
+    uint32_t nPrimitives = end - start;
+    if (nPrimitives <= maxPrimsInNode) {
+        // Create and return leaf node of LBVH treelet
+        (*totalNodes)++;
+        BVHBuildNode *node = buildArena.Alloc<BVHBuildNode>();
+        BBox bbox;
+        for (uint32_t i = start; i < end; ++i) {
+            uint32_t primitiveIndex = mortonPrims[i].primitiveIndex;
+            orderedPrims[i] = primitives[primitiveIndex];
+            bbox = Union(bbox, buildData[primitiveIndex].bounds);
+        }
+        node->InitLeaf(start, nPrimitives, bbox);
+        return node;
     }
+    uint32_t splitOffset;
+    if (bitIndex == -1) {
+        // Split primitives with identical Morton codes into equal halves
+        splitOffset = (start + end) / 2;
+    }
+    else {
+        uint32_t mask = 1 << bitIndex;
+        // Advance to next subtree level if there's no LBVH split for this bit
+        if ((mortonPrims[start].mortonCode & mask) ==
+            (mortonPrims[end-1].mortonCode & mask))
+            return emitLBVH(buildArena, buildData, mortonPrims, start, end,
+                            totalNodes, orderedPrims, bitIndex - 1);
+
+        // Find LBVH split point for this dimension
+        uint32_t searchStart = start, searchEnd = end - 1;
+        while (searchStart + 1 != searchEnd) {
+            Assert(searchStart != searchEnd);
+            uint32_t mid = (searchStart + searchEnd) / 2;
+            if ((mortonPrims[searchStart].mortonCode & mask) ==
+                (mortonPrims[mid].mortonCode & mask))
+                searchStart = mid;
+            else {
+                Assert((mortonPrims[mid].mortonCode & mask) ==
+                       (mortonPrims[searchEnd].mortonCode & mask));
+                searchEnd = mid;
+            }
+        }
+        splitOffset = searchEnd;
+    }
+    Assert(splitOffset > start && splitOffset < end);
+
+    // Create and return interior LBVH node
+    (*totalNodes)++;
+    BVHBuildNode *node = buildArena.Alloc<BVHBuildNode>();
+    // Once all bits are used, keep halving primitives with equal codes
+    int childBitIndex = max(bitIndex - 1, -1);
+    BVHBuildNode *lbvh0 = emitLBVH(buildArena, buildData, mortonPrims,
+        start, splitOffset, totalNodes, orderedPrims, childBitIndex);
+    BVHBuildNode *lbvh1 = emitLBVH(buildArena, buildData, mortonPrims,
+        splitOffset, end, totalNodes, orderedPrims, childBitIndex);
+    int axis = bitIndex >= 0 ? bitIndex % 3 : 0;
+    node->InitInterior(axis, lbvh0, lbvh1);
+    return node;
+}
+
+
+BVHBuildNode *BVHAccel::buildUpperSAH(MemoryArena &buildArena,
+        vector<BVHBuildNode *> &treeletRoots, uint32_t start, uint32_t end,
+        uint32_t *totalNodes) {
+    Assert(start < end);
+    uint32_t nNodes = end - start;
+    if (nNodes == 1) return treeletRoots[start];
+    (*totalNodes)++;
+    BVHBuildNode *node = buildArena.Alloc<BVHBuildNode>();
+
+    // Compute bounds of all nodes under this HLBVH node
+    BBox bbox;
+    for (uint32_t i = start; i < end; ++i)
+        bbox = Union(bbox, treeletRoots[i]->bounds);
+
+    // Compute bound of HLBVH node centroids, choose split dimension _dim_
+    BBox centroidBounds;
+    for (uint32_t i = start; i < end; ++i) {
+        Point centroid = .5f * treeletRoots[i]->bounds.pMin +
+                         .5f * treeletRoots[i]->bounds.pMax;
+        centroidBounds = Union(centroidBounds, centroid);
+    }
+    int dim = centroidBounds.MaximumExtent();
+    uint32_t mid = (start + end) / 2;
+    if (centroidBounds.pMax[dim] != centroidBounds.pMin[dim]) {
+        // Initialize _BucketInfo_ for HLBVH SAH partition buckets
+        BucketInfo buckets[nBuckets];
+        for (uint32_t i = start; i < end; ++i) {
+            float centroid = .5f * treeletRoots[i]->bounds.pMin[dim] +
+                             .5f * treeletRoots[i]->bounds.pMax[dim];
+            int b = nBuckets * ((centroid - centroidBounds.pMin[dim]) /
+                        (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+            if (b == nBuckets) b = nBuckets - 1;
+            Assert(b >= 0 && b < nBuckets);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds,
+                                      treeletRoots[i]->bounds);
+        }
+
+        // Compute costs for splitting after each bucket
+        float cost[nBuckets - 1];
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            BBox b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, buckets[j].bounds);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, buckets[j].bounds);
+                count1 += buckets[j].count;
+            }
+            cost[i] = .125f + (count0 * b0.SurfaceArea() +
+                               count1 * b1.SurfaceArea()) / bbox.SurfaceArea();
+        }
+
+        // Find bucket to split at that minimizes SAH metric
+        float minCost = cost[0];
+        int minCostSplitBucket = 0;
+        for (int i = 1; i < nBuckets - 1; ++i) {
+            if (cost[i] < minCost) {
+                minCost = cost[i];
+                minCostSplitBucket = i;
+            }
+        }
+
+        // Split nodes and create interior HLBVH SAH node
+        BVHBuildNode **pmid = std::partition(&treeletRoots[start],
+            &treeletRoots[end - 1] + 1,
+            CompareTreeletToBucket(minCostSplitBucket, nBuckets, dim,
+                                   centroidBounds));
+        mid = pmid - &treeletRoots[0];
+        if (mid == start || mid == end) mid = (start + end) / 2;
+    }
+    Assert(mid > start && mid < end);
+    node->InitInterior(dim,
+        buildUpperSAH(buildArena, treeletRoots, start, mid, totalNodes),
+        buildUpperSAH(buildArena, treeletRoots, mid, end, totalNodes));
     return node;
 }
 
@@ -380,14 +2058,234 @@ uint32_t BVHAccel::flattenBVHTree(BVHBuildNode *node, uint32_t *offset) {
 }
 
 
+uint32_t BVHAccel::flattenQuantizedTree(BVHBuildNode *node, const BBox &box,
+                                        uint32_t *offset) {
+    QuantizedBVHNode *qnode = &quantizedNodes[*offset];
+    uint32_t myOffset = (*offset)++;
+    memset(qnode->bounds, 0, sizeof(qnode->bounds));
+    if (node->nPrimitives > 0) {
+        qnode->bounds[0][0][0] = node->nPrimitives;
+        qnode->offset = node->firstPrimOffset | quantizedLeafFlag;
+    }
+    else {
+        // Quantize child bounds relative to _box_ and flatten children
+        BBox childBounds[2];
+        for (int i = 0; i < 2; ++i) {
+            QuantizeBounds(box, node->children[i]->bounds, qnode->bounds[i]);
+            childBounds[i] = DequantizeBounds(box, qnode->bounds[i]);
+        }
+        flattenQuantizedTree(node->children[0], childBounds[0], offset);
+        qnode->offset = flattenQuantizedTree(node->children[1],
+                                             childBounds[1], offset) |
+                        (node->splitAxis << 30);
+    }
+    return myOffset;
+}
+
+
+uint32_t BVHAccel::flattenQBVHTree(BVHBuildNode *node, uint32_t *offset) {
+    QBVHNode *qnode = &qnodes[*offset];
+    uint32_t myOffset = (*offset)++;
+    BVHBuildNode *children[4];
+    QBVHChildren(node, children, qnode->axis);
+    for (int i = 0; i < 4; ++i) {
+        BVHBuildNode *child = children[i];
+        if (!child) {
+            // Initialize empty child with bounds that no ray can overlap
+            for (int axis = 0; axis < 3; ++axis) {
+                qnode->bounds[0][axis][i] = INFINITY;
+                qnode->bounds[1][axis][i] = -INFINITY;
+            }
+            qnode->children[i] = 0;
+            qnode->nPrimitives[i] = 0;
+            continue;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            qnode->bounds[0][axis][i] = child->bounds.pMin[axis];
+            qnode->bounds[1][axis][i] = child->bounds.pMax[axis];
+        }
+        if (child->nPrimitives > 0) {
+            qnode->children[i] = child->firstPrimOffset;
+            qnode->nPrimitives[i] = child->nPrimitives;
+        }
+        else {
+            qnode->nPrimitives[i] = 0;
+            qnode->children[i] = flattenQBVHTree(child, offset);
+        }
+    }
+    return myOffset;
+}
+
+
 BVHAccel::~BVHAccel() {
-    FreeAligned(nodes);
+    if (cacheMemory)
+        UnmapBVHCacheFile(cacheMemory, cacheMemorySize);
+    else {
+        FreeAligned(nodes);
+        FreeAligned(qnodes);
+        FreeAligned(quantizedNodes);
+    }
+}
+
+
+uint32_t BVHAccel::packLeafTriangles(BVHBuildNode *node,
+        vector<Reference<Primitive> > &packedPrims,
+        const vector<uint32_t> &primOrder, vector<uint32_t> &packedOrder) {
+    if (node->nPrimitives == 0)
+        return packLeafTriangles(node->children[0], packedPrims, primOrder,
+                                 packedOrder) +
+               packLeafTriangles(node->children[1], packedPrims, primOrder,
+                                 packedOrder);
+    // Pack up to four triangles at a time from leaf's primitives
+    uint32_t firstPrimOffset = packedPrims.size(), nPacks = 0;
+    for (uint32_t i = 0; i < node->nPrimitives; i += 4) {
+        uint32_t start = node->firstPrimOffset + i;
+        uint32_t n = min(4u, node->nPrimitives - i);
+        Primitive *pack = n > 1 ? MakeTrianglePack(&primitives[start], n) :
+                                  NULL;
+        if (pack) {
+            packedPrims.push_back(pack);
+            ++nPacks;
+            if (primOrder.size())
+                packedOrder.push_back(bvhCachePackFlag | n);
+        }
+        else
+            for (uint32_t j = 0; j < n; ++j)
+                packedPrims.push_back(primitives[start + j]);
+        if (primOrder.size())
+            for (uint32_t j = 0; j < n; ++j)
+                packedOrder.push_back(primOrder[start + j]);
+    }
+    node->firstPrimOffset = firstPrimOffset;
+    node->nPrimitives = packedPrims.size() - firstPrimOffset;
+    return nPacks;
+}
+
+
+float BVHAccel::sahCost() const {
+    // Compute SAH cost of flattened tree relative to its root's surface area
+    float rootArea = nodes[0].bounds.SurfaceArea();
+    if (rootArea <= 0.f) return 0.f;
+    float cost = 0.f;
+    for (uint32_t i = 0; i < nNodes; ++i) {
+        float area = nodes[i].bounds.SurfaceArea();
+        cost += nodes[i].nPrimitives > 0 ? area * nodes[i].nPrimitives :
+                                           .125f * area;
+    }
+    return cost / rootArea;
+}
+
+
+void BVHAccel::Refit(float time0, float time1) {
+    // Skip refit if already done for this interval, as for shared instances
+    if (primitives.size() == 0 ||
+        (time0 == refitTime0 && time1 == refitTime1)) return;
+    refitTime0 = time0;
+    refitTime1 = time1;
+    Timer refitTimer;
+    refitTimer.Start();
+
+    // Refit each primitive once, serially, since instances may share theirs
+    vector<Primitive *> prims(primitives.size());
+    for (uint32_t i = 0; i < primitives.size(); ++i)
+        prims[i] = const_cast<Primitive *>(primitives[i].GetPtr());
+    if (splitMethod == SPLIT_SBVH) {
+        // Spatial splits may reference a primitive from several leaves
+        std::sort(prims.begin(), prims.end());
+        prims.erase(std::unique(prims.begin(), prims.end()), prims.end());
+    }
+    for (uint32_t i = 0; i < prims.size(); ++i)
+        prims[i]->Refit(time0, time1);
+    if (!nodes) {
+        Info("Rebuilding %s BVH; only \"binary\" nodes can be refit",
+             nodeFormatNames[nodeFormat]);
+        rebuild();
+        return;
+    }
+
+    // Refit independent subtrees in parallel, then the nodes above them
+    int nCores = NumSystemCores();
+    if (nCores > 1 && nNodes >= 8192) {
+        vector<uint32_t> todo, topNodes;
+        vector<Task *> refitTasks;
+        todo.push_back(0);
+        uint32_t maxSubtreeNodes = max(1024u, nNodes / (16 * nCores));
+        while (todo.size()) {
+            uint32_t i = todo.back();
+            todo.pop_back();
+            uint32_t end = SubtreeEnd(nodes, i);
+            if (end - i <= maxSubtreeNodes)
+                refitTasks.push_back(new BVHRefitTask(nodes, primitives,
+                                                      i, end));
+            else {
+                topNodes.push_back(i);
+                todo.push_back(nodes[i].secondChildOffset);
+                todo.push_back(i + 1);
+            }
+        }
+        EnqueueTasks(refitTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < refitTasks.size(); ++i)
+            delete refitTasks[i];
+        for (uint32_t i = topNodes.size(); i > 0; --i)
+            RefitNode(nodes, topNodes[i - 1], primitives);
+    }
+    else {
+        BVHRefitTask task(nodes, primitives, 0, nNodes);
+        task.Run();
+    }
+    bounds = nodes[0].bounds;
+
+    // Rebuild BVH if refitting has degraded its quality too much
+    float cost = sahCost();
+    if (buildCost > 0.f && cost > rebuildThreshold * buildCost) {
+        Info("Rebuilding BVH; refit SAH cost %.2f exceeds %.2fx build cost "
+             "%.2f", cost, rebuildThreshold, buildCost);
+        rebuild();
+    }
+    else
+        Info("BVH refit %d nodes in %.3fs (SAH cost %.2f, build cost %.2f)",
+             (int)nNodes, refitTimer.Time(), cost, buildCost);
+}
+
+
+void BVHAccel::rebuild() {
+    // Free current nodes and collect unique primitives for a new build
+    if (cacheMemory)
+        UnmapBVHCacheFile(cacheMemory, cacheMemorySize);
+    else {
+        FreeAligned(nodes);
+        FreeAligned(qnodes);
+        FreeAligned(quantizedNodes);
+    }
+    nodes = NULL;
+    qnodes = NULL;
+    quantizedNodes = NULL;
+    cacheMemory = NULL;
+    cacheMemorySize = 0;
+    nNodes = 0;
+    vector<Reference<Primitive> > prims;
+    prims.reserve(primitives.size());
+    for (uint32_t i = 0; i < primitives.size(); ++i)
+        if (!UnpackTriangles(primitives[i], prims))
+            prims.push_back(primitives[i]);
+    primitives.swap(prims);
+    if (splitMethod == SPLIT_SBVH) {
+        std::sort(primitives.begin(), primitives.end(), RefLess());
+        primitives.erase(std::unique(primitives.begin(), primitives.end(),
+                                     RefEqual()), primitives.end());
+    }
+    buildTree("");
 }
 
 
 bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
+    if (qnodes) return intersectQBVH(ray, isect);
+    if (quantizedNodes) return intersectQuantized(ray, isect);
     if (!nodes) return false;
     PBRT_BVH_INTERSECTION_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
     bool hit = false;
     Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
@@ -396,6 +2294,7 @@ bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
     uint32_t todo[64];
     while (true) {
         const LinearBVHNode *node = &nodes[nodeNum];
+        ++nodesVisited;
         // Check ray against BVH node
         if (::IntersectP(node->bounds, ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
@@ -404,6 +2303,7 @@ bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
                 for (uint32_t i = 0; i < node->nPrimitives; ++i)
                 {
                     PBRT_BVH_INTERSECTION_PRIMITIVE_TEST(const_cast<Primitive *>(primitives[node->primitivesOffset+i].GetPtr()));
+                    ++primitiveTests;
                     if (primitives[node->primitivesOffset+i]->Intersect(ray, isect))
                     {
                         PBRT_BVH_INTERSECTION_PRIMITIVE_HIT(const_cast<Primitive *>(primitives[node->primitivesOffset+i].GetPtr()));
@@ -440,20 +2340,26 @@ bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
 
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
+    if (qnodes) return intersectPQBVH(ray);
+    if (quantizedNodes) return intersectPQuantized(ray);
     if (!nodes) return false;
     PBRT_BVH_INTERSECTIONP_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
     Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
     uint32_t todo[64];
     uint32_t todoOffset = 0, nodeNum = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[nodeNum];
+        ++nodesVisited;
         if (::IntersectP(node->bounds, ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
                 PBRT_BVH_INTERSECTIONP_TRAVERSED_LEAF_NODE(const_cast<LinearBVHNode *>(node));
                   for (uint32_t i = 0; i < node->nPrimitives; ++i) {
                     PBRT_BVH_INTERSECTIONP_PRIMITIVE_TEST(const_cast<Primitive *>(primitives[node->primitivesOffset + i].GetPtr()));
+                    ++primitiveTests;
                     if (primitives[node->primitivesOffset+i]->IntersectP(ray)) {
                         PBRT_BVH_INTERSECTIONP_PRIMITIVE_HIT(const_cast<Primitive *>(primitives[node->primitivesOffset+i].GetPtr()));
                         return true;
@@ -488,11 +2394,337 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
 }
 
 
+bool BVHAccel::intersectQBVH(const Ray &ray, Intersection *isect) const {
+    PBRT_BVH_INTERSECTION_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
+    bool hit = false;
+    QBVHRay qray(ray);
+    // Follow ray through QBVH nodes to find primitive intersections
+    QBVHTodo todo[128];
+    uint32_t todoOffset = 0, nodeNum = 0;
+    while (true) {
+        const QBVHNode *node = &qnodes[nodeNum];
+        ++nodesVisited;
+        // Push children of _node_ overlapped by the ray, nearest last
+        float tNear[4];
+        int hitMask = IntersectQBVHNode(*node, ray, qray, tNear);
+        int order[4];
+        QBVHChildOrder(*node, qray.dirIsNeg, order);
+        for (int i = 3; i >= 0; --i) {
+            int c = order[i];
+            if (hitMask & (1 << c)) {
+                todo[todoOffset].offset = node->children[c];
+                todo[todoOffset].nPrimitives = node->nPrimitives[c];
+                todo[todoOffset].tMin = tNear[c];
+                ++todoOffset;
+            }
+        }
+
+        // Intersect leaves from _todo_ until reaching an interior node
+        while (true) {
+            if (todoOffset == 0) {
+                PBRT_BVH_INTERSECTION_FINISHED();
+                return hit;
+            }
+            const QBVHTodo &entry = todo[--todoOffset];
+            if (entry.tMin > ray.maxt)
+                continue;
+            if (entry.nPrimitives == 0) {
+                nodeNum = entry.offset;
+                break;
+            }
+            for (uint32_t i = 0; i < entry.nPrimitives; ++i) {
+                const Primitive *prim = primitives[entry.offset+i].GetPtr();
+                PBRT_BVH_INTERSECTION_PRIMITIVE_TEST(const_cast<Primitive *>(prim));
+                ++primitiveTests;
+                if (prim->Intersect(ray, isect)) {
+                    PBRT_BVH_INTERSECTION_PRIMITIVE_HIT(const_cast<Primitive *>(prim));
+                    hit = true;
+                }
+                else {
+                    PBRT_BVH_INTERSECTION_PRIMITIVE_MISSED(const_cast<Primitive *>(prim));
+                }
+            }
+        }
+    }
+}
+
+
+bool BVHAccel::intersectPQBVH(const Ray &ray) const {
+    PBRT_BVH_INTERSECTIONP_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
+    QBVHRay qray(ray);
+    QBVHTodo todo[128];
+    uint32_t todoOffset = 0, nodeNum = 0;
+    while (true) {
+        const QBVHNode *node = &qnodes[nodeNum];
+        ++nodesVisited;
+        float tNear[4];
+        int hitMask = IntersectQBVHNode(*node, ray, qray, tNear);
+        int order[4];
+        QBVHChildOrder(*node, qray.dirIsNeg, order);
+        for (int i = 3; i >= 0; --i) {
+            int c = order[i];
+            if (hitMask & (1 << c)) {
+                todo[todoOffset].offset = node->children[c];
+                todo[todoOffset].nPrimitives = node->nPrimitives[c];
+                ++todoOffset;
+            }
+        }
+        while (true) {
+            if (todoOffset == 0) {
+                PBRT_BVH_INTERSECTIONP_FINISHED();
+                return false;
+            }
+            const QBVHTodo &entry = todo[--todoOffset];
+            if (entry.nPrimitives == 0) {
+                nodeNum = entry.offset;
+                break;
+            }
+            for (uint32_t i = 0; i < entry.nPrimitives; ++i) {
+                const Primitive *prim = primitives[entry.offset+i].GetPtr();
+                PBRT_BVH_INTERSECTIONP_PRIMITIVE_TEST(const_cast<Primitive *>(prim));
+                ++primitiveTests;
+                if (prim->IntersectP(ray)) {
+                    PBRT_BVH_INTERSECTIONP_PRIMITIVE_HIT(const_cast<Primitive *>(prim));
+                    return true;
+                }
+                else {
+                    PBRT_BVH_INTERSECTIONP_PRIMITIVE_MISSED(const_cast<Primitive *>(prim));
+                }
+            }
+        }
+    }
+}
+
+
+bool BVHAccel::intersectQuantized(const Ray &ray,
+                                  Intersection *isect) const {
+    PBRT_BVH_INTERSECTION_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
+    bool hit = false;
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    if (!::IntersectP(bounds, ray, invDir, dirIsNeg)) {
+        PBRT_BVH_INTERSECTION_FINISHED();
+        return false;
+    }
+    // Follow ray through quantized nodes, decoding child bounds on the way
+    QuantizedTodo todo[64];
+    uint32_t todoOffset = 0;
+    todo[todoOffset].nodeNum = 0;
+    todo[todoOffset++].bounds = bounds;
+    while (todoOffset > 0) {
+        const QuantizedTodo entry = todo[--todoOffset];
+        const QuantizedBVHNode *node = &quantizedNodes[entry.nodeNum];
+        ++nodesVisited;
+        if ((node->offset & quantizedLeafFlag) == quantizedLeafFlag) {
+            // Intersect ray with primitives in leaf node
+            uint32_t primitivesOffset = node->offset & quantizedOffsetMask;
+            for (uint32_t i = 0; i < node->bounds[0][0][0]; ++i) {
+                const Primitive *prim = primitives[primitivesOffset+i].GetPtr();
+                PBRT_BVH_INTERSECTION_PRIMITIVE_TEST(const_cast<Primitive *>(prim));
+                ++primitiveTests;
+                if (prim->Intersect(ray, isect)) {
+                    PBRT_BVH_INTERSECTION_PRIMITIVE_HIT(const_cast<Primitive *>(prim));
+                    hit = true;
+                }
+                else {
+                    PBRT_BVH_INTERSECTION_PRIMITIVE_MISSED(const_cast<Primitive *>(prim));
+                }
+            }
+            continue;
+        }
+        // Test ray against both children, pushing far child first
+        uint32_t childNum[2] = { entry.nodeNum + 1,
+                                 node->offset & quantizedOffsetMask };
+        int nearChild = dirIsNeg[node->offset >> 30] ? 1 : 0;
+        for (int j = 0; j < 2; ++j) {
+            int c = (j == 0) ? 1 - nearChild : nearChild;
+            BBox childBounds = DequantizeBounds(entry.bounds, node->bounds[c]);
+            if (::IntersectP(childBounds, ray, invDir, dirIsNeg)) {
+                todo[todoOffset].nodeNum = childNum[c];
+                todo[todoOffset++].bounds = childBounds;
+            }
+        }
+    }
+    PBRT_BVH_INTERSECTION_FINISHED();
+    return hit;
+}
+
+
+bool BVHAccel::intersectPQuantized(const Ray &ray) const {
+    PBRT_BVH_INTERSECTIONP_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
+    STAT_TALLY(bvhNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    if (!::IntersectP(bounds, ray, invDir, dirIsNeg)) {
+        PBRT_BVH_INTERSECTIONP_FINISHED();
+        return false;
+    }
+    QuantizedTodo todo[64];
+    uint32_t todoOffset = 0;
+    todo[todoOffset].nodeNum = 0;
+    todo[todoOffset++].bounds = bounds;
+    while (todoOffset > 0) {
+        const QuantizedTodo entry = todo[--todoOffset];
+        const QuantizedBVHNode *node = &quantizedNodes[entry.nodeNum];
+        ++nodesVisited;
+        if ((node->offset & quantizedLeafFlag) == quantizedLeafFlag) {
+            uint32_t primitivesOffset = node->offset & quantizedOffsetMask;
+            for (uint32_t i = 0; i < node->bounds[0][0][0]; ++i) {
+                const Primitive *prim = primitives[primitivesOffset+i].GetPtr();
+                PBRT_BVH_INTERSECTIONP_PRIMITIVE_TEST(const_cast<Primitive *>(prim));
+                ++primitiveTests;
+                if (prim->IntersectP(ray)) {
+                    PBRT_BVH_INTERSECTIONP_PRIMITIVE_HIT(const_cast<Primitive *>(prim));
+                    PBRT_BVH_INTERSECTIONP_FINISHED();
+                    return true;
+                }
+                else {
+                    PBRT_BVH_INTERSECTIONP_PRIMITIVE_MISSED(const_cast<Primitive *>(prim));
+                }
+            }
+            continue;
+        }
+        uint32_t childNum[2] = { entry.nodeNum + 1,
+                                 node->offset & quantizedOffsetMask };
+        int nearChild = dirIsNeg[node->offset >> 30] ? 1 : 0;
+        for (int j = 0; j < 2; ++j) {
+            int c = (j == 0) ? 1 - nearChild : nearChild;
+            BBox childBounds = DequantizeBounds(entry.bounds, node->bounds[c]);
+            if (::IntersectP(childBounds, ray, invDir, dirIsNeg)) {
+                todo[todoOffset].nodeNum = childNum[c];
+                todo[todoOffset++].bounds = childBounds;
+            }
+        }
+    }
+    PBRT_BVH_INTERSECTIONP_FINISHED();
+    return false;
+}
+
+
+void BVHAccel::IntersectPacket(const Ray *const *rays, int nRays,
+                               Intersection *isects, bool *hits) const {
+    if (!nodes) Primitive::IntersectPacket(rays, nRays, isects, hits);
+    else intersectPacket(rays, nRays, isects, hits);
+}
+
+
+void BVHAccel::IntersectPPacket(const Ray *const *rays, int nRays,
+                                bool *hits) const {
+    if (!nodes) Primitive::IntersectPPacket(rays, nRays, hits);
+    else intersectPacket(rays, nRays, NULL, hits);
+}
+
+
+void BVHAccel::intersectPacket(const Ray *const *rays, int nRays,
+                               Intersection *isects, bool *hits) const {
+    // Shadow ray packets are traced when _isects_ is _NULL_
+    for (int i = 0; i < nRays; ++i)
+        hits[i] = false;
+    if (nRays == 0) return;
+    BVHRayPacket packet(rays, nRays, ALLOCA(Vector, nRays),
+                        ALLOCA(uint32_t, 3*nRays));
+    if (!packet.coherent) {
+        // Trace incoherent packets one ray at a time
+        for (int i = 0; i < nRays; ++i)
+            hits[i] = isects ? Intersect(*rays[i], &isects[i]) :
+                               IntersectP(*rays[i]);
+        return;
+    }
+    int *active = ALLOCA(int, nRays);
+    STAT_TALLY(bvhPacketNodesVisited, nodesVisited);
+    STAT_TALLY(bvhPrimitiveTests, primitiveTests);
+
+    // Follow packet through BVH nodes, tracking its first active ray
+    struct { uint32_t node; int first; } todo[64];
+    uint32_t todoOffset = 0, nodeNum = 0;
+    int first = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[nodeNum];
+        ++nodesVisited;
+        // Find first active ray in packet that overlaps _node_
+        int firstHit = -1;
+        if (packet.IntersectP(node->bounds, first))
+            firstHit = first;
+        else if (packet.MayHit(node->bounds)) {
+            for (int i = first + 1; i < nRays; ++i)
+                if (!(isects == NULL && hits[i]) &&
+                    packet.IntersectP(node->bounds, i)) {
+                    firstHit = i;
+                    break;
+                }
+        }
+        if (firstHit >= 0) {
+            if (node->nPrimitives > 0) {
+                // Intersect active rays with primitives in leaf BVH node
+                int nActive = 0;
+                active[nActive++] = firstHit;
+                for (int i = firstHit + 1; i < nRays; ++i)
+                    if (!(isects == NULL && hits[i]) &&
+                        packet.IntersectP(node->bounds, i))
+                        active[nActive++] = i;
+                primitiveTests += node->nPrimitives * nActive;
+                for (uint32_t p = 0; p < node->nPrimitives; ++p) {
+                    const Primitive *prim =
+                        primitives[node->primitivesOffset+p].GetPtr();
+                    for (int j = 0; j < nActive; ++j) {
+                        int i = active[j];
+                        if (isects) {
+                            if (prim->Intersect(*rays[i], &isects[i]))
+                                hits[i] = true;
+                        }
+                        else if (!hits[i] && prim->IntersectP(*rays[i]))
+                            hits[i] = true;
+                    }
+                }
+            }
+            else {
+                // Put far BVH node on _todo_ stack, advance to near node
+                if (packet.dirIsNeg[3*firstHit+node->axis]) {
+                   todo[todoOffset].node = nodeNum + 1;
+                   nodeNum = node->secondChildOffset;
+                }
+                else {
+                   todo[todoOffset].node = node->secondChildOffset;
+                   nodeNum = nodeNum + 1;
+                }
+                todo[todoOffset++].first = firstHit;
+                first = firstHit;
+                continue;
+            }
+        }
+        // Pop next node, skipping rays that have already found an occluder
+        while (true) {
+            if (todoOffset == 0) return;
+            --todoOffset;
+            nodeNum = todo[todoOffset].node;
+            first = todo[todoOffset].first;
+            if (isects == NULL)
+                while (first < nRays && hits[first]) ++first;
+            if (first < nRays) break;
+        }
+    }
+}
+
+
 BVHAccel *CreateBVHAccelerator(const vector<Reference<Primitive> > &prims,
         const ParamSet &ps) {
     string splitMethod = ps.FindOneString("splitmethod", "sah");
     uint32_t maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return new BVHAccel(prims, maxPrimsInNode, splitMethod);
+    string nodeFormat = ps.FindOneString("nodeformat", "binary");
+    string cacheDir = ps.FindOneString("cachedir", "");
+    float duplicationBudget = ps.FindOneFloat("duplicationbudget", .3f);
+    float rebuildThreshold = ps.FindOneFloat("rebuildthreshold", 1.5f);
+    bool packTriangles = ps.FindOneBool("packtriangles", true);
+    return new BVHAccel(prims, maxPrimsInNode, splitMethod, nodeFormat,
+                        cacheDir, duplicationBudget, rebuildThreshold,
+                        packTriangles);
 }
 
 
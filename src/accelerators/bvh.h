@@ -44,31 +44,94 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct LinearBVHNode;
+struct MortonPrimitive;
+struct BVHReference;
+struct SBVHBuildState;
+struct QBVHNode;
+struct QuantizedBVHNode;
+class Task;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
 public:
     // BVHAccel Public Methods
     BVHAccel(const vector<Reference<Primitive> > &p, uint32_t maxPrims = 1,
-             const string &sm = "sah");
+             const string &sm = "sah", const string &nf = "binary",
+             const string &cacheDir = "", float duplicationBudget = .3f,
+             float rebuildThreshold = 1.5f, bool packTriangles = true);
     BBox WorldBound() const;
     bool CanIntersect() const { return true; }
     ~BVHAccel();
     bool Intersect(const Ray &ray, Intersection *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void IntersectPacket(const Ray *const *rays, int nRays,
+                         Intersection *isects, bool *hits) const;
+    void IntersectPPacket(const Ray *const *rays, int nRays,
+                          bool *hits) const;
+    void Refit(float time0, float time1);
 private:
     // BVHAccel Private Methods
+    void buildTree(const string &cacheDir);
+    void rebuild();
+    float sahCost() const;
+    friend class BVHSubtreeTask;
     BVHBuildNode *recursiveBuild(MemoryArena &buildArena,
         vector<BVHPrimitiveInfo> &buildData, uint32_t start, uint32_t end,
-        uint32_t *totalNodes, vector<Reference<Primitive> > &orderedPrims);
+        uint32_t *totalNodes, vector<Reference<Primitive> > &orderedPrims,
+        vector<Task *> *subtreeTasks = NULL, uint32_t subtreeMaxPrims = 0);
+    BVHBuildNode *SBVHBuild(MemoryArena &buildArena,
+        vector<BVHReference> &refs, uint32_t *totalNodes,
+        vector<Reference<Primitive> > &orderedPrims, SBVHBuildState &state,
+        int depth);
+    friend class LBVHTreeletTask;
+    BVHBuildNode *HLBVHBuild(MemoryArena &buildArena,
+        const vector<BVHPrimitiveInfo> &buildData, uint32_t *totalNodes,
+        vector<Reference<Primitive> > &orderedPrims,
+        vector<Task *> &treeletTasks);
+    BVHBuildNode *emitLBVH(MemoryArena &buildArena,
+        const vector<BVHPrimitiveInfo> &buildData,
+        const MortonPrimitive *mortonPrims, uint32_t start, uint32_t end,
+        uint32_t *totalNodes, vector<Reference<Primitive> > &orderedPrims,
+        int bitIndex);
+    BVHBuildNode *buildUpperSAH(MemoryArena &buildArena,
+        vector<BVHBuildNode *> &treeletRoots, uint32_t start, uint32_t end,
+        uint32_t *totalNodes);
+    uint32_t packLeafTriangles(BVHBuildNode *node,
+        vector<Reference<Primitive> > &packedPrims,
+        const vector<uint32_t> &primOrder, vector<uint32_t> &packedOrder);
+    bool loadCache(const string &filename, uint64_t key);
+    void writeCache(const string &filename, uint64_t key,
+        const vector<uint32_t> &primOrder, uint32_t totalNodes) const;
     uint32_t flattenBVHTree(BVHBuildNode *node, uint32_t *offset);
+    uint32_t flattenQBVHTree(BVHBuildNode *node, uint32_t *offset);
+    uint32_t flattenQuantizedTree(BVHBuildNode *node, const BBox &box,
+                                  uint32_t *offset);
+    bool intersectQBVH(const Ray &ray, Intersection *isect) const;
+    bool intersectPQBVH(const Ray &ray) const;
+    bool intersectQuantized(const Ray &ray, Intersection *isect) const;
+    bool intersectPQuantized(const Ray &ray) const;
+    void intersectPacket(const Ray *const *rays, int nRays,
+                         Intersection *isects, bool *hits) const;
 
     // BVHAccel Private Data
     uint32_t maxPrimsInNode;
-    enum SplitMethod { SPLIT_MIDDLE, SPLIT_EQUAL_COUNTS, SPLIT_SAH };
+    enum SplitMethod { SPLIT_MIDDLE, SPLIT_EQUAL_COUNTS, SPLIT_SAH,
+                       SPLIT_HLBVH, SPLIT_SBVH };
     SplitMethod splitMethod;
+    float duplicationBudget;
+    bool packTriangles;
+    enum NodeFormat { NODES_BINARY, NODES_QBVH, NODES_QUANTIZED };
+    NodeFormat nodeFormat;
     vector<Reference<Primitive> > primitives;
+    BBox bounds;
     LinearBVHNode *nodes;
+    QBVHNode *qnodes;
+    QuantizedBVHNode *quantizedNodes;
+    uint32_t nNodes;
+    float rebuildThreshold, buildCost;
+    float refitTime0, refitTime1;
+    void *cacheMemory;
+    size_t cacheMemorySize;
 };
 
 
@@ -35,6 +35,7 @@
 #include "accelerators/grid.h"
 #include "probes.h"
 #include "paramset.h"
+#include "parallel.h"
 
 // GridAccel Method Definitions
 GridAccel::GridAccel(const vector<Reference<Primitive> > &p,
@@ -100,9 +101,6 @@ GridAccel::GridAccel(const vector<Reference<Primitive> > &p,
                     }
                 }
     }
-
-    // Create reader-writer mutex for grid
-    rwMutex = RWMutex::Create();
     PBRT_GRID_FINISHED_CONSTRUCTION(this);
 }
 
@@ -116,7 +114,6 @@ GridAccel::~GridAccel() {
     for (int i = 0; i < nVoxels[0]*nVoxels[1]*nVoxels[2]; ++i)
         if (voxels[i]) voxels[i]->~Voxel();
     FreeAligned(voxels);
-    RWMutex::Destroy(rwMutex);
 }
 
 
@@ -158,14 +155,13 @@ bool GridAccel::Intersect(const Ray &ray, Intersection *isect) const {
     }
 
     // Walk ray through voxel grid
-    RWMutexLock lock(*rwMutex, READ);
     bool hitSomething = false;
     for (;;) {
         // Check for intersection in current voxel and advance to next
         Voxel *voxel = voxels[offset(Pos[0], Pos[1], Pos[2])];
         PBRT_GRID_RAY_TRAVERSED_VOXEL(Pos, voxel ? voxel->size() : 0);
         if (voxel != NULL)
-            hitSomething |= voxel->Intersect(ray, isect, lock);
+            hitSomething |= voxel->Intersect(ray, isect);
 
         // Advance to next voxel
 
@@ -186,32 +182,63 @@ bool GridAccel::Intersect(const Ray &ray, Intersection *isect) const {
 }
 
 
-bool Voxel::Intersect(const Ray &ray, Intersection *isect,
-                      RWMutexLock &lock) {
-    // Refine primitives in voxel if needed
-    if (!allCanIntersect) {
-        lock.UpgradeToWrite();
-        for (uint32_t i = 0; i < primitives.size(); ++i) {
-            Reference<Primitive> &prim = primitives[i];
-            // Refine primitive _prim_ if it's not intersectable
-            if (!prim->CanIntersect()) {
-                vector<Reference<Primitive> > p;
-                prim->FullyRefine(p);
-                Assert(p.size() > 0);
-                if (p.size() == 1)
-                    primitives[i] = p[0];
-                else
-                    primitives[i] = new GridAccel(p, false);
-            }
+// Value of _Voxel::intersectable_ while a thread refines the voxel
+static vector<Reference<Primitive> > voxelRefining;
+
+const vector<Reference<Primitive> > &Voxel::intersectablePrimitives() {
+    vector<Reference<Primitive> > *prims = intersectable;
+    if (prims == NULL) {
+        // Claim voxel so that only this thread refines its primitives
+        prims = AtomicCompareAndSwapPointer(&intersectable, &voxelRefining,
+            (vector<Reference<Primitive> > *)NULL);
+        if (prims == NULL)
+            return refinePrimitives();
+    }
+    // Run other queued work until voxel's primitives have been refined
+    while (prims == &voxelRefining) {
+        RunQueuedTask();
+        prims = intersectable;
+    }
+    return *prims;
+}
+
+
+const vector<Reference<Primitive> > &Voxel::refinePrimitives() {
+    // Don't run unrelated tasks, which may wait for this voxel, while
+    // refinement waits for its own tasks
+    SerialTaskScope serialTasks;
+
+    // Refine primitives in voxel into a private list
+    vector<Reference<Primitive> > *prims = &primitives;
+    for (uint32_t i = 0; i < primitives.size(); ++i) {
+        const Reference<Primitive> &prim = primitives[i];
+        // Refine primitive _prim_ if it's not intersectable
+        if (!prim->CanIntersect()) {
+            if (prims == &primitives)
+                prims = new vector<Reference<Primitive> >(primitives);
+            vector<Reference<Primitive> > p;
+            prim->FullyRefine(p);
+            Assert(p.size() > 0);
+            if (p.size() == 1)
+                (*prims)[i] = p[0];
+            else
+                (*prims)[i] = new GridAccel(p, false);
         }
-        allCanIntersect = true;
-        lock.DowngradeToRead();
     }
 
+    // Publish refined primitives to threads waiting for them
+    AtomicCompareAndSwapPointer(&intersectable, prims, &voxelRefining);
+    return *prims;
+}
+
+
+bool Voxel::Intersect(const Ray &ray, Intersection *isect) {
+    const vector<Reference<Primitive> > &prims = intersectablePrimitives();
+
     // Loop over primitives in voxel and find intersections
     bool hitSomething = false;
-    for (uint32_t i = 0; i < primitives.size(); ++i) {
-        Reference<Primitive> &prim = primitives[i];
+    for (uint32_t i = 0; i < prims.size(); ++i) {
+        const Reference<Primitive> &prim = prims[i];
         PBRT_GRID_RAY_PRIMITIVE_INTERSECTION_TEST(const_cast<Primitive *>(prim.GetPtr()));
         if (prim->Intersect(ray, isect))
         {
@@ -225,7 +252,6 @@ bool Voxel::Intersect(const Ray &ray, Intersection *isect,
 
 bool GridAccel::IntersectP(const Ray &ray) const {
     PBRT_GRID_INTERSECTIONP_TEST(const_cast<GridAccel *>(this), const_cast<Ray *>(&ray));
-    RWMutexLock lock(*rwMutex, READ);
     // Check ray against overall grid bounds
     float rayT;
     if (bounds.Inside(ray(ray.mint)))
@@ -266,7 +292,7 @@ bool GridAccel::IntersectP(const Ray &ray) const {
         int o = offset(Pos[0], Pos[1], Pos[2]);
         Voxel *voxel = voxels[o];
         PBRT_GRID_RAY_TRAVERSED_VOXEL(Pos, voxel ? voxel->size() : 0);
-        if (voxel && voxel->IntersectP(ray, lock))
+        if (voxel && voxel->IntersectP(ray))
             return true;
         // Advance to next voxel
 
@@ -287,28 +313,10 @@ bool GridAccel::IntersectP(const Ray &ray) const {
 }
 
 
-bool Voxel::IntersectP(const Ray &ray, RWMutexLock &lock) {
-    // Refine primitives in voxel if needed
-    if (!allCanIntersect) {
-        lock.UpgradeToWrite();
-        for (uint32_t i = 0; i < primitives.size(); ++i) {
-            Reference<Primitive> &prim = primitives[i];
-            // Refine primitive _prim_ if it's not intersectable
-            if (!prim->CanIntersect()) {
-                vector<Reference<Primitive> > p;
-                prim->FullyRefine(p);
-                Assert(p.size() > 0);
-                if (p.size() == 1)
-                    primitives[i] = p[0];
-                else
-                    primitives[i] = new GridAccel(p, false);
-            }
-        }
-        allCanIntersect = true;
-        lock.DowngradeToRead();
-    }
-    for (uint32_t i = 0; i < primitives.size(); ++i) {
-        Reference<Primitive> &prim = primitives[i];
+bool Voxel::IntersectP(const Ray &ray) {
+    const vector<Reference<Primitive> > &prims = intersectablePrimitives();
+    for (uint32_t i = 0; i < prims.size(); ++i) {
+        const Reference<Primitive> &prim = prims[i];
         PBRT_GRID_RAY_PRIMITIVE_INTERSECTIONP_TEST(const_cast<Primitive *>(prim.GetPtr()));
         if (prim->IntersectP(ray)) {
             PBRT_GRID_RAY_PRIMITIVE_HIT(const_cast<Primitive *>(prim.GetPtr()));
@@ -47,19 +47,27 @@ struct Voxel;
 struct Voxel {
     // Voxel Public Methods
     uint32_t size() const { return primitives.size(); }
-    Voxel() { }
+    Voxel() { intersectable = NULL; }
     Voxel(Reference<Primitive> op) {
-        allCanIntersect = false;
+        intersectable = NULL;
         primitives.push_back(op);
     }
+    ~Voxel() {
+        if (intersectable != &primitives) delete intersectable;
+    }
     void AddPrimitive(Reference<Primitive> prim) {
         primitives.push_back(prim);
     }
-    bool Intersect(const Ray &ray, Intersection *isect, RWMutexLock &lock);
-    bool IntersectP(const Ray &ray, RWMutexLock &lock);
+    bool Intersect(const Ray &ray, Intersection *isect);
+    bool IntersectP(const Ray &ray);
 private:
+    // Voxel Private Methods
+    const vector<Reference<Primitive> > &intersectablePrimitives();
+    const vector<Reference<Primitive> > &refinePrimitives();
+
+    // Voxel Private Data
     vector<Reference<Primitive> > primitives;
-    bool allCanIntersect;
+    vector<Reference<Primitive> > *intersectable;
 };
 
 
@@ -95,7 +103,6 @@ private:
     Vector width, invWidth;
     Voxel **voxels;
     MemoryArena voxelArena;
-    mutable RWMutex *rwMutex;
 };
 
 
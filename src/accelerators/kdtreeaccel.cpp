@@ -34,8 +34,14 @@
 #include "stdafx.h"
 #include "accelerators/kdtreeaccel.h"
 #include "paramset.h"
+#include "parallel.h"
+#include "timer.h"
+#include "stats.h"
 
 // KdTreeAccel Local Declarations
+STAT_INT_DISTRIBUTION("Kd-tree/Nodes visited per ray", kdNodesVisited);
+STAT_COUNTER("Kd-tree/Primitive intersection tests", kdPrimitiveTests);
+STAT_MEMORY_COUNTER("Memory/Kd-tree nodes", kdNodeBytes);
 struct KdAccelNode {
     // KdAccelNode Methods
     void initLeaf(uint32_t *primNums, int np, MemoryArena &arena);
@@ -73,8 +79,10 @@ struct BoundEdge {
         type = starting ? START : END;
     }
     bool operator<(const BoundEdge &e) const {
-        if (t == e.t)
+        if (t == e.t) {
+            if (type == e.type) return primNum < e.primNum;
             return (int)type < (int)e.type;
+        }
         else return t < e.t;
     }
     float t;
@@ -83,6 +91,73 @@ struct BoundEdge {
 };
 
 
+struct KdBuildState {
+    KdBuildState(MemoryArena &a, uint32_t nPrims)
+        : nodes(NULL), nAllocedNodes(0), nextFreeNode(0), arena(a),
+          primSides(nPrims, 0), primIndices(NULL), subtreeTasks(NULL),
+          subtreeMaxPrims(0) { }
+    KdAccelNode *nodes;
+    int nAllocedNodes, nextFreeNode;
+    MemoryArena &arena;
+    // Side flags, indexed by the edges' _primNum_
+    vector<uint8_t> primSides;
+    // Maps subtree-local _primNum_s to primitive indices, if non-_NULL_
+    const vector<uint32_t> *primIndices;
+    vector<Task *> *subtreeTasks;
+    vector<uint32_t> subtreeIndex;
+    int subtreeMaxPrims;
+};
+
+
+class KdSubtreeTask : public Task {
+public:
+    KdSubtreeTask(KdTreeAccel *k, int nn, const BBox &b,
+                  const vector<BBox> &pb, vector<BoundEdge> e[3],
+                  vector<uint32_t> &pi, int d, int br)
+        : kd(k), nodeNum(nn), bounds(b), allPrimBounds(pb), depth(d),
+          badRefines(br), nodes(NULL), nNodes(0) {
+        for (int i = 0; i < 3; ++i)
+            edges[i].swap(e[i]);
+        primIndices.swap(pi);
+    }
+    void Run() {
+        KdBuildState state(arena, primIndices.size());
+        state.primIndices = &primIndices;
+        kd->buildTree(state, 0, bounds, allPrimBounds, edges, depth,
+                      badRefines);
+        nodes = state.nodes;
+        nNodes = state.nextFreeNode;
+    }
+
+    KdTreeAccel *kd;
+    int nodeNum;
+    BBox bounds;
+    const vector<BBox> &allPrimBounds;
+    vector<BoundEdge> edges[3];
+    vector<uint32_t> primIndices;
+    int depth, badRefines;
+    MemoryArena arena;
+    KdAccelNode *nodes;
+    int nNodes;
+};
+
+
+static float KdSAHCost(const KdAccelNode *nodes, int nodeNum,
+                       const BBox &nodeBounds, float traversalRatio) {
+    // Return SAH cost of subtree, weighted by its bounds' surface area
+    const KdAccelNode &node = nodes[nodeNum];
+    float area = nodeBounds.SurfaceArea();
+    if (node.IsLeaf())
+        return area * node.nPrimitives();
+    BBox bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.pMax[node.SplitAxis()] = bounds1.pMin[node.SplitAxis()] =
+        node.SplitPos();
+    return traversalRatio * area +
+        KdSAHCost(nodes, nodeNum + 1, bounds0, traversalRatio) +
+        KdSAHCost(nodes, node.AboveChild(), bounds1, traversalRatio);
+}
+
+
 
 // KdTreeAccel Method Definitions
 KdTreeAccel::KdTreeAccel(const vector<Reference<Primitive> > &p,
@@ -91,10 +166,13 @@ KdTreeAccel::KdTreeAccel(const vector<Reference<Primitive> > &p,
     : isectCost(icost), traversalCost(tcost), maxPrims(maxp), maxDepth(md),
       emptyBonus(ebonus) {
     PBRT_KDTREE_STARTED_CONSTRUCTION(this, p.size());
+    Timer buildTimer;
+    buildTimer.Start();
     for (uint32_t i = 0; i < p.size(); ++i)
         p[i]->FullyRefine(primitives);
     // Build kd-tree for accelerator
-    nextFreeNode = nAllocedNodes = 0;
+    nodes = NULL;
+    nNodes = 0;
     if (maxDepth <= 0)
         maxDepth = Round2Int(8 + 1.3f * Log2Int(float(primitives.size())));
 
@@ -107,28 +185,88 @@ KdTreeAccel::KdTreeAccel(const vector<Reference<Primitive> > &p,
         primBounds.push_back(b);
     }
 
-    // Allocate working memory for kd-tree construction
-    BoundEdge *edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i] = new BoundEdge[2*primitives.size()];
-    uint32_t *prims0 = new uint32_t[primitives.size()];
-    uint32_t *prims1 = new uint32_t[(maxDepth+1) * primitives.size()];
-
-    // Initialize _primNums_ for kd-tree construction
-    uint32_t *primNums = new uint32_t[primitives.size()];
-    for (uint32_t i = 0; i < primitives.size(); ++i)
-        primNums[i] = i;
+    // Initialize presorted edges for kd-tree construction
+    vector<BoundEdge> edges[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        edges[axis].resize(2*primitives.size());
+        for (uint32_t i = 0; i < primitives.size(); ++i) {
+            edges[axis][2*i] =   BoundEdge(primBounds[i].pMin[axis], i, true);
+            edges[axis][2*i+1] = BoundEdge(primBounds[i].pMax[axis], i, false);
+        }
+        sort(edges[axis].begin(), edges[axis].end());
+    }
 
     // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums, primitives.size(),
-              maxDepth, edges, prims0, prims1);
-
-    // Free working memory for kd-tree construction
-    delete[] primNums;
-    for (int i = 0; i < 3; ++i)
-        delete[] edges[i];
-    delete[] prims0;
-    delete[] prims1;
+    KdBuildState state(arena, primitives.size());
+    vector<Task *> subtreeTasks;
+    int nCores = NumSystemCores(), nThreads = 1;
+    if (nCores > 1 && primitives.size() >= 4096) {
+        // Build top of kd-tree serially, deferring subtrees to tasks
+        state.subtreeTasks = &subtreeTasks;
+        state.subtreeMaxPrims = max(1024, int(primitives.size() / (8 * nCores)));
+        state.subtreeIndex.resize(primitives.size());
+        nThreads = nCores;
+    }
+    buildTree(state, 0, bounds, primBounds, edges, maxDepth);
+    EnqueueTasks(subtreeTasks);
+    WaitForAllTasks();
+
+    // Splice subtree nodes into depth-first node array
+    nNodes = state.nextFreeNode;
+    for (uint32_t i = 0; i < subtreeTasks.size(); ++i)
+        nNodes += ((KdSubtreeTask *)subtreeTasks[i])->nNodes - 1;
+    nodes = AllocAligned<KdAccelNode>(nNodes);
+    NumaInterleave(nodes, nNodes * sizeof(KdAccelNode));
+    STAT_ADD(kdNodeBytes, nNodes * sizeof(KdAccelNode));
+    vector<int> nodeOffsets(state.nextFreeNode);
+    for (int i = 0, offset = 0, task = 0; i < state.nextFreeNode; ++i) {
+        nodeOffsets[i] = offset;
+        KdSubtreeTask *subtree = task < int(subtreeTasks.size()) ?
+            (KdSubtreeTask *)subtreeTasks[task] : NULL;
+        if (subtree && subtree->nodeNum == i) {
+            offset += subtree->nNodes;
+            ++task;
+        }
+        else ++offset;
+    }
+    for (int i = 0, task = 0; i < state.nextFreeNode; ++i) {
+        KdSubtreeTask *subtree = task < int(subtreeTasks.size()) ?
+            (KdSubtreeTask *)subtreeTasks[task] : NULL;
+        if (subtree && subtree->nodeNum == i) {
+            // Copy subtree's nodes and leaf primitive lists
+            for (int j = 0; j < subtree->nNodes; ++j) {
+                KdAccelNode &node = nodes[nodeOffsets[i] + j];
+                node = subtree->nodes[j];
+                if (!node.IsLeaf())
+                    node.initInterior(node.SplitAxis(),
+                        node.AboveChild() + nodeOffsets[i], node.SplitPos());
+                else if (node.nPrimitives() > 1) {
+                    uint32_t *prims = arena.Alloc<uint32_t>(node.nPrimitives());
+                    memcpy(prims, node.primitives,
+                           node.nPrimitives() * sizeof(uint32_t));
+                    node.primitives = prims;
+                }
+            }
+            FreeAligned(subtree->nodes);
+            delete subtree;
+            ++task;
+        }
+        else {
+            KdAccelNode &node = nodes[nodeOffsets[i]];
+            node = state.nodes[i];
+            if (!node.IsLeaf())
+                node.initInterior(node.SplitAxis(),
+                    nodeOffsets[node.AboveChild()], node.SplitPos());
+        }
+    }
+    FreeAligned(state.nodes);
+    float sahCost = 0.f;
+    if (primitives.size() > 0 && bounds.SurfaceArea() > 0.f)
+        sahCost = KdSAHCost(nodes, 0, bounds,
+            float(traversalCost) / float(isectCost)) / bounds.SurfaceArea();
+    Info("kd-tree created with %d nodes for %d primitives in %.3fs using "
+         "%d thread(s) (SAH cost %.2f)", nNodes, (int)primitives.size(),
+         buildTimer.Time(), nThreads, sahCost);
     PBRT_KDTREE_FINISHED_CONSTRUCTION(this);
 }
 
@@ -155,28 +293,48 @@ KdTreeAccel::~KdTreeAccel() {
 }
 
 
-void KdTreeAccel::buildTree(int nodeNum, const BBox &nodeBounds,
-        const vector<BBox> &allPrimBounds, uint32_t *primNums,
-        int nPrimitives, int depth, BoundEdge *edges[3],
-        uint32_t *prims0, uint32_t *prims1, int badRefines) {
-    Assert(nodeNum == nextFreeNode);
+void KdTreeAccel::buildTree(KdBuildState &state, int nodeNum,
+        const BBox &nodeBounds, const vector<BBox> &allPrimBounds,
+        vector<BoundEdge> edges[3], int depth, int badRefines) {
+    Assert(nodeNum == state.nextFreeNode);
     // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nAlloc = max(2 * nAllocedNodes, 512);
+    if (state.nextFreeNode == state.nAllocedNodes) {
+        int nAlloc = max(2 * state.nAllocedNodes, 512);
         KdAccelNode *n = AllocAligned<KdAccelNode>(nAlloc);
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes, nAllocedNodes * sizeof(KdAccelNode));
-            FreeAligned(nodes);
+        if (state.nAllocedNodes > 0) {
+            memcpy(n, state.nodes, state.nAllocedNodes * sizeof(KdAccelNode));
+            FreeAligned(state.nodes);
         }
-        nodes = n;
-        nAllocedNodes = nAlloc;
+        state.nodes = n;
+        state.nAllocedNodes = nAlloc;
+    }
+    ++state.nextFreeNode;
+    int nPrimitives = edges[0].size() / 2;
+
+    // Defer construction of small enough subtrees to _KdSubtreeTask_s
+    if (state.subtreeTasks && nPrimitives <= state.subtreeMaxPrims &&
+        nPrimitives > maxPrims && depth > 0) {
+        // Renumber subtree's primitives so its side flags fit the subtree
+        vector<uint32_t> primIndices;
+        primIndices.reserve(nPrimitives);
+        for (int i = 0; i < 2*nPrimitives; ++i)
+            if (edges[0][i].type == BoundEdge::START) {
+                state.subtreeIndex[edges[0][i].primNum] = primIndices.size();
+                primIndices.push_back(edges[0][i].primNum);
+            }
+        for (int a = 0; a < 3; ++a)
+            for (int i = 0; i < 2*nPrimitives; ++i)
+                edges[a][i].primNum = state.subtreeIndex[edges[a][i].primNum];
+        state.subtreeTasks->push_back(new KdSubtreeTask(this, nodeNum,
+            nodeBounds, allPrimBounds, edges, primIndices, depth,
+            badRefines));
+        return;
     }
-    ++nextFreeNode;
 
     // Initialize leaf node if termination criteria met
     if (nPrimitives <= maxPrims || depth == 0) {
         PBRT_KDTREE_CREATED_LEAF(nPrimitives, maxDepth-depth);
-        nodes[nodeNum].initLeaf(primNums, nPrimitives, arena);
+        initLeaf(state, nodeNum, edges[0]);
         return;
     }
 
@@ -195,15 +353,6 @@ void KdTreeAccel::buildTree(int nodeNum, const BBox &nodeBounds,
     int retries = 0;
     retrySplit:
 
-    // Initialize edges for _axis_
-    for (int i = 0; i < nPrimitives; ++i) {
-        int pn = primNums[i];
-        const BBox &bbox = allPrimBounds[pn];
-        edges[axis][2*i] =   BoundEdge(bbox.pMin[axis], pn, true);
-        edges[axis][2*i+1] = BoundEdge(bbox.pMax[axis], pn, false);
-    }
-    sort(&edges[axis][0], &edges[axis][2*nPrimitives]);
-
     // Compute cost of all splits for _axis_ to find best
     int nBelow = 0, nAbove = nPrimitives;
     for (int i = 0; i < 2*nPrimitives; ++i) {
@@ -246,31 +395,68 @@ void KdTreeAccel::buildTree(int nodeNum, const BBox &nodeBounds,
     if ((bestCost > 4.f * oldCost && nPrimitives < 16) ||
         bestAxis == -1 || badRefines == 3) {
         PBRT_KDTREE_CREATED_LEAF(nPrimitives, maxDepth-depth);
-        nodes[nodeNum].initLeaf(primNums, nPrimitives, arena);
+        initLeaf(state, nodeNum, edges[0]);
         return;
     }
 
     // Classify primitives with respect to split
+    const vector<BoundEdge> &splitEdges = edges[bestAxis];
     int n0 = 0, n1 = 0;
     for (int i = 0; i < bestOffset; ++i)
-        if (edges[bestAxis][i].type == BoundEdge::START)
-            prims0[n0++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == BoundEdge::START) {
+            state.primSides[splitEdges[i].primNum] |= 1;
+            ++n0;
+        }
     for (int i = bestOffset+1; i < 2*nPrimitives; ++i)
-        if (edges[bestAxis][i].type == BoundEdge::END)
-            prims1[n1++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == BoundEdge::END) {
+            state.primSides[splitEdges[i].primNum] |= 2;
+            ++n1;
+        }
+
+    // Partition sorted edges for children, preserving their order
+    vector<BoundEdge> edges0[3], edges1[3];
+    for (int a = 0; a < 3; ++a) {
+        edges0[a].resize(2*n0);
+        edges1[a].resize(2*n1);
+        BoundEdge *e0 = n0 ? &edges0[a][0] : NULL;
+        BoundEdge *e1 = n1 ? &edges1[a][0] : NULL;
+        const BoundEdge *e = &edges[a][0];
+        for (int i = 0; i < 2*nPrimitives; ++i) {
+            uint8_t side = state.primSides[e[i].primNum];
+            if (side & 1) *e0++ = e[i];
+            if (side & 2) *e1++ = e[i];
+        }
+    }
+    for (int i = 0; i < 2*nPrimitives; ++i)
+        state.primSides[splitEdges[i].primNum] = 0;
+    float tsplit = splitEdges[bestOffset].t;
+    for (int a = 0; a < 3; ++a)
+        vector<BoundEdge>().swap(edges[a]);
 
     // Recursively initialize children nodes
-    float tsplit = edges[bestAxis][bestOffset].t;
     PBRT_KDTREE_CREATED_INTERIOR_NODE(bestAxis, tsplit);
     BBox bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tsplit;
-    buildTree(nodeNum+1, bounds0,
-              allPrimBounds, prims0, n0, depth-1, edges,
-              prims0, prims1 + nPrimitives, badRefines);
-    uint32_t aboveChild = nextFreeNode;
-    nodes[nodeNum].initInterior(bestAxis, aboveChild, tsplit);
-    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1,
-              depth-1, edges, prims0, prims1 + nPrimitives, badRefines);
+    buildTree(state, nodeNum+1, bounds0, allPrimBounds, edges0, depth-1,
+              badRefines);
+    uint32_t aboveChild = state.nextFreeNode;
+    state.nodes[nodeNum].initInterior(bestAxis, aboveChild, tsplit);
+    buildTree(state, aboveChild, bounds1, allPrimBounds, edges1, depth-1,
+              badRefines);
+}
+
+
+void KdTreeAccel::initLeaf(KdBuildState &state, int nodeNum,
+                           const vector<BoundEdge> &edges) {
+    // Collect primitive numbers from starting edges for leaf node
+    vector<uint32_t> primNums;
+    primNums.reserve(edges.size() / 2);
+    for (uint32_t i = 0; i < edges.size(); ++i)
+        if (edges[i].type == BoundEdge::START)
+            primNums.push_back(state.primIndices ?
+                (*state.primIndices)[edges[i].primNum] : edges[i].primNum);
+    state.nodes[nodeNum].initLeaf(primNums.size() ? &primNums[0] : NULL,
+                                  primNums.size(), state.arena);
 }
 
 
@@ -290,6 +476,8 @@ bool KdTreeAccel::Intersect(const Ray &ray,
 #define MAX_TODO 64
     KdToDo todo[MAX_TODO];
     int todoPos = 0;
+    STAT_TALLY(kdNodesVisited, nodesVisited);
+    STAT_TALLY(kdPrimitiveTests, primitiveTests);
 
     // Traverse kd-tree nodes in order for ray
     bool hit = false;
@@ -299,6 +487,7 @@ bool KdTreeAccel::Intersect(const Ray &ray,
         if (ray.maxt < tmin) break;
         if (!node->IsLeaf()) {
             PBRT_KDTREE_INTERSECTION_TRAVERSED_INTERIOR_NODE(const_cast<KdAccelNode *>(node));
+            ++nodesVisited;
             // Process kd-tree interior node
 
             // Compute parametric distance along ray to split plane
@@ -335,12 +524,14 @@ bool KdTreeAccel::Intersect(const Ray &ray,
         }
         else {
             PBRT_KDTREE_INTERSECTION_TRAVERSED_LEAF_NODE(const_cast<KdAccelNode *>(node), node->nPrimitives());
+            ++nodesVisited;
             // Check for intersections inside leaf node
             uint32_t nPrimitives = node->nPrimitives();
             if (nPrimitives == 1) {
                 const Reference<Primitive> &prim = primitives[node->onePrimitive];
                 // Check one primitive inside leaf node
                 PBRT_KDTREE_INTERSECTION_PRIMITIVE_TEST(const_cast<Primitive *>(prim.GetPtr()));
+                ++primitiveTests;
                 if (prim->Intersect(ray, isect))
                 {
                     PBRT_KDTREE_INTERSECTION_HIT(const_cast<Primitive *>(prim.GetPtr()));
@@ -353,6 +544,7 @@ bool KdTreeAccel::Intersect(const Ray &ray,
                     const Reference<Primitive> &prim = primitives[prims[i]];
                     // Check one primitive inside leaf node
                     PBRT_KDTREE_INTERSECTION_PRIMITIVE_TEST(const_cast<Primitive *>(prim.GetPtr()));
+                    ++primitiveTests;
                     if (prim->Intersect(ray, isect))
                     {
                         PBRT_KDTREE_INTERSECTION_HIT(const_cast<Primitive *>(prim.GetPtr()));
@@ -392,15 +584,19 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
 #define MAX_TODO 64
     KdToDo todo[MAX_TODO];
     int todoPos = 0;
+    STAT_TALLY(kdNodesVisited, nodesVisited);
+    STAT_TALLY(kdPrimitiveTests, primitiveTests);
     const KdAccelNode *node = &nodes[0];
     while (node != NULL) {
         if (node->IsLeaf()) {
             PBRT_KDTREE_INTERSECTIONP_TRAVERSED_LEAF_NODE(const_cast<KdAccelNode *>(node), node->nPrimitives());
+            ++nodesVisited;
             // Check for shadow ray intersections inside leaf node
             uint32_t nPrimitives = node->nPrimitives();
             if (nPrimitives == 1) {
                 const Reference<Primitive> &prim = primitives[node->onePrimitive];
                 PBRT_KDTREE_INTERSECTIONP_PRIMITIVE_TEST(const_cast<Primitive *>(prim.GetPtr()));
+                ++primitiveTests;
                 if (prim->IntersectP(ray)) {
                     PBRT_KDTREE_INTERSECTIONP_HIT(const_cast<Primitive *>(prim.GetPtr()));
                     return true;
@@ -411,6 +607,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
                 for (uint32_t i = 0; i < nPrimitives; ++i) {
                     const Reference<Primitive> &prim = primitives[prims[i]];
                     PBRT_KDTREE_INTERSECTIONP_PRIMITIVE_TEST(const_cast<Primitive *>(prim.GetPtr()));
+                    ++primitiveTests;
                     if (prim->IntersectP(ray)) {
                         PBRT_KDTREE_INTERSECTIONP_HIT(const_cast<Primitive *>(prim.GetPtr()));
                         return true;
@@ -430,6 +627,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
         }
         else {
             PBRT_KDTREE_INTERSECTIONP_TRAVERSED_INTERIOR_NODE(const_cast<KdAccelNode *>(node));
+            ++nodesVisited;
             // Process kd-tree interior node
 
             // Compute parametric distance along ray to split plane
@@ -43,6 +43,7 @@
 // KdTreeAccel Declarations
 struct KdAccelNode;
 struct BoundEdge;
+struct KdBuildState;
 class KdTreeAccel : public Aggregate {
 public:
     // KdTreeAccel Public Methods
@@ -56,16 +57,19 @@ public:
     bool IntersectP(const Ray &ray) const;
 private:
     // KdTreeAccel Private Methods
-    void buildTree(int nodeNum, const BBox &bounds,
-        const vector<BBox> &primBounds, uint32_t *primNums, int nprims, int depth,
-        BoundEdge *edges[3], uint32_t *prims0, uint32_t *prims1, int badRefines = 0);
+    friend class KdSubtreeTask;
+    void buildTree(KdBuildState &state, int nodeNum, const BBox &bounds,
+        const vector<BBox> &primBounds, vector<BoundEdge> edges[3],
+        int depth, int badRefines = 0);
+    void initLeaf(KdBuildState &state, int nodeNum,
+                  const vector<BoundEdge> &edges);
 
     // KdTreeAccel Private Data
     int isectCost, traversalCost, maxPrims, maxDepth;
     float emptyBonus;
     vector<Reference<Primitive> > primitives;
     KdAccelNode *nodes;
-    int nAllocedNodes, nextFreeNode;
+    int nNodes;
     BBox bounds;
     MemoryArena arena;
 };
@@ -41,6 +41,7 @@
 #include "film.h"
 #include "volume.h"
 #include "probes.h"
+#include "stats.h"
 
 // API Additional Headers
 #include "accelerators/bvh.h"
@@ -50,6 +51,7 @@
 #include "cameras/orthographic.h"
 #include "cameras/perspective.h"
 #include "film/image.h"
+#include "film/streaming.h"
 #include "filters/box.h"
 #include "filters/gaussian.h"
 #include "filters/mitchell.h"
@@ -93,6 +95,7 @@
 #include "renderers/metropolis.h"
 #include "renderers/samplerrenderer.h"
 #include "renderers/surfacepoints.h"
+#include "renderers/wavefront.h"
 #include "renderers/oclrenderer.h"
 #include "samplers/adaptive.h"
 #include "samplers/bestcandidate.h"
@@ -167,8 +170,10 @@ struct RenderOptions {
     // RenderOptions Public Methods
     RenderOptions();
     Scene *MakeScene();
-    Camera *MakeCamera() const;
-    Renderer *MakeRenderer() const;
+    Camera *MakeCamera(int frame, int nFrames) const;
+    void FrameShutter(int frame, int nFrames, float *open,
+                      float *close) const;
+    Renderer *MakeRenderer(int frame = 0, int nFrames = 1) const;
 
     // RenderOptions Public Data
     float transformStartTime, transformEndTime;
@@ -284,6 +289,7 @@ static vector<TransformSet> pushedTransforms;
 static vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
 static vector<Reference<GeometricPrimitive> > OCLprims;
+STAT_TIMER("Time/Scene construction", sceneConstructionTime);
 
 // API Macros
 #define VERIFY_INITIALIZED(func) \
@@ -667,6 +673,8 @@ Film *MakeFilm(const string &name,
     Film *film = NULL;
     if (name == "image")
         film = CreateImageFilm(paramSet, filter);
+    else if (name == "streaming")
+        film = CreateStreamingFilm(paramSet, filter);
     else
         Warning("Film \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -682,6 +690,15 @@ void pbrtInit(const Options &opt) {
     if (currentApiState != STATE_UNINITIALIZED)
         Error("pbrtInit() has already been called.");
     currentApiState = STATE_OPTIONS_BLOCK;
+    if (PbrtOptions.nFrames < 1) {
+        Warning("--frames must be at least one; rendering a single frame.");
+        PbrtOptions.nFrames = 1;
+    }
+    if (PbrtOptions.nFrames > 1 && PbrtOptions.checkpointFile != "") {
+        Warning("--checkpoint is not supported with --frames; ignoring it.");
+        PbrtOptions.checkpointFile = "";
+        PbrtOptions.resume = false;
+    }
     renderOptions = new RenderOptions;
     graphicsState = GraphicsState();
     SampledSpectrum::Init();
@@ -1162,12 +1179,31 @@ void pbrtWorldEnd() {
     }
 
     // Create scene and render
-    Renderer *renderer = renderOptions->MakeRenderer();
-    Scene *scene = renderOptions->MakeScene();
-    if (scene && renderer) renderer->Render(scene);
+    int nFrames = PbrtOptions.nFrames;
+    Renderer *renderer = renderOptions->MakeRenderer(0, nFrames);
+    Scene *scene;
+    {
+    STAT_TIMED_SCOPE(sceneConstructionTime);
+    scene = renderOptions->MakeScene();
+    }
+    for (int frame = 0; frame < nFrames; ++frame) {
+        if (frame > 0) renderer = renderOptions->MakeRenderer(frame, nFrames);
+        if (scene && renderer) {
+            // Refit scene to the motion within this frame's shutter interval
+            if (nFrames > 1) {
+                float open, close;
+                renderOptions->FrameShutter(frame, nFrames, &open, &close);
+                scene->Refit(open, close);
+            }
+            renderer->Render(scene);
+        }
+        delete renderer;
+    }
     TasksCleanup();
-    delete renderer;
     delete scene;
+    if (PbrtOptions.printStats) StatsReport(stdout);
+    if (PbrtOptions.statsFile != "") StatsWriteJSON(PbrtOptions.statsFile);
+    StatsReset();
 
     // Clean up after rendering
     graphicsState = GraphicsState();
@@ -1208,14 +1244,23 @@ Scene *RenderOptions::MakeScene() {
 }
 
 
-Renderer *RenderOptions::MakeRenderer() const {
+Renderer *RenderOptions::MakeRenderer(int frame, int nFrames) const {
     Renderer *renderer = NULL;
-    Camera *camera = MakeCamera();
+    Camera *camera = MakeCamera(frame, nFrames);
+    if (frame == 0 && PbrtOptions.timeLimit > 0.f &&
+        RendererName != "sampler")
+        Warning("--time-limit is only supported by the \"sampler\" renderer; "
+                "ignoring it.");
+    if (PbrtOptions.checkpointFile != "" && RendererName != "sampler")
+        Warning("--checkpoint is only supported by the \"sampler\" renderer; "
+                "ignoring it.");
+    if (PbrtOptions.resume && PbrtOptions.checkpointFile == "")
+        Warning("--resume given without --checkpoint; ignoring it.");
     if (RendererName == "metropolis") {
         renderer = CreateMetropolisRenderer(RendererParams, camera);
-        RendererParams.ReportUnused();
+        if (frame == 0) RendererParams.ReportUnused();
         // Warn if no light sources are defined
-        if (lights.size() == 0)
+        if (frame == 0 && lights.size() == 0)
             Warning("No light sources defined in scene; "
                 "possibly rendering a black image.");
     }
@@ -1229,20 +1274,38 @@ Renderer *RenderOptions::MakeRenderer() const {
             VolIntegratorParams);
         if (!volumeIntegrator) Severe("Unable to create volume integrator.");
         renderer = CreateRadianceProbesRenderer(camera, surfaceIntegrator, volumeIntegrator, RendererParams);
-        RendererParams.ReportUnused();
+        if (frame == 0) RendererParams.ReportUnused();
         // Warn if no light sources are defined
-        if (lights.size() == 0)
+        if (frame == 0 && lights.size() == 0)
             Warning("No light sources defined in scene; "
                 "possibly rendering a black image.");
     }
     else if (RendererName == "aggregatetest") {
         renderer = CreateAggregateTestRenderer(RendererParams, primitives);
-        RendererParams.ReportUnused();
+        if (frame == 0) RendererParams.ReportUnused();
     }
     else if (RendererName == "surfacepoints") {
         Point pCamera = camera->CameraToWorld(camera->shutterOpen, Point(0, 0, 0));
         renderer = CreateSurfacePointsRenderer(RendererParams, pCamera, camera->shutterOpen);
-        RendererParams.ReportUnused();
+        if (frame == 0) RendererParams.ReportUnused();
+    }
+    else if (RendererName == "wavefront") {
+        Sampler *sampler = MakeSampler(SamplerName, SamplerParams, camera->film, camera);
+        if (!sampler) Severe("Unable to create sampler.");
+        // Create surface and volume integrators
+        SurfaceIntegrator *surfaceIntegrator = MakeSurfaceIntegrator(SurfIntegratorName,
+            SurfIntegratorParams);
+        if (!surfaceIntegrator) Severe("Unable to create surface integrator.");
+        VolumeIntegrator *volumeIntegrator = MakeVolumeIntegrator(VolIntegratorName,
+            VolIntegratorParams);
+        if (!volumeIntegrator) Severe("Unable to create volume integrator.");
+        renderer = CreateWavefrontRenderer(RendererParams, sampler, camera,
+                                           surfaceIntegrator, volumeIntegrator);
+        if (frame == 0) RendererParams.ReportUnused();
+        // Warn if no light sources are defined
+        if (frame == 0 && lights.size() == 0)
+            Warning("No light sources defined in scene; "
+                "possibly rendering a black image.");
     }
     else if (RendererName == "ocl") {
     	Sampler *sampler = MakeSampler(SamplerName, SamplerParams, camera->film, camera);
@@ -1255,9 +1318,25 @@ Renderer *RenderOptions::MakeRenderer() const {
             Warning("Renderer type \"%s\" unknown.  Using \"sampler\".",
                     RendererName.c_str());
         bool visIds = RendererParams.FindOneBool("visualizeobjectids", false);
-        RendererParams.ReportUnused();
+        string tileLog = RendererParams.FindOneString("tilelog", "");
+        bool progressive = RendererParams.FindOneBool("progressive", false) ||
+                           PbrtOptions.timeLimit > 0.f;
+        float noiseThreshold = RendererParams.FindOneFloat("noisethreshold", 0.f);
+        // Keep going until another limit is reached if one was given
+        bool limited = (noiseThreshold > 0.f || PbrtOptions.timeLimit > 0.f);
+        int maxPasses = RendererParams.FindOneInt("maxpasses", limited ? 0 : 8);
+        if (frame == 0) RendererParams.ReportUnused();
+        if (progressive && FilmName == "streaming") {
+            Warning("The \"streaming\" film doesn't support progressive "
+                    "rendering; rendering all samples in a single pass.");
+            progressive = false;
+        }
         Sampler *sampler = MakeSampler(SamplerName, SamplerParams, camera->film, camera);
         if (!sampler) Severe("Unable to create sampler.");
+        if (progressive && (SamplerName == "halton" ||
+                            SamplerName == "bestcandidate"))
+            Warning("The \"%s\" sampler uses the same image sample positions "
+                    "in each progressive pass.", SamplerName.c_str());
         // Create surface and volume integrators
         SurfaceIntegrator *surfaceIntegrator = MakeSurfaceIntegrator(SurfIntegratorName,
             SurfIntegratorParams);
@@ -1266,9 +1345,10 @@ Renderer *RenderOptions::MakeRenderer() const {
             VolIntegratorParams);
         if (!volumeIntegrator) Severe("Unable to create volume integrator.");
         renderer = new SamplerRenderer(sampler, camera, surfaceIntegrator,
-                                       volumeIntegrator, visIds);
+                                       volumeIntegrator, visIds, tileLog,
+                                       progressive, maxPasses, noiseThreshold);
         // Warn if no light sources are defined
-        if (lights.size() == 0)
+        if (frame == 0 && lights.size() == 0)
             Warning("No light sources defined in scene; "
                 "possibly rendering a black image.");
     }
@@ -1276,11 +1356,57 @@ Renderer *RenderOptions::MakeRenderer() const {
 }
 
 
-Camera *RenderOptions::MakeCamera() const {
+void RenderOptions::FrameShutter(int frame, int nFrames, float *open,
+                                 float *close) const {
+    float shutterOpen = CameraParams.FindOneFloat("shutteropen", 0.f);
+    float shutterClose = CameraParams.FindOneFloat("shutterclose", 1.f);
+    *open = Lerp(float(frame) / nFrames, shutterOpen, shutterClose);
+    *close = Lerp(float(frame + 1) / nFrames, shutterOpen, shutterClose);
+}
+
+
+Camera *RenderOptions::MakeCamera(int frame, int nFrames) const {
     Filter *filter = MakeFilter(FilterName, FilterParams);
-    Film *film = MakeFilm(FilmName, FilmParams, filter);
+    string filmName = FilmName;
+    if (filmName == "streaming" && RendererName != "sampler" &&
+        RendererName != "wavefront") {
+        Warning("The \"streaming\" film is only supported by the \"sampler\" "
+                "and \"wavefront\" renderers.  Using \"image\".");
+        filmName = "image";
+    }
+    Film *film;
+    ParamSet cameraParams = CameraParams;
+    if (nFrames > 1) {
+        // Give frame its share of the shutter interval and a numbered image
+        float frameOpen, frameClose;
+        FrameShutter(frame, nFrames, &frameOpen, &frameClose);
+        cameraParams.AddFloat("shutteropen", &frameOpen);
+        cameraParams.AddFloat("shutterclose", &frameClose);
+        string filename = FilmParams.FindOneString("filename", "");
+        if (filename == "") filename = PbrtOptions.imageFile;
+        if (filename == "")
+#ifdef PBRT_HAS_OPENEXR
+            filename = "pbrt.exr";
+#else
+            filename = "pbrt.tga";
+#endif
+        char suffix[16];
+        sprintf(suffix, "%04d", frame + 1);
+        size_t dot = filename.rfind('.');
+        if (dot == string::npos || filename.find('/', dot) != string::npos)
+            dot = filename.size();
+        filename.insert(dot, suffix);
+        ParamSet filmParams = FilmParams;
+        filmParams.AddString("filename", &filename, 1);
+        string imageFile = PbrtOptions.imageFile;
+        PbrtOptions.imageFile = "";
+        film = MakeFilm(filmName, filmParams, filter);
+        PbrtOptions.imageFile = imageFile;
+    }
+    else
+        film = MakeFilm(filmName, FilmParams, filter);
     if (!film) Severe("Unable to create film.");
-    Camera *camera = ::MakeCamera(CameraName, CameraParams,
+    Camera *camera = ::MakeCamera(CameraName, cameraParams,
         CameraToWorld, renderOptions->transformStartTime,
         renderOptions->transformEndTime, film);
     if (!camera) Severe("Unable to create camera.");
@@ -45,6 +45,7 @@ struct DifferentialGeometry {
     DifferentialGeometry() { 
         u = v = dudx = dvdx = dudy = dvdy = 0.; 
         shape = NULL; 
+        face = 0;
     }
     // DifferentialGeometry Public Methods
     DifferentialGeometry(const Point &P, const Vector &DPDU,
@@ -58,6 +59,7 @@ struct DifferentialGeometry {
     Normal nn;
     float u, v;
     const Shape *shape;
+    uint32_t face;
     Vector dpdu, dpdv;
     Normal dndu, dndv;
     mutable Vector dpdx, dpdy;
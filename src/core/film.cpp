@@ -35,13 +35,58 @@
 #include "film.h"
 #include "paramset.h"
 
+// Film Local Declarations
+class DirectFilmTile : public FilmTile {
+public:
+    DirectFilmTile(Film *f) : film(f) { }
+    void AddSample(const CameraSample &sample, const Spectrum &L) {
+        film->AddSample(sample, L);
+    }
+private:
+    Film *film;
+};
+
+
+
+// FilmTile Method Definitions
+FilmTile::~FilmTile() {
+}
+
+
+
 // Film Method Definitions
 Film::~Film() {
 }
 
 
+FilmTile *Film::GetFilmTile(int xstart, int xend, int ystart, int yend) {
+    // Films without tile buffers take each sample directly
+    return new DirectFilmTile(this);
+}
+
+
+void Film::MergeFilmTile(FilmTile *tile) {
+    delete tile;
+}
+
+
 void Film::UpdateDisplay(int x0, int y0, int x1, int y1,
                          float splatScale) {
 }
 
 
+bool Film::GetPixelValues(float *rgb, float splatScale) const {
+    return false;
+}
+
+
+bool Film::GetRawPixels(vector<float> *data) const {
+    return false;
+}
+
+
+bool Film::SetRawPixels(const vector<float> &data) {
+    return false;
+}
+
+
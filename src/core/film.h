@@ -39,6 +39,16 @@
 // core/film.h*
 #include "pbrt.h"
 
+// FilmTile Declarations
+class FilmTile {
+public:
+    // FilmTile Interface
+    virtual ~FilmTile();
+    virtual void AddSample(const CameraSample &sample,
+                           const Spectrum &L) = 0;
+};
+
+
 // Film Declarations
 class Film {
 public:
@@ -53,8 +63,14 @@ public:
                                  int *ystart, int *yend) const = 0;
     virtual void GetPixelExtent(int *xstart, int *xend,
                                 int *ystart, int *yend) const = 0;
+    virtual FilmTile *GetFilmTile(int xstart, int xend,
+                                  int ystart, int yend);
+    virtual void MergeFilmTile(FilmTile *tile);
     virtual void UpdateDisplay(int x0, int y0, int x1, int y1, float splatScale = 1.f);
     virtual void WriteImage(float splatScale = 1.f) = 0;
+    virtual bool GetPixelValues(float *rgb, float splatScale = 1.f) const;
+    virtual bool GetRawPixels(vector<float> *data) const;
+    virtual bool SetRawPixels(const vector<float> &data);
 
     // Film Public Data
     const int xResolution, yResolution;
@@ -59,6 +59,18 @@ BBox Union(const BBox &b, const BBox &b2) {
 }
 
 
+BBox Intersect(const BBox &b, const BBox &b2) {
+    BBox ret;
+    ret.pMin.x = max(b.pMin.x, b2.pMin.x);
+    ret.pMin.y = max(b.pMin.y, b2.pMin.y);
+    ret.pMin.z = max(b.pMin.z, b2.pMin.z);
+    ret.pMax.x = min(b.pMax.x, b2.pMax.x);
+    ret.pMax.y = min(b.pMax.y, b2.pMax.y);
+    ret.pMax.z = min(b.pMax.z, b2.pMax.z);
+    return ret;
+}
+
+
 void BBox::BoundingSphere(Point *c, float *rad) const {
     *c = .5f * pMin + .5f * pMax;
     *rad = Inside(*c) ? Distance(*c, pMax) : 0.f;
@@ -395,6 +395,7 @@ public:
     }
     friend BBox Union(const BBox &b, const Point &p);
     friend BBox Union(const BBox &b, const BBox &b2);
+    friend BBox Intersect(const BBox &b, const BBox &b2);
     bool Overlaps(const BBox &b) const {
         bool x = (pMax.x >= b.pMin.x) && (pMin.x <= b.pMax.x);
         bool y = (pMax.y >= b.pMin.y) && (pMin.y <= b.pMax.y);
@@ -453,6 +454,9 @@ public:
 };
 
 
+BBox Intersect(const BBox &b, const BBox &b2);
+
+
 
 // Geometry Inline Functions
 inline Vector::Vector(const Point &p)
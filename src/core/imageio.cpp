@@ -110,6 +110,7 @@ void WriteImage(const string &name, float *pixels, float *alpha, int xRes,
 #endif
 #include <ImfInputFile.h>
 #include <ImfRgbaFile.h>
+#include <ImfTiledRgbaFile.h>
 #include <ImfChannelList.h>
 #include <ImfFrameBuffer.h>
 #include <half.h>
@@ -179,6 +180,62 @@ static void WriteImageEXR(const string &name, float *pixels,
 }
 
 
+// EXRTileWriter Declarations
+class EXRTileWriter : public ImageTileWriter {
+public:
+    // EXRTileWriter Public Methods
+    EXRTileWriter(const string &name, int xRes, int yRes, int totalXRes,
+                  int totalYRes, int xOffset, int yOffset, int tileSize);
+    ~EXRTileWriter() { delete file; }
+    void WriteTile(int x0, int y0, int xRes, int yRes, const float *rgb);
+private:
+    // EXRTileWriter Private Data
+    string filename;
+    int xOffset, yOffset, tileSize;
+    TiledRgbaOutputFile *file;
+};
+
+
+
+// EXRTileWriter Method Definitions
+EXRTileWriter::EXRTileWriter(const string &name, int xRes, int yRes,
+        int totalXRes, int totalYRes, int xOff, int yOff, int ts)
+    : filename(name), xOffset(xOff), yOffset(yOff), tileSize(ts),
+      file(NULL) {
+    Box2i displayWindow(V2i(0,0), V2i(totalXRes-1, totalYRes-1));
+    Box2i dataWindow(V2i(xOffset, yOffset), V2i(xOffset + xRes - 1, yOffset + yRes - 1));
+    try {
+        // Store tiles in the order they're written rather than buffering them
+        file = new TiledRgbaOutputFile(name.c_str(), displayWindow,
+            dataWindow, tileSize, tileSize, ONE_LEVEL, ROUND_DOWN,
+            WRITE_RGBA, 1.f, V2f(0.f, 0.f), 1.f, RANDOM_Y);
+    }
+    catch (const std::exception &e) {
+        Error("Unable to write image file \"%s\": %s", name.c_str(),
+            e.what());
+    }
+}
+
+
+void EXRTileWriter::WriteTile(int x0, int y0, int xRes, int yRes,
+                              const float *rgb) {
+    if (!file) return;
+    Rgba *hrgba = new Rgba[xRes * yRes];
+    for (int i = 0; i < xRes * yRes; ++i)
+        hrgba[i] = Rgba(rgb[3*i], rgb[3*i+1], rgb[3*i+2], 1.f);
+    try {
+        file->setFrameBuffer(hrgba - (xOffset + x0) - (yOffset + y0) * xRes,
+                             1, xRes);
+        file->writeTile(x0 / tileSize, y0 / tileSize);
+    }
+    catch (const std::exception &e) {
+        Error("Unable to write image file \"%s\": %s", filename.c_str(),
+            e.what());
+    }
+    delete[] hrgba;
+}
+
+
 #endif // PBRT_HAS_OPENEXR
 
 
@@ -447,3 +504,132 @@ static bool WriteImagePFM(const string &filename, const float *rgb,
 }
 
 
+// PFMTileWriter Declarations
+class PFMTileWriter : public ImageTileWriter {
+public:
+    // PFMTileWriter Public Methods
+    PFMTileWriter(const string &name, int xRes, int yRes);
+    ~PFMTileWriter();
+    void WriteTile(int x0, int y0, int xRes, int yRes, const float *rgb);
+private:
+    // PFMTileWriter Private Data
+    string filename;
+    int width, height;
+    FILE *fp;
+    int64_t dataOffset;
+};
+
+
+
+// PFMTileWriter Method Definitions
+static int seekFile(FILE *fp, int64_t offset) {
+#if defined(PBRT_IS_WINDOWS)
+    return _fseeki64(fp, offset, SEEK_SET);
+#else
+    return fseeko(fp, off_t(offset), SEEK_SET);
+#endif
+}
+
+
+PFMTileWriter::PFMTileWriter(const string &name, int xRes, int yRes)
+    : filename(name), width(xRes), height(yRes) {
+    fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+        Error("Unable to open output PFM file \"%s\"", filename.c_str());
+        return;
+    }
+    float scale = hostLittleEndian ? -1.f : 1.f;
+    if (fprintf(fp, "PF\n%d %d\n%f\n", width, height, scale) < 0) {
+        Error("Error writing PFM file \"%s\"", filename.c_str());
+        fclose(fp);
+        fp = NULL;
+        return;
+    }
+    dataOffset = ftell(fp);
+}
+
+
+PFMTileWriter::~PFMTileWriter() {
+    if (fp) fclose(fp);
+}
+
+
+void PFMTileWriter::WriteTile(int x0, int y0, int xRes, int yRes,
+                              const float *rgb) {
+    if (!fp) return;
+    for (int y = 0; y < yRes; ++y) {
+        // Seek to tile's part of row; rows are stored from the bottom up
+        int64_t row = height - 1 - (y0 + y);
+        int64_t offset = dataOffset +
+            int64_t(sizeof(float)) * 3 * (row * width + x0);
+        if (seekFile(fp, offset) != 0 ||
+            fwrite(rgb + 3 * y * xRes, sizeof(float), 3 * xRes, fp) <
+                size_t(3 * xRes)) {
+            Error("Error writing PFM file \"%s\"", filename.c_str());
+            fclose(fp);
+            fp = NULL;
+            return;
+        }
+    }
+}
+
+
+
+// BufferedTileWriter Declarations
+class BufferedTileWriter : public ImageTileWriter {
+public:
+    // BufferedTileWriter Public Methods
+    BufferedTileWriter(const string &name, int xr, int yr, int txr, int tyr,
+                       int xo, int yo)
+        : filename(name), xRes(xr), yRes(yr), totalXRes(txr),
+          totalYRes(tyr), xOffset(xo), yOffset(yo) {
+        rgb = new float[3 * xRes * yRes];
+        memset(rgb, 0, 3 * xRes * yRes * sizeof(float));
+    }
+    ~BufferedTileWriter() {
+        WriteImage(filename, rgb, NULL, xRes, yRes, totalXRes, totalYRes,
+                   xOffset, yOffset);
+        delete[] rgb;
+    }
+    void WriteTile(int x0, int y0, int tileXRes, int tileYRes,
+                   const float *tileRgb) {
+        for (int y = 0; y < tileYRes; ++y)
+            memcpy(&rgb[3 * ((y0 + y) * xRes + x0)], &tileRgb[3 * y * tileXRes],
+                   3 * tileXRes * sizeof(float));
+    }
+private:
+    // BufferedTileWriter Private Data
+    string filename;
+    int xRes, yRes, totalXRes, totalYRes, xOffset, yOffset;
+    float *rgb;
+};
+
+
+
+// ImageTileWriter Method Definitions
+ImageTileWriter::~ImageTileWriter() {
+}
+
+
+ImageTileWriter *CreateImageTileWriter(const string &name, int xRes,
+        int yRes, int totalXRes, int totalYRes, int xOffset, int yOffset,
+        int tileSize) {
+    if (name.size() >= 5) {
+        uint32_t suffixOffset = name.size() - 4;
+#ifdef PBRT_HAS_OPENEXR
+        if (!strcmp(name.c_str() + suffixOffset, ".exr") ||
+            !strcmp(name.c_str() + suffixOffset, ".EXR"))
+            return new EXRTileWriter(name, xRes, yRes, totalXRes, totalYRes,
+                                     xOffset, yOffset, tileSize);
+#endif // PBRT_HAS_OPENEXR
+        if (!strcmp(name.c_str() + suffixOffset, ".pfm") ||
+            !strcmp(name.c_str() + suffixOffset, ".PFM"))
+            return new PFMTileWriter(name, xRes, yRes);
+    }
+    Warning("Image file \"%s\" can't be written a tile at a time; keeping "
+            "the whole image in memory until it's written.", name.c_str());
+    return new BufferedTileWriter(name, xRes, yRes, totalXRes, totalYRes,
+                                  xOffset, yOffset);
+}
+
+
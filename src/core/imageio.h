@@ -45,4 +45,19 @@ void WriteImage(const string &name, float *pixels, float *alpha,
     int XRes, int YRes, int totalXRes, int totalYRes, int xOffset,
     int yOffset);
 
+
+// ImageTileWriter Declarations
+class ImageTileWriter {
+public:
+    // ImageTileWriter Interface
+    virtual ~ImageTileWriter();
+    virtual void WriteTile(int x0, int y0, int xRes, int yRes,
+                           const float *rgb) = 0;
+};
+
+
+ImageTileWriter *CreateImageTileWriter(const string &name, int xRes,
+    int yRes, int totalXRes, int totalYRes, int xOffset, int yOffset,
+    int tileSize);
+
 #endif // PBRT_CORE_IMAGEIO_H
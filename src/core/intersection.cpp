@@ -38,6 +38,16 @@
 #include "light.h"
 
 // Intersection Method Definitions
+void Intersection::computeDeferredGeometry(const Ray &ray) {
+    // Compute geometry and transformations for closest deferred hit
+    deferredShape->GetDifferentialGeometry(ray, deferredT, deferredFace,
+                                           deferredParams, &dg);
+    WorldToObject = *deferredShape->WorldToObject;
+    ObjectToWorld = *deferredShape->ObjectToWorld;
+    deferredShape = NULL;
+}
+
+
 BSDF *Intersection::GetBSDF(const RayDifferential &ray,
                             MemoryArena &arena) const {
     PBRT_STARTED_BSDF_SHADING(const_cast<RayDifferential *>(&ray));
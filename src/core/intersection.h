@@ -48,6 +48,10 @@ struct Intersection {
         primitive = NULL;
         shapeId = primitiveId = 0;
         rayEpsilon = 0.f;
+        deferredShape = NULL;
+    }
+    void Finalize(const Ray &ray) {
+        if (deferredShape) computeDeferredGeometry(ray);
     }
     BSDF *GetBSDF(const RayDifferential &ray, MemoryArena &arena) const;
     BSSRDF *GetBSSRDF(const RayDifferential &ray, MemoryArena &arena) const;
@@ -59,6 +63,15 @@ struct Intersection {
     Transform WorldToObject, ObjectToWorld;
     uint32_t shapeId, primitiveId;
     float rayEpsilon;
+
+    // Hit recorded by _Shape::IntersectDeferred()_ or a mesh primitive,
+    // pending _Finalize()_
+    const Shape *deferredShape;
+    uint32_t deferredFace;
+    float deferredT, deferredParams[2];
+private:
+    // Intersection Private Methods
+    void computeDeferredGeometry(const Ray &ray);
 };
 
 
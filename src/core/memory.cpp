@@ -33,6 +33,62 @@
 // core/memory.cpp*
 #include "stdafx.h"
 #include "memory.h"
+#include <errno.h>
+#if defined(PBRT_IS_LINUX)
+#include <sys/mman.h>
+#endif
+#ifndef PBRT_THREAD_LOCAL
+#include <pthread.h>
+#endif
+
+// Memory Statistics
+STAT_MEMORY_COUNTER("Memory/MemoryArena blocks allocated", arenaBlockBytes);
+STAT_COUNTER("Memory/MemoryArena blocks reused from thread pools", nArenaBlocksReused);
+STAT_INT_DISTRIBUTION("Memory/MemoryArena bytes used per reset", arenaBytesUsed);
+STAT_INT_DISTRIBUTION("Memory/MemoryArena high-water bytes", arenaHighWater);
+
+// MemoryArena Block Pool Declarations
+
+// Blocks of destroyed _MemoryArena_s are kept by the thread that freed
+// them, up to _maxPooledBytes_, and handed to the thread's later arenas.
+// Blocks of at least _hugeBlockSize_ bytes are mapped directly so that
+// they can be backed by huge pages.
+static const uint32_t maxPooledBytes = 16 * 1024 * 1024;
+static const uint32_t hugeBlockSize = 2 * 1024 * 1024;
+struct ArenaBlockPool {
+    ArenaBlockPool() { pooledBytes = 0; }
+    vector<std::pair<uint32_t, char *> > blocks;
+    uint32_t pooledBytes;
+};
+
+
+#ifdef PBRT_THREAD_LOCAL
+static PBRT_THREAD_LOCAL ArenaBlockPool *threadBlockPool = NULL;
+static ArenaBlockPool *blockPool() {
+    if (!threadBlockPool) threadBlockPool = new ArenaBlockPool;
+    return threadBlockPool;
+}
+#else
+// No compiler-supported thread-local storage; use the threads API
+static pthread_key_t blockPoolKey;
+static pthread_once_t blockPoolKeyOnce = PTHREAD_ONCE_INIT;
+static void freeBlockPool(void *p);
+static void createBlockPoolKey() {
+    if (pthread_key_create(&blockPoolKey, freeBlockPool) != 0)
+        Severe("Error from pthread_key_create: %s", strerror(errno));
+}
+
+
+static ArenaBlockPool *blockPool() {
+    pthread_once(&blockPoolKeyOnce, createBlockPoolKey);
+    ArenaBlockPool *pool = (ArenaBlockPool *)pthread_getspecific(blockPoolKey);
+    if (!pool) {
+        pool = new ArenaBlockPool;
+        pthread_setspecific(blockPoolKey, pool);
+    }
+    return pool;
+}
+#endif // PBRT_THREAD_LOCAL
 
 // Memory Allocation Functions
 void *AllocAligned(size_t size) {
@@ -69,3 +125,105 @@ void FreeAligned(void *ptr) {
 }
 
 
+
+static char *allocHugeBlock(uint32_t size) {
+#if defined(PBRT_IS_LINUX)
+    size_t len = (size + hugeBlockSize - 1) & ~size_t(hugeBlockSize - 1);
+    void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // Use reserved huge pages until the system runs out of them
+    static volatile bool hugetlbFailed = false;
+    if (!hugetlbFailed) {
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) hugetlbFailed = true;
+    }
+#endif // MAP_HUGETLB
+    if (ptr == MAP_FAILED) {
+        // Map a huge-page-aligned range and ask for transparent huge pages
+        char *mem = (char *)mmap(NULL, len + hugeBlockSize,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == (char *)MAP_FAILED)
+            Severe("Unable to map %lu bytes for MemoryArena block: %s",
+                   (unsigned long)len, strerror(errno));
+        size_t skip = (hugeBlockSize - (size_t(mem) & (hugeBlockSize - 1))) &
+                      (hugeBlockSize - 1);
+        if (skip > 0) munmap(mem, skip);
+        munmap(mem + skip + len, hugeBlockSize - skip);
+        ptr = mem + skip;
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+    return (char *)ptr;
+#else
+    return AllocAligned<char>(size);
+#endif
+}
+
+
+static void freeBlock(char *block, uint32_t size) {
+#if defined(PBRT_IS_LINUX)
+    if (size >= hugeBlockSize) {
+        munmap(block, (size + hugeBlockSize - 1) & ~size_t(hugeBlockSize - 1));
+        return;
+    }
+#endif
+    FreeAligned(block);
+}
+
+
+static void freeBlockPool(void *p) {
+    ArenaBlockPool *pool = (ArenaBlockPool *)p;
+    for (uint32_t i = 0; i < pool->blocks.size(); ++i)
+        freeBlock(pool->blocks[i].second, pool->blocks[i].first);
+    delete pool;
+}
+
+
+
+// MemoryArena Block Pool Definitions
+char *ArenaAllocBlock(uint32_t size) {
+    // Reuse a block of the same size from this thread's pool, if possible
+    ArenaBlockPool *pool = blockPool();
+    for (int i = int(pool->blocks.size()) - 1; i >= 0; --i) {
+        if (pool->blocks[i].first == size) {
+            char *block = pool->blocks[i].second;
+            pool->blocks[i] = pool->blocks.back();
+            pool->blocks.pop_back();
+            pool->pooledBytes -= size;
+            STAT_INC(nArenaBlocksReused);
+            return block;
+        }
+    }
+    STAT_ADD(arenaBlockBytes, size);
+    if (size >= hugeBlockSize) return allocHugeBlock(size);
+    return AllocAligned<char>(size);
+}
+
+
+void ArenaFreeBlock(char *block, uint32_t size) {
+    ArenaBlockPool *pool = blockPool();
+    if (pool->pooledBytes + size <= maxPooledBytes) {
+        pool->blocks.push_back(std::make_pair(size, block));
+        pool->pooledBytes += size;
+    }
+    else
+        freeBlock(block, size);
+}
+
+
+void ArenaFreeThreadBlocks() {
+    // Release the calling thread's pool before the thread exits
+#ifdef PBRT_THREAD_LOCAL
+    ArenaBlockPool *pool = threadBlockPool;
+    threadBlockPool = NULL;
+#else
+    pthread_once(&blockPoolKeyOnce, createBlockPoolKey);
+    ArenaBlockPool *pool = (ArenaBlockPool *)pthread_getspecific(blockPoolKey);
+    pthread_setspecific(blockPoolKey, NULL);
+#endif
+    if (pool) freeBlockPool(pool);
+}
+
+
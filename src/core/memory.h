@@ -39,6 +39,7 @@
 // core/memory.h*
 #include "pbrt.h"
 #include "parallel.h"
+#include "stats.h"
 
 // Memory Declarations
 class ReferenceCounted {
@@ -94,33 +95,45 @@ template <typename T> T *AllocAligned(uint32_t count) {
 
 
 void FreeAligned(void *);
+char *ArenaAllocBlock(uint32_t size);
+void ArenaFreeBlock(char *block, uint32_t size);
+void ArenaFreeThreadBlocks();
+STAT_EXTERN(arenaBytesUsed);
+STAT_EXTERN(arenaHighWater);
 class MemoryArena {
 public:
     // MemoryArena Public Methods
     MemoryArena(uint32_t bs = 32768) {
         blockSize = bs;
         curBlockPos = 0;
-        currentBlock = AllocAligned<char>(blockSize);
+        curBlockSize = blockSize;
+        currentBlock = ArenaAllocBlock(blockSize);
+        highWater = 0;
     }
     ~MemoryArena() {
-        FreeAligned(currentBlock);
+        STAT_REPORT_VALUE(arenaHighWater, max(highWater, bytesInUse()));
+        ArenaFreeBlock(currentBlock, curBlockSize);
         for (uint32_t i = 0; i < usedBlocks.size(); ++i)
-            FreeAligned(usedBlocks[i]);
+            ArenaFreeBlock(usedBlocks[i].second, usedBlocks[i].first);
         for (uint32_t i = 0; i < availableBlocks.size(); ++i)
-            FreeAligned(availableBlocks[i]);
+            ArenaFreeBlock(availableBlocks[i].second,
+                           availableBlocks[i].first);
     }
     void *Alloc(uint32_t sz) {
         // Round up _sz_ to minimum machine alignment
         sz = ((sz + 15) & (~15));
-        if (curBlockPos + sz > blockSize) {
+        if (curBlockPos + sz > curBlockSize) {
             // Get new block of memory for _MemoryArena_
-            usedBlocks.push_back(currentBlock);
+            usedBlocks.push_back(std::make_pair(curBlockSize, currentBlock));
             if (availableBlocks.size() && sz <= blockSize) {
-                currentBlock = availableBlocks.back();
+                curBlockSize = availableBlocks.back().first;
+                currentBlock = availableBlocks.back().second;
                 availableBlocks.pop_back();
             }
-            else
-                currentBlock = AllocAligned<char>(max(sz, blockSize));
+            else {
+                curBlockSize = max(sz, blockSize);
+                currentBlock = ArenaAllocBlock(curBlockSize);
+            }
             curBlockPos = 0;
         }
         void *ret = currentBlock + curBlockPos;
@@ -134,20 +147,32 @@ public:
         return ret;
     }
     void FreeAll() {
+        uint64_t used = bytesInUse();
+        STAT_REPORT_VALUE(arenaBytesUsed, used);
+        highWater = max(highWater, used);
         curBlockPos = 0;
         while (usedBlocks.size()) {
     #ifndef NDEBUG
-            memset(usedBlocks.back(), 0xfa, blockSize);
+            memset(usedBlocks.back().second, 0xfa, usedBlocks.back().first);
     #endif
             availableBlocks.push_back(usedBlocks.back());
             usedBlocks.pop_back();
         }
     }
 private:
+    // MemoryArena Private Methods
+    uint64_t bytesInUse() const {
+        uint64_t used = curBlockPos;
+        for (uint32_t i = 0; i < usedBlocks.size(); ++i)
+            used += usedBlocks[i].first;
+        return used;
+    }
+
     // MemoryArena Private Data
-    uint32_t curBlockPos, blockSize;
+    uint32_t curBlockPos, curBlockSize, blockSize;
     char *currentBlock;
-    vector<char *> usedBlocks, availableBlocks;
+    vector<std::pair<uint32_t, char *> > usedBlocks, availableBlocks;
+    uint64_t highWater;
 };
 
 
@@ -160,6 +185,7 @@ public:
         uBlocks = RoundUp(uRes) >> logBlockSize;
         uint32_t nAlloc = RoundUp(uRes) * RoundUp(vRes);
         data = AllocAligned<T>(nAlloc);
+        NumaInterleave(data, nAlloc * sizeof(T));
         for (uint32_t i = 0; i < nAlloc; ++i)
             new (&data[i]) T();
         if (d)
@@ -40,8 +40,13 @@
 #include "pbrt.h"
 #include "spectrum.h"
 #include "texture.h"
+#include "parallel.h"
+#include "stats.h"
 
 // MIPMap Declarations
+STAT_EXTERN(nTrilinearLookups);
+STAT_EXTERN(nEWALookups);
+STAT_EXTERN(mipmapBytes);
 typedef enum {
     TEXTURE_REPEAT,
     TEXTURE_BLACK,
@@ -85,9 +90,9 @@ private:
         }
         return wt;
     }
-    float clamp(float v) { return Clamp(v, 0.f, INFINITY); }
-    RGBSpectrum clamp(const RGBSpectrum &v) { return v.Clamp(0.f, INFINITY); }
-    SampledSpectrum clamp(const SampledSpectrum &v) { return v.Clamp(0.f, INFINITY); }
+    float clamp(float v) const { return Clamp(v, 0.f, INFINITY); }
+    RGBSpectrum clamp(const RGBSpectrum &v) const { return v.Clamp(0.f, INFINITY); }
+    SampledSpectrum clamp(const SampledSpectrum &v) const { return v.Clamp(0.f, INFINITY); }
     T triangle(uint32_t level, float s, float t) const;
     T EWA(uint32_t level, float s, float t, float ds0, float dt0, float ds1, float dt1) const;
 
@@ -99,6 +104,68 @@ private:
         int firstTexel;
         float weight[4];
     };
+    struct SZoomRow {
+        // Compute row _t_ of $s$-zoomed image
+        void operator()(int t) const {
+            for (uint32_t s = 0; s < sPow2; ++s) {
+                // Compute texel $(s,t)$ in $s$-zoomed image
+                resampledImage[t*sPow2+s] = 0.;
+                for (int j = 0; j < 4; ++j) {
+                    int origS = sWeights[s].firstTexel + j;
+                    if (wrapMode == TEXTURE_REPEAT)
+                        origS = Mod(origS, sres);
+                    else if (wrapMode == TEXTURE_CLAMP)
+                        origS = Clamp(origS, 0, sres-1);
+                    if (origS >= 0 && origS < (int)sres)
+                        resampledImage[t*sPow2+s] += sWeights[s].weight[j] *
+                                                     img[t*sres + origS];
+                }
+            }
+        }
+        const ResampleWeight *sWeights;
+        const T *img;
+        T *resampledImage;
+        uint32_t sres, sPow2;
+        ImageWrap wrapMode;
+    };
+    struct TZoomColumn {
+        // Resample column _s_ of image in $t$ direction
+        void operator()(int s) const {
+            vector<T> workData(tPow2);
+            for (uint32_t t = 0; t < tPow2; ++t) {
+                workData[t] = 0.;
+                for (uint32_t j = 0; j < 4; ++j) {
+                    int offset = tWeights[t].firstTexel + j;
+                    if (wrapMode == TEXTURE_REPEAT) offset = Mod(offset, tres);
+                    else if (wrapMode == TEXTURE_CLAMP) offset = Clamp(offset, 0, tres-1);
+                    if (offset >= 0 && offset < (int)tres)
+                        workData[t] += tWeights[t].weight[j] *
+                            resampledImage[offset*sPow2 + s];
+                }
+            }
+            for (uint32_t t = 0; t < tPow2; ++t)
+                resampledImage[t*sPow2 + s] = mipmap->clamp(workData[t]);
+        }
+        const MIPMap<T> *mipmap;
+        const ResampleWeight *tWeights;
+        T *resampledImage;
+        uint32_t tres, tPow2, sPow2;
+        ImageWrap wrapMode;
+    };
+    struct FilterLevelRow {
+        // Filter four texels from finer level for row _t_ of _level_
+        void operator()(int t) const {
+            BlockedArray<T> &l = *mipmap->pyramid[level];
+            for (uint32_t s = 0; s < l.uSize(); ++s)
+                l(s, t) = .25f *
+                   (mipmap->Texel(level-1, 2*s, 2*t)   +
+                    mipmap->Texel(level-1, 2*s+1, 2*t) +
+                    mipmap->Texel(level-1, 2*s, 2*t+1) +
+                    mipmap->Texel(level-1, 2*s+1, 2*t+1));
+        }
+        const MIPMap<T> *mipmap;
+        uint32_t level;
+    };
     BlockedArray<T> **pyramid;
     uint32_t width, height, nLevels;
 #define WEIGHT_LUT_SIZE 128
@@ -124,43 +191,27 @@ MIPMap<T>::MIPMap(uint32_t sres, uint32_t tres, const T *img, bool doTri,
         resampledImage = new T[sPow2 * tPow2];
 
         // Apply _sWeights_ to zoom in $s$ direction
-        for (uint32_t t = 0; t < tres; ++t) {
-            for (uint32_t s = 0; s < sPow2; ++s) {
-                // Compute texel $(s,t)$ in $s$-zoomed image
-                resampledImage[t*sPow2+s] = 0.;
-                for (int j = 0; j < 4; ++j) {
-                    int origS = sWeights[s].firstTexel + j;
-                    if (wrapMode == TEXTURE_REPEAT)
-                        origS = Mod(origS, sres);
-                    else if (wrapMode == TEXTURE_CLAMP)
-                        origS = Clamp(origS, 0, sres-1);
-                    if (origS >= 0 && origS < (int)sres)
-                        resampledImage[t*sPow2+s] += sWeights[s].weight[j] *
-                                                     img[t*sres + origS];
-                }
-            }
-        }
+        SZoomRow sZoom;
+        sZoom.sWeights = sWeights;
+        sZoom.img = img;
+        sZoom.resampledImage = resampledImage;
+        sZoom.sres = sres;
+        sZoom.sPow2 = sPow2;
+        sZoom.wrapMode = wrapMode;
+        ParallelFor(0, tres, max(1u, 16384u / sPow2), sZoom);
         delete[] sWeights;
 
         // Resample image in $t$ direction
         ResampleWeight *tWeights = resampleWeights(tres, tPow2);
-        T *workData = new T[tPow2];
-        for (uint32_t s = 0; s < sPow2; ++s) {
-            for (uint32_t t = 0; t < tPow2; ++t) {
-                workData[t] = 0.;
-                for (uint32_t j = 0; j < 4; ++j) {
-                    int offset = tWeights[t].firstTexel + j;
-                    if (wrapMode == TEXTURE_REPEAT) offset = Mod(offset, tres);
-                    else if (wrapMode == TEXTURE_CLAMP) offset = Clamp(offset, 0, tres-1);
-                    if (offset >= 0 && offset < (int)tres)
-                        workData[t] += tWeights[t].weight[j] *
-                            resampledImage[offset*sPow2 + s];
-                }
-            }
-            for (uint32_t t = 0; t < tPow2; ++t)
-                resampledImage[t*sPow2 + s] = clamp(workData[t]);
-        }
-        delete[] workData;
+        TZoomColumn tZoom;
+        tZoom.mipmap = this;
+        tZoom.tWeights = tWeights;
+        tZoom.resampledImage = resampledImage;
+        tZoom.tres = tres;
+        tZoom.tPow2 = tPow2;
+        tZoom.sPow2 = sPow2;
+        tZoom.wrapMode = wrapMode;
+        ParallelFor(0, sPow2, max(1u, 16384u / tPow2), tZoom);
         delete[] tWeights;
         img = resampledImage;
         sres = sPow2;
@@ -174,18 +225,19 @@ MIPMap<T>::MIPMap(uint32_t sres, uint32_t tres, const T *img, bool doTri,
 
     // Initialize most detailed level of MIPMap
     pyramid[0] = new BlockedArray<T>(sres, tres, img);
+    STAT_ADD(mipmapBytes, sres * tres * sizeof(T));
     for (uint32_t i = 1; i < nLevels; ++i) {
         // Initialize $i$th MIPMap level from $i-1$st level
         uint32_t sRes = max(1u, pyramid[i-1]->uSize()/2);
         uint32_t tRes = max(1u, pyramid[i-1]->vSize()/2);
         pyramid[i] = new BlockedArray<T>(sRes, tRes);
+        STAT_ADD(mipmapBytes, sRes * tRes * sizeof(T));
 
         // Filter four texels from finer level of pyramid
-        for (uint32_t t = 0; t < tRes; ++t)
-            for (uint32_t s = 0; s < sRes; ++s)
-                (*pyramid[i])(s, t) = .25f *
-                   (Texel(i-1, 2*s, 2*t)   + Texel(i-1, 2*s+1, 2*t) +
-                    Texel(i-1, 2*s, 2*t+1) + Texel(i-1, 2*s+1, 2*t+1));
+        FilterLevelRow filter;
+        filter.mipmap = this;
+        filter.level = i;
+        ParallelFor(0, tRes, max(1u, 16384u / sRes), filter);
     }
     if (resampledImage) delete[] resampledImage;
     // Initialize EWA filter weights if needed
@@ -242,6 +294,7 @@ T MIPMap<T>::Lookup(float s, float t, float width) const {
 
     // Perform trilinear interpolation at appropriate MIPMap level
     PBRT_MIPMAP_TRILINEAR_FILTER(const_cast<MIPMap<T> *>(this), s, t, width, level, nLevels);
+    STAT_INC(nTrilinearLookups);
     if (level < 0)
         return triangle(0, s, t);
     else if (level >= nLevels - 1)
@@ -281,6 +334,7 @@ T MIPMap<T>::Lookup(float s, float t, float ds0, float dt0,
         return val;
     }
     PBRT_STARTED_EWA_TEXTURE_LOOKUP(s, t);
+    STAT_INC(nEWALookups);
     // Compute ellipse minor and major axes
     if (ds0*ds0 + dt0*dt0 < ds1*ds1 + dt1*dt1) {
         swap(ds0, ds1);
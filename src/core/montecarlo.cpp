@@ -36,6 +36,7 @@
 #include "geometry.h"
 #include "shape.h"
 #include "volume.h"
+#include "parallel.h"
 
 // Sampling Local Definitions
 static const int primes[] = {
@@ -353,12 +354,24 @@ void UniformSampleTriangle(float u1, float u2, float *u, float *v) {
     *v = u2 * su1;
 }
 
-Distribution2D::Distribution2D(const float *func, int nu, int nv) {
-    pConditionalV.reserve(nv);
-    for (int v = 0; v < nv; ++v) {
-        // Compute conditional sampling distribution for $\tilde{v}$
-        pConditionalV.push_back(new Distribution1D(&func[v*nu], nu));
+struct ConditionalDistribution {
+    // Compute conditional sampling distribution for $\tilde{v}$
+    void operator()(int v) const {
+        (*pConditionalV)[v] = new Distribution1D(&func[v*nu], nu);
     }
+    vector<Distribution1D *> *pConditionalV;
+    const float *func;
+    int nu;
+};
+
+
+Distribution2D::Distribution2D(const float *func, int nu, int nv) {
+    pConditionalV.resize(nv);
+    ConditionalDistribution conditional;
+    conditional.pConditionalV = &pConditionalV;
+    conditional.func = func;
+    conditional.nu = nu;
+    ParallelFor(0, nv, max(1, 16384 / nu), conditional);
 
     // Compute marginal sampling distribution $p[\tilde{v}]$
     vector<float> marginalFunc;
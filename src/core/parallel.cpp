@@ -34,6 +34,7 @@
 #include "stdafx.h"
 #include "parallel.h"
 #include "memory.h"
+#include "timer.h"
 #ifdef PBRT_USE_GRAND_CENTRAL_DISPATCH
 #include <dispatch/dispatch.h>
 #endif // PBRT_USE_GRAND_CENTRAL_DISPATCH
@@ -45,7 +46,11 @@
 #include <sys/param.h>
 #include <sys/sysctl.h>
 #include <errno.h>
+#include <sched.h>
 #endif 
+#if defined(PBRT_IS_LINUX)
+#include <sys/syscall.h>
+#endif
 #include <list>
 
 // Parallel Local Declarations
@@ -58,12 +63,14 @@ static pthread_t *threads;
 static dispatch_queue_t gcdQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
 static dispatch_group_t gcdGroup = dispatch_group_create();
 #else
+struct TaskRange;
 static Mutex *taskQueueMutex = Mutex::Create();
-static std::vector<Task *> taskQueue;
+static std::vector<TaskRange *> taskQueue;
+static AtomicInt32 taskQueueSize;
 #endif // PBRT_USE_GRAND_CENTRAL_DISPATCH
 #ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
 static Semaphore *workerSemaphore;
-static uint32_t numUnfinishedTasks;
+static AtomicInt32 numUnfinishedTasks;
 static ConditionVariable *tasksRunningCondition;
 #endif // PBRT_USE_GRAND_CENTRAL_DISPATCH
 #ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
@@ -73,7 +80,93 @@ DWORD WINAPI taskEntry(LPVOID arg);
 #else
 void *taskEntry(void *arg);
 #endif
+
+// TaskBatch Declarations
+struct TaskBatch {
+    // TaskBatch Public Data
+    vector<Task *> tasks;
+    AtomicInt32 unfinished;
+    AtomicInt32 *pending;
+};
+
+
+struct TaskRange {
+    TaskRange(TaskBatch *b, int s, int e) {
+        batch = b; start = s; end = e;
+    }
+    TaskBatch *batch;
+    int start, end;
+};
+
+
+
+// TaskDeque Declarations
+struct TaskDequeBuffer {
+    TaskDequeBuffer(int size) {
+        mask = size - 1;
+        ranges = new TaskRange *[size];
+    }
+    ~TaskDequeBuffer() { delete[] ranges; }
+    int32_t mask;
+    TaskRange **ranges;
+};
+
+
+class TaskDeque {
+public:
+    // TaskDeque Public Methods
+    TaskDeque();
+    ~TaskDeque();
+    void Push(TaskRange *range);
+    TaskRange *Pop();
+    TaskRange *Steal();
+private:
+    // TaskDeque Private Data
+    AtomicInt32 top;
+    char pad[PBRT_L1_CACHE_LINE_SIZE];
+    AtomicInt32 bottom;
+    TaskDequeBuffer * volatile buffer;
+    vector<TaskDequeBuffer *> retiredBuffers;
+};
+
+
+struct TaskWorker {
+    // TaskWorker Public Data
+    TaskDeque deque;
+    int index;
+    uint32_t rngState;
+    AtomicInt32 *frame;
+    int serialDepth;
+    int cpu, numaNode;
+    // _nRays_ is updated for every ray traced, so keep it off the cache
+    // lines of _deque_, which other workers read when stealing
+    char raysPad[PBRT_L1_CACHE_LINE_SIZE];
+    uint64_t nRays;
+    char pad[PBRT_L1_CACHE_LINE_SIZE];
+};
+
+
+static TaskWorker *workers;
+static int nWorkers;
+static AtomicInt32 numSleepingWorkers, numWaitingWorkers;
+static volatile bool shutdownWorkers;
+#if defined(PBRT_IS_WINDOWS)
+static DWORD workerTlsIndex = TLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t workerKey;
+static bool workerKeyCreated = false;
+#endif
 #endif // !PBRT_USE_GRAND_CENTRAL_DISPATCH
+struct NumaNode {
+    int id;
+    vector<int> cpus;
+};
+
+
+static vector<NumaNode> numaNodes;
+static bool numaTopologyInitialized = false;
+static uint64_t mainThreadRays;
+static Timer *rayCountTimer;
 
 // Parallel Definitions
 #if !defined(PBRT_IS_WINDOWS)
@@ -719,16 +812,364 @@ void ConditionVariable::Signal() {
 
 
 #endif // PBRT_IS_WINDOWS
+#if defined(PBRT_IS_WINDOWS)
+DWORD WINAPI Thread::entry(LPVOID arg) {
+#else
+void *Thread::entry(void *arg) {
+#endif
+    Thread *thread = (Thread *)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+
+Thread *Thread::Create(void (*func)(void *), void *arg) {
+    Thread *thread = new Thread;
+    thread->func = func;
+    thread->arg = arg;
+#if defined(PBRT_IS_WINDOWS)
+    thread->handle = CreateThread(NULL, 0, entry, thread, 0, NULL);
+    if (thread->handle == NULL)
+        Severe("Error from CreateThread");
+#else
+    int err = pthread_create(&thread->thread, NULL, &entry, thread);
+    if (err != 0)
+        Severe("Error from pthread_create: %s", strerror(err));
+#endif
+    return thread;
+}
+
+
+void Thread::Join(Thread *thread) {
+#if defined(PBRT_IS_WINDOWS)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    int err = pthread_join(thread->thread, NULL);
+    if (err != 0)
+        Severe("Error from pthread_join: %s", strerror(err));
+#endif
+    delete thread;
+}
+
+
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+
+// TaskDeque Method Definitions
+TaskDeque::TaskDeque() {
+    top = bottom = 0;
+    buffer = new TaskDequeBuffer(256);
+}
+
+
+TaskDeque::~TaskDeque() {
+    delete buffer;
+    for (uint32_t i = 0; i < retiredBuffers.size(); ++i)
+        delete retiredBuffers[i];
+}
+
+
+void TaskDeque::Push(TaskRange *range) {
+    // Only the owning worker pushes to the bottom of its deque
+    int32_t b = bottom, t = top;
+    TaskDequeBuffer *buf = buffer;
+    if (b - t > buf->mask) {
+        // Grow deque buffer, keeping the old one alive for thieves
+        TaskDequeBuffer *newBuf = new TaskDequeBuffer(2 * (buf->mask + 1));
+        for (int32_t i = t; i < b; ++i)
+            newBuf->ranges[i & newBuf->mask] = buf->ranges[i & buf->mask];
+        retiredBuffers.push_back(buf);
+        AtomicMemoryBarrier();
+        buffer = buf = newBuf;
+    }
+    buf->ranges[b & buf->mask] = range;
+    AtomicMemoryBarrier();
+    bottom = b + 1;
+}
+
+
+TaskRange *TaskDeque::Pop() {
+    // Reserve the bottom element before looking at _top_
+    int32_t b = AtomicAdd(&bottom, -1);
+    int32_t t = top;
+    if (t > b) {
+        bottom = b + 1;
+        return NULL;
+    }
+    TaskDequeBuffer *buf = buffer;
+    TaskRange *range = buf->ranges[b & buf->mask];
+    if (t == b) {
+        // Race thieves for the last element in the deque
+        if (AtomicCompareAndSwap(&top, t + 1, t) != t)
+            range = NULL;
+        bottom = b + 1;
+    }
+    return range;
+}
+
+
+TaskRange *TaskDeque::Steal() {
+    int32_t t = top;
+    AtomicMemoryBarrier();
+    int32_t b = bottom;
+    if (t >= b)
+        return NULL;
+    TaskDequeBuffer *buf = buffer;
+    TaskRange *range = buf->ranges[t & buf->mask];
+    if (AtomicCompareAndSwap(&top, t + 1, t) != t)
+        return NULL;
+    return range;
+}
+
+
+
+// Task Scheduling Local Functions
+static TaskWorker *currentWorker() {
+#if defined(PBRT_IS_WINDOWS)
+    return (TaskWorker *)TlsGetValue(workerTlsIndex);
+#else
+    return (TaskWorker *)pthread_getspecific(workerKey);
+#endif
+}
+
+
+static void wakeWorkers(int count) {
+    // Make queued work visible before checking for sleeping workers
+    AtomicMemoryBarrier();
+    int sleeping = numSleepingWorkers;
+    if (sleeping > 0)
+        workerSemaphore->Post(min(count, sleeping));
+}
+
+
+static TaskRange *findWork(TaskWorker *worker) {
+    // Take most recently pushed range from this worker's deque
+    TaskRange *range = worker->deque.Pop();
+    if (range) return range;
+
+    // Try to steal the oldest range from randomly chosen workers
+    for (int i = 0; i < 2 * nWorkers; ++i) {
+        worker->rngState ^= worker->rngState << 13;
+        worker->rngState ^= worker->rngState >> 17;
+        worker->rngState ^= worker->rngState << 5;
+        int victim = worker->rngState % nWorkers;
+        if (victim == worker->index) continue;
+        range = workers[victim].deque.Steal();
+        if (range) return range;
+    }
+
+    // Take work enqueued from threads outside the pool
+    if (taskQueueSize > 0) {
+        MutexLock lock(*taskQueueMutex);
+        if (taskQueue.size() > 0) {
+            range = taskQueue.back();
+            taskQueue.pop_back();
+            AtomicAdd(&taskQueueSize, -1);
+        }
+    }
+    return range;
+}
+
+
+static void runTaskRange(TaskWorker *worker, TaskRange *range);
+static void runQueuedTask(TaskWorker *worker) {
+    // Run one queued task range, or yield if there's no work to be found
+    TaskRange *range = worker ? findWork(worker) : NULL;
+    if (range)
+        runTaskRange(worker, range);
+    else {
+        AtomicAdd(&numWaitingWorkers, 1);
+#if defined(PBRT_IS_WINDOWS)
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+        AtomicAdd(&numWaitingWorkers, -1);
+    }
+}
+
+
+static void waitForSubtasks(TaskWorker *worker, AtomicInt32 *pending) {
+    // Run other queued work until all subtasks have finished
+    while (*pending > 0)
+        runQueuedTask(worker);
+}
+
+
+static void runTask(TaskWorker *worker, Task *task) {
+    // Run _task_ with its own count of outstanding subtasks
+    AtomicInt32 subtasks = 0;
+    AtomicInt32 *parentFrame = worker->frame;
+    worker->frame = &subtasks;
+    PBRT_STARTED_TASK(task);
+    task->Run();
+    waitForSubtasks(worker, &subtasks);
+    PBRT_FINISHED_TASK(task);
+    worker->frame = parentFrame;
+}
+
+
+static void runTaskRange(TaskWorker *worker, TaskRange *range) {
+    // Split off the front of the range for other workers to steal
+    while (range->end - range->start > 1) {
+        int mid = range->start + (range->end - range->start) / 2;
+        worker->deque.Push(new TaskRange(range->batch, range->start, mid));
+        wakeWorkers(1);
+        range->start = mid;
+    }
+    TaskBatch *batch = range->batch;
+    Task *task = batch->tasks[range->start];
+    delete range;
+    runTask(worker, task);
+
+    // Report task completion to the batch and the code waiting for it
+    if (AtomicAdd(&batch->unfinished, -1) == 0) {
+        AtomicInt32 *pending = batch->pending;
+        delete batch;
+        if (AtomicAdd(pending, -1) == 0 && pending == &numUnfinishedTasks) {
+            tasksRunningCondition->Lock();
+            tasksRunningCondition->Signal();
+            tasksRunningCondition->Unlock();
+        }
+    }
+}
+
+
+#endif // !PBRT_USE_GRAND_CENTRAL_DISPATCH
+
+// NUMA Local Functions
+static void initNumaTopology() {
+    if (numaTopologyInitialized) return;
+    numaTopologyInitialized = true;
+#if defined(PBRT_IS_LINUX)
+    // Find the CPUs of each NUMA node that this process may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &allowed);
+    for (int node = 0; node < 64; ++node) {
+        char path[64];
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        // Parse list of CPU ranges, e.g. ``0-7,16-23''
+        NumaNode n;
+        n.id = node;
+        int first, last;
+        while (fscanf(f, "%d", &first) == 1) {
+            last = first;
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%d", &last) != 1) break;
+                c = fgetc(f);
+            }
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))
+                    n.cpus.push_back(cpu);
+            if (c != ',') break;
+        }
+        fclose(f);
+        if (n.cpus.size() > 0)
+            numaNodes.push_back(n);
+    }
+    if (numaNodes.size() == 0) {
+        // Treat system as a single node if topology isn't available
+        NumaNode n;
+        n.id = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                n.cpus.push_back(cpu);
+        numaNodes.push_back(n);
+    }
+#elif defined(PBRT_IS_WINDOWS)
+    ULONG highestNode = 0;
+    if (!GetNumaHighestNodeNumber(&highestNode))
+        highestNode = 0;
+    for (ULONG node = 0; node <= highestNode; ++node) {
+        ULONGLONG mask = 0;
+        if (!GetNumaNodeProcessorMask((UCHAR)node, &mask))
+            continue;
+        NumaNode n;
+        n.id = node;
+        for (int cpu = 0; cpu < 64; ++cpu)
+            if (mask & (1ULL << cpu))
+                n.cpus.push_back(cpu);
+        if (n.cpus.size() > 0)
+            numaNodes.push_back(n);
+    }
+#endif
+}
+
+
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+static void assignWorkerCPUs() {
+    for (int i = 0; i < nWorkers; ++i)
+        workers[i].cpu = workers[i].numaNode = -1;
+    if (!PbrtOptions.pinThreads)
+        return;
+    initNumaTopology();
+    if (numaNodes.size() == 0) {
+        Warning("Thread pinning isn't supported on this system.");
+        return;
+    }
+    // Spread workers across NUMA nodes and then across each node's CPUs
+    int nNodes = numaNodes.size();
+    for (int i = 0; i < nWorkers; ++i) {
+        const NumaNode &node = numaNodes[i % nNodes];
+        workers[i].numaNode = i % nNodes;
+        workers[i].cpu = node.cpus[(i / nNodes) % node.cpus.size()];
+    }
+}
+
+
+static void pinWorker(TaskWorker *worker) {
+    if (worker->cpu < 0) return;
+#if defined(PBRT_IS_LINUX)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0)
+        Warning("Error from pthread_setaffinity_np: %s", strerror(err));
+#elif defined(PBRT_IS_WINDOWS)
+    if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << worker->cpu))
+        Warning("Error from SetThreadAffinityMask: %d", GetLastError());
+#endif
+}
+
+
+#endif // !PBRT_USE_GRAND_CENTRAL_DISPATCH
 void TasksInit() {
     if (PbrtOptions.nCores == 1)
         return;
 #ifdef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    if (PbrtOptions.pinThreads)
+        Warning("Thread pinning isn't supported with Grand Central Dispatch.");
     return;
 #else // PBRT_USE_GRAND_CENTRAL_DISPATCH
     static const int nThreads = NumSystemCores();
     workerSemaphore = new Semaphore;
     tasksRunningCondition = new ConditionVariable;
+    nWorkers = nThreads;
+    workers = new TaskWorker[nWorkers];
+    for (int i = 0; i < nWorkers; ++i) {
+        workers[i].index = i;
+        workers[i].rngState = 2463534242u + 7919u * i;
+        workers[i].frame = NULL;
+        workers[i].serialDepth = 0;
+        workers[i].nRays = 0;
+    }
+    assignWorkerCPUs();
+    numSleepingWorkers = numWaitingWorkers = 0;
+    shutdownWorkers = false;
 #if !defined(PBRT_IS_WINDOWS)
+    if (!workerKeyCreated) {
+        int err = pthread_key_create(&workerKey, NULL);
+        if (err != 0)
+            Severe("Error from pthread_key_create: %s", strerror(err));
+        workerKeyCreated = true;
+    }
     threads = new pthread_t[nThreads];
     for (int i = 0; i < nThreads; ++i) {
         int err = pthread_create(&threads[i], NULL, &taskEntry, reinterpret_cast<void *>(i));
@@ -736,6 +1177,11 @@ void TasksInit() {
             Severe("Error from pthread_create: %s", strerror(err));
     }
 #else
+    if (workerTlsIndex == TLS_OUT_OF_INDEXES) {
+        workerTlsIndex = TlsAlloc();
+        if (workerTlsIndex == TLS_OUT_OF_INDEXES)
+            Severe("Error from TlsAlloc: %d", GetLastError());
+    }
     threads = new HANDLE[nThreads];
     for (int i = 0; i < nThreads; ++i) {
         threads[i] = CreateThread(NULL, 0, taskEntry, reinterpret_cast<void *>(i), 0, NULL);
@@ -760,6 +1206,7 @@ void TasksCleanup() {
     }
 
     static const int nThreads = NumSystemCores();
+    shutdownWorkers = true;
     if (workerSemaphore != NULL)
         workerSemaphore->Post(nThreads);
 
@@ -779,6 +1226,8 @@ void TasksCleanup() {
         delete[] threads;
         threads = NULL;
     }
+    delete[] workers;
+    workers = NULL;
 #endif // PBRT_USE_GRAND_CENTRAL_DISPATCH
 }
 
@@ -798,6 +1247,14 @@ static void lRunTask(void *t) {
 
 #endif
 void EnqueueTasks(const vector<Task *> &tasks) {
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    TaskWorker *serialWorker = threads ? currentWorker() : NULL;
+    if (serialWorker && serialWorker->serialDepth > 0) {
+        for (uint32_t i = 0; i < tasks.size(); ++i)
+            tasks[i]->Run();
+        return;
+    }
+#endif // !PBRT_USE_GRAND_CENTRAL_DISPATCH
     if (PbrtOptions.nCores == 1) {
         for (unsigned int i = 0; i < tasks.size(); ++i)
             tasks[i]->Run();
@@ -809,16 +1266,30 @@ void EnqueueTasks(const vector<Task *> &tasks) {
 #else
     if (!threads)
         TasksInit();
+    if (tasks.size() == 0)
+        return;
 
-    { MutexLock lock(*taskQueueMutex);
-    for (unsigned int i = 0; i < tasks.size(); ++i)
-        taskQueue.push_back(tasks[i]);
+    // Wrap _tasks_ in a _TaskRange_ that workers split as they run it
+    TaskBatch *batch = new TaskBatch;
+    batch->tasks = tasks;
+    batch->unfinished = tasks.size();
+    TaskRange *range = new TaskRange(batch, 0, tasks.size());
+    TaskWorker *worker = currentWorker();
+    if (worker) {
+        // Push subtasks of the running task onto this worker's deque
+        batch->pending = worker->frame;
+        AtomicAdd(batch->pending, 1);
+        worker->deque.Push(range);
     }
-    tasksRunningCondition->Lock();
-    numUnfinishedTasks += tasks.size();
-    tasksRunningCondition->Unlock();
-
-    workerSemaphore->Post(tasks.size());
+    else {
+        batch->pending = &numUnfinishedTasks;
+        AtomicAdd(batch->pending, 1);
+        { MutexLock lock(*taskQueueMutex);
+        taskQueue.push_back(range);
+        }
+        AtomicAdd(&taskQueueSize, 1);
+    }
+    wakeWorkers(tasks.size());
 #endif
 }
 
@@ -829,28 +1300,38 @@ static DWORD WINAPI taskEntry(LPVOID arg) {
 #else
 static void *taskEntry(void *arg) {
 #endif
+    TaskWorker *worker = &workers[reinterpret_cast<intptr_t>(arg)];
+#if defined(PBRT_IS_WINDOWS)
+    TlsSetValue(workerTlsIndex, worker);
+#else
+    pthread_setspecific(workerKey, worker);
+#endif
+    pinWorker(worker);
     while (true) {
-        workerSemaphore->Wait();
-        // Try to get task from task queue
-        Task *myTask = NULL;
-        { MutexLock lock(*taskQueueMutex);
-        if (taskQueue.size() == 0)
-            break;
-        myTask = taskQueue.back();
-        taskQueue.pop_back();
+        // Run tasks until no work can be found
+        TaskRange *range = findWork(worker);
+        if (range) {
+            runTaskRange(worker, range);
+            continue;
         }
 
-        // Do work for _myTask_
-        PBRT_STARTED_TASK(myTask);
-        myTask->Run();
-        PBRT_FINISHED_TASK(myTask);
-        tasksRunningCondition->Lock();
-        int unfinished = --numUnfinishedTasks;
-        if (unfinished == 0)
-            tasksRunningCondition->Signal();
-        tasksRunningCondition->Unlock();
+        // Check for work once more after announcing that we'll sleep
+        AtomicAdd(&numSleepingWorkers, 1);
+        range = findWork(worker);
+        if (range) {
+            AtomicAdd(&numSleepingWorkers, -1);
+            runTaskRange(worker, range);
+            continue;
+        }
+        if (shutdownWorkers) {
+            AtomicAdd(&numSleepingWorkers, -1);
+            break;
+        }
+        workerSemaphore->Wait();
+        AtomicAdd(&numSleepingWorkers, -1);
     }
     // Cleanup from task thread and exit
+    ArenaFreeThreadBlocks();
 #if !defined(PBRT_IS_WINDOWS)
     pthread_exit(NULL);
 #endif // !PBRT_IS_WINDOWS
@@ -867,6 +1348,14 @@ void WaitForAllTasks() {
 #else
     if (!tasksRunningCondition)
         return;  // no tasks have been enqueued, so TasksInit() never called
+    TaskWorker *worker = currentWorker();
+    if (worker && worker->serialDepth > 0)
+        return;  // enqueued tasks were run immediately
+    if (worker) {
+        // Help run queued work until the current task's subtasks finish
+        waitForSubtasks(worker, worker->frame);
+        return;
+    }
     tasksRunningCondition->Lock();
     while (numUnfinishedTasks > 0)
         tasksRunningCondition->Wait();
@@ -875,6 +1364,47 @@ void WaitForAllTasks() {
 }
 
 
+void RunQueuedTask() {
+    // Let threads that wait for other threads do useful work meanwhile
+#ifdef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    sched_yield();
+#else
+    if (PbrtOptions.nCores == 1)
+        return;
+    runQueuedTask(threads ? currentWorker() : NULL);
+#endif
+}
+
+
+SerialTaskScope::SerialTaskScope() {
+    worker = NULL;
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    TaskWorker *w = threads ? currentWorker() : NULL;
+    if (w) ++w->serialDepth;
+    worker = w;
+#endif
+}
+
+
+SerialTaskScope::~SerialTaskScope() {
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    if (worker) --((TaskWorker *)worker)->serialDepth;
+#endif
+}
+
+
+int NumIdleWorkers() {
+    // Count workers that are asleep or waiting on subtasks with nothing
+    // else to run; tasks can use this to decide to split up their work
+#ifdef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    return 0;
+#else
+    if (PbrtOptions.nCores == 1) return 0;
+    return numSleepingWorkers + numWaitingWorkers;
+#endif
+}
+
+
 int NumSystemCores() {
     if (PbrtOptions.nCores > 0) return PbrtOptions.nCores;
 #if defined(PBRT_IS_WINDOWS)
@@ -910,3 +1440,98 @@ int NumSystemCores() {
 }
 
 
+int NumaNodeCount() {
+    initNumaTopology();
+    return max(1, int(numaNodes.size()));
+}
+
+
+void NumaInterleave(void *ptr, size_t size) {
+    if (!PbrtOptions.numa || !ptr)
+        return;
+#if defined(PBRT_IS_LINUX) && defined(SYS_mbind)
+    initNumaTopology();
+    if (numaNodes.size() < 2)
+        return;
+    // Interleave whole pages of the region across all nodes
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t start = ((size_t)ptr + pageSize - 1) & ~(pageSize - 1);
+    size_t end = ((size_t)ptr + size) & ~(pageSize - 1);
+    if (end <= start)
+        return;
+    unsigned long nodeMask = 0;
+    for (uint32_t i = 0; i < numaNodes.size(); ++i)
+        if (numaNodes[i].id < int(8 * sizeof(nodeMask)))
+            nodeMask |= 1ul << numaNodes[i].id;
+    const int mpolInterleave = 3;
+    const unsigned int mpolMoveFlag = 1 << 1;
+    if (syscall(SYS_mbind, start, end - start, mpolInterleave, &nodeMask,
+                8 * sizeof(nodeMask) + 1, mpolMoveFlag) != 0) {
+        static bool warned = false;
+        if (!warned) {
+            Warning("Error from mbind: %s", strerror(errno));
+            warned = true;
+        }
+    }
+#endif
+}
+
+
+void NumaResetRayCounts() {
+    mainThreadRays = 0;
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    for (int i = 0; workers && i < nWorkers; ++i)
+        workers[i].nRays = 0;
+#endif
+    if (!rayCountTimer)
+        rayCountTimer = new Timer;
+    rayCountTimer->Reset();
+    rayCountTimer->Start();
+}
+
+
+void NumaCountRays(int nRays) {
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    TaskWorker *worker = workers ? currentWorker() : NULL;
+    if (worker) {
+        worker->nRays += nRays;
+        return;
+    }
+#endif
+    mainThreadRays += nRays;
+}
+
+
+void NumaReportRayCounts() {
+    if (!PbrtOptions.numa || PbrtOptions.quiet || !rayCountTimer)
+        return;
+    double seconds = max(rayCountTimer->Time(), 1e-6);
+    // Sum ray counts over the workers on each node
+    int nNodes = NumaNodeCount();
+    vector<uint64_t> nodeRays(nNodes, 0);
+    vector<int> nodeThreads(nNodes, 0);
+    uint64_t otherRays = mainThreadRays;
+#ifndef PBRT_USE_GRAND_CENTRAL_DISPATCH
+    for (int i = 0; workers && i < nWorkers; ++i) {
+        if (workers[i].numaNode >= 0) {
+            nodeRays[workers[i].numaNode] += workers[i].nRays;
+            ++nodeThreads[workers[i].numaNode];
+        }
+        else
+            otherRays += workers[i].nRays;
+    }
+#endif
+    uint64_t totalRays = otherRays;
+    for (int i = 0; i < nNodes; ++i) {
+        totalRays += nodeRays[i];
+        if (nodeThreads[i] == 0) continue;
+        printf("NUMA node %d: %d thread(s), %.2f Mrays/s (%.2f Mrays/s per thread)\n",
+               i < int(numaNodes.size()) ? numaNodes[i].id : i, nodeThreads[i],
+               1e-6 * nodeRays[i] / seconds,
+               1e-6 * nodeRays[i] / seconds / nodeThreads[i]);
+    }
+    if (otherRays > 0)
+        printf("Unpinned threads: %.2f Mrays/s\n", 1e-6 * otherRays / seconds);
+    printf("Total: %.2f Mrays/s\n", 1e-6 * totalRays / seconds);
+    fflush(stdout);
+}
@@ -70,6 +70,17 @@
 		typedef volatile int64_t AtomicInt64;
 	#endif
 #endif // !PBRT_IS_WINDOWS
+inline void AtomicMemoryBarrier() {
+#if defined(PBRT_IS_WINDOWS)
+    MemoryBarrier();
+#elif defined(PBRT_IS_APPLE_PPC)
+    OSMemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+
 inline int32_t AtomicAdd(AtomicInt32 *v, int32_t delta) {
     PBRT_ATOMIC_MEMORY_OP();
 #if defined(PBRT_IS_WINDOWS)
@@ -330,6 +341,31 @@ private:
 };
 
 
+class Thread {
+public:
+    // Thread Public Methods
+    static Thread *Create(void (*func)(void *), void *arg);
+    static void Join(Thread *thread);
+private:
+    // Thread Private Methods
+    Thread() { }
+#if defined(PBRT_IS_WINDOWS)
+    static DWORD WINAPI entry(LPVOID arg);
+#else
+    static void *entry(void *arg);
+#endif
+
+    // Thread Private Data
+    void (*func)(void *);
+    void *arg;
+#if defined(PBRT_IS_WINDOWS)
+    HANDLE handle;
+#else
+    pthread_t thread;
+#endif
+};
+
+
 void TasksInit();
 void TasksCleanup();
 class Task {
@@ -339,8 +375,118 @@ public:
 };
 
 
+// Tasks may enqueue subtasks; a task's _Run()_ method doesn't complete
+// until all of the subtasks it enqueued have finished.
 void EnqueueTasks(const vector<Task *> &tasks);
 void WaitForAllTasks();
+void RunQueuedTask();
+int NumIdleWorkers();
 int NumSystemCores();
+int NumaNodeCount();
+void NumaInterleave(void *ptr, size_t size);
+void NumaResetRayCounts();
+void NumaCountRays(int nRays);
+void NumaReportRayCounts();
+
+// Tasks enqueued by a worker thread inside a _SerialTaskScope_ run
+// immediately, so it doesn't pick up unrelated queued work while it
+// waits for them.
+struct SerialTaskScope {
+    SerialTaskScope();
+    ~SerialTaskScope();
+private:
+    void *worker;
+    SerialTaskScope(const SerialTaskScope &);
+    SerialTaskScope &operator=(const SerialTaskScope &);
+};
+
+
+// ParallelFor Declarations
+template <typename Func> class ParallelForTask : public Task {
+public:
+    // ParallelForTask Public Methods
+    ParallelForTask(const Func &f, int s, int e)
+        : func(f), start(s), end(e) { }
+    void Run() {
+        for (int i = start; i < end; ++i)
+            func(i);
+    }
+private:
+    // ParallelForTask Private Data
+    const Func &func;
+    int start, end;
+};
+
+
+template <typename Func>
+void ParallelFor(int begin, int end, int chunkSize, const Func &func) {
+    Assert(chunkSize > 0);
+    if (end - begin <= chunkSize || PbrtOptions.nCores == 1) {
+        for (int i = begin; i < end; ++i)
+            func(i);
+        return;
+    }
+    // Run _func_ over chunks of _[begin,end)_ in parallel
+    vector<Task *> tasks;
+    tasks.reserve((end - begin + chunkSize - 1) / chunkSize);
+    for (int i = begin; i < end; i += chunkSize)
+        tasks.push_back(new ParallelForTask<Func>(func, i,
+                                                  min(i + chunkSize, end)));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+}
+
+
+template <typename T, typename Func, typename Combine>
+class ParallelReduceTask : public Task {
+public:
+    // ParallelReduceTask Public Methods
+    ParallelReduceTask(const T &identity, const Func &f, const Combine &c,
+                       int s, int e)
+        : result(identity), func(f), combine(c), start(s), end(e) { }
+    void Run() {
+        for (int i = start; i < end; ++i)
+            result = combine(result, func(i));
+    }
+
+    // ParallelReduceTask Public Data
+    T result;
+private:
+    // ParallelReduceTask Private Data
+    const Func &func;
+    const Combine &combine;
+    int start, end;
+};
+
+
+template <typename T, typename Func, typename Combine>
+T ParallelReduce(int begin, int end, int chunkSize, const T &identity,
+                 const Func &func, const Combine &combine) {
+    Assert(chunkSize > 0);
+    vector<ParallelReduceTask<T, Func, Combine> *> tasks;
+    for (int i = begin; i < end; i += chunkSize)
+        tasks.push_back(new ParallelReduceTask<T, Func, Combine>(identity,
+            func, combine, i, min(i + chunkSize, end)));
+    if (tasks.size() > 1 && PbrtOptions.nCores != 1) {
+        vector<Task *> runTasks(tasks.begin(), tasks.end());
+        EnqueueTasks(runTasks);
+        WaitForAllTasks();
+    }
+    else {
+        for (uint32_t i = 0; i < tasks.size(); ++i)
+            tasks[i]->Run();
+    }
+
+    // Combine per-chunk results in order
+    T result = identity;
+    for (uint32_t i = 0; i < tasks.size(); ++i) {
+        result = combine(result, tasks[i]->result);
+        delete tasks[i];
+    }
+    return result;
+}
+
 
 #endif // PBRT_CORE_PARALLEL_H
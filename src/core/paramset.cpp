@@ -397,11 +397,14 @@ string ParamSet::FindTexture(const string &name) const {
 
 
 void ParamSet::ReportUnused() const {
+    // Report each unused parameter once, even if its items are shared
 #define CHECK_UNUSED(v) \
     for (i = 0; i < (v).size(); ++i) \
-        if (!(v)[i]->lookedUp) \
+        if (!(v)[i]->lookedUp) { \
             Warning("Parameter \"%s\" not used", \
-                (v)[i]->name.c_str())
+                (v)[i]->name.c_str()); \
+            (v)[i]->lookedUp = true; \
+        }
     uint32_t i;
     CHECK_UNUSED(ints);    CHECK_UNUSED(bools);
     CHECK_UNUSED(floats);  CHECK_UNUSED(points);
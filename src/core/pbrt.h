@@ -106,6 +106,11 @@ typedef unsigned __int64 uint64_t;
 
 // Global Macros
 #define ALLOCA(TYPE, COUNT) (TYPE *)alloca((COUNT) * sizeof(TYPE))
+#if defined(PBRT_IS_WINDOWS)
+#define PBRT_THREAD_LOCAL __declspec(thread)
+#elif defined(PBRT_IS_LINUX)
+#define PBRT_THREAD_LOCAL __thread
+#endif
 
 // Global Forward Declarations
 class RNG;
@@ -122,8 +127,22 @@ template <typename T> struct ParamSetItem;
 struct Options {
     Options() { nCores = 0;
                 quickRender = quiet = openWindow = verbose = false;
-                imageFile = ""; }
+                pinThreads = numa = false;
+                printStats = false;
+                timeLimit = 0.f;
+                checkpointInterval = 600.f;
+                resume = false;
+                nFrames = 1;
+                imageFile = statsFile = checkpointFile = ""; }
     int nCores;
+    bool pinThreads, numa;
+    bool printStats;
+    string statsFile;
+    float timeLimit;
+    string checkpointFile;
+    float checkpointInterval;
+    bool resume;
+    int nFrames;
     bool quickRender;
     bool quiet, verbose;
     bool openWindow;
@@ -209,6 +228,11 @@ class VolumeIntegrator;
 #define PBRT_HAS_64_BIT_ATOMICS
 #endif
 #endif // PBRT_HAS_64_BIT_ATOMICS
+#ifndef PBRT_HAS_SSE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PBRT_HAS_SSE
+#endif
+#endif // PBRT_HAS_SSE
 
 // Global Inline Functions
 inline float Lerp(float t, float v1, float v2) {
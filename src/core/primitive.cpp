@@ -35,9 +35,11 @@
 #include "primitive.h"
 #include "light.h"
 #include "intersection.h"
+#include "parallel.h"
+#include "shapes/trianglemesh.h"
 
 // Primitive Method Definitions
-uint32_t Primitive::nextprimitiveId = 1;
+AtomicInt32 Primitive::nextprimitiveId = 0;
 Primitive::~Primitive() { }
 
 bool Primitive::CanIntersect() const {
@@ -45,6 +47,30 @@ bool Primitive::CanIntersect() const {
 }
 
 
+BBox Primitive::ClippedWorldBound(const BBox &clip) const {
+    return ::Intersect(WorldBound(), clip);
+}
+
+
+bool Primitive::GetTriangleVertices(Point p[3]) const {
+    return false;
+}
+
+
+void Primitive::IntersectPacket(const Ray *const *rays, int nRays,
+                                Intersection *isects, bool *hits) const {
+    for (int i = 0; i < nRays; ++i)
+        hits[i] = Intersect(*rays[i], &isects[i]);
+}
+
+
+void Primitive::IntersectPPacket(const Ray *const *rays, int nRays,
+                                 bool *hits) const {
+    for (int i = 0; i < nRays; ++i)
+        hits[i] = IntersectP(*rays[i]);
+}
+
+
 
 void Primitive::Refine(vector<Reference<Primitive> > &refined) const {
     Severe("Unimplemented Primitive::Refine() method called!");
@@ -67,6 +93,15 @@ Primitive::FullyRefine(vector<Reference<Primitive> > &refined) const {
 }
 
 
+void Primitive::Refit(float time0, float time1) {
+}
+
+
+const Material *Primitive::GetMaterial() const {
+    return NULL;
+}
+
+
 const AreaLight *Aggregate::GetAreaLight() const {
     Severe("Aggregate::GetAreaLight() method"
          "called; should have gone to GeometricPrimitive");
@@ -99,6 +134,7 @@ bool TransformedPrimitive::Intersect(const Ray &r,
     Ray ray = w2p(r);
     if (!primitive->Intersect(ray, isect))
         return false;
+    isect->Finalize(ray);
     r.maxt = ray.maxt;
     isect->primitiveId = primitiveId;
     if (!w2p.IsIdentity()) {
@@ -124,6 +160,14 @@ bool TransformedPrimitive::IntersectP(const Ray &r) const {
 }
 
 
+void TransformedPrimitive::Refit(float time0, float time1) {
+    // Bound instance's motion between _time0_ and _time1_ only
+    primitive->Refit(time0, time1);
+    boundTime0 = time0;
+    boundTime1 = time1;
+}
+
+
 
 // GeometricPrimitive Method Definitions
 BBox GeometricPrimitive::WorldBound() const {
@@ -131,6 +175,16 @@ BBox GeometricPrimitive::WorldBound() const {
 }
 
 
+BBox GeometricPrimitive::ClippedWorldBound(const BBox &clip) const {
+    return shape->ClippedWorldBound(clip);
+}
+
+
+bool GeometricPrimitive::GetTriangleVertices(Point p[3]) const {
+    return shape->GetTriangleVertices(p);
+}
+
+
 bool GeometricPrimitive::IntersectP(const Ray &r) const {
     return shape->IntersectP(r);
 }
@@ -141,32 +195,88 @@ bool GeometricPrimitive::CanIntersect() const {
 }
 
 
+struct RefineGeometricPrimitive {
+    void operator()(int i) const {
+        (*refined)[offset + i] = new GeometricPrimitive((*shapes)[i],
+            *material, areaLight);
+    }
+    const vector<Reference<Shape> > *shapes;
+    const Reference<Material> *material;
+    AreaLight *areaLight;
+    vector<Reference<Primitive> > *refined;
+    int offset;
+};
+
+
+struct RefineMeshFaces {
+    void operator()(int i) const {
+        (*refined)[offset + i] = new MeshFacePrimitive(*meshPrimitive,
+                                                       mesh, i);
+    }
+    const Reference<Primitive> *meshPrimitive;
+    const TriangleMesh *mesh;
+    vector<Reference<Primitive> > *refined;
+    int offset;
+};
+
+
 void GeometricPrimitive::
         Refine(vector<Reference<Primitive> > &refined)
         const {
+    // Refine triangle meshes to face primitives, not one shape per face
+    const TriangleMesh *mesh =
+        dynamic_cast<const TriangleMesh *>(shape.GetPtr());
+    if (mesh) {
+        Reference<Primitive> meshPrimitive =
+            const_cast<GeometricPrimitive *>(this);
+        RefineMeshFaces refineFaces;
+        refineFaces.meshPrimitive = &meshPrimitive;
+        refineFaces.mesh = mesh;
+        refineFaces.refined = &refined;
+        refineFaces.offset = refined.size();
+        refined.resize(refined.size() + mesh->NumFaces());
+        ParallelFor(0, mesh->NumFaces(), 4096, refineFaces);
+        return;
+    }
     vector<Reference<Shape> > r;
     shape->Refine(r);
-    for (uint32_t i = 0; i < r.size(); ++i) {
-        GeometricPrimitive *gp = new GeometricPrimitive(r[i],
-               material, areaLight);
-        refined.push_back(gp);
-    }
+    RefineGeometricPrimitive refinePrim;
+    refinePrim.shapes = &r;
+    refinePrim.material = &material;
+    refinePrim.areaLight = areaLight;
+    refinePrim.refined = &refined;
+    refinePrim.offset = refined.size();
+    refined.resize(refined.size() + r.size());
+    ParallelFor(0, r.size(), 4096, refinePrim);
 }
 
 GeometricPrimitive::GeometricPrimitive(const Reference<Shape> &s,
         const Reference<Material> &m, AreaLight *a)
     : shape(s), material(m), areaLight(a) {
+    deferIntersection = shape->DefersIntersection();
 }
 
 
 bool GeometricPrimitive::Intersect(const Ray &r,
                                    Intersection *isect) const {
     float thit, rayEpsilon;
-    if (!shape->Intersect(r, &thit, &rayEpsilon, &isect->dg))
-        return false;
+    if (deferIntersection) {
+        // Record hit, leaving geometry for _Intersection::Finalize()_
+        if (!shape->IntersectDeferred(r, &thit, &rayEpsilon,
+                                      isect->deferredParams))
+            return false;
+        isect->deferredShape = shape.GetPtr();
+        isect->deferredFace = 0;
+        isect->deferredT = thit;
+    }
+    else {
+        if (!shape->Intersect(r, &thit, &rayEpsilon, &isect->dg))
+            return false;
+        isect->deferredShape = NULL;
+        isect->WorldToObject = *shape->WorldToObject;
+        isect->ObjectToWorld = *shape->ObjectToWorld;
+    }
     isect->primitive = this;
-    isect->WorldToObject = *shape->WorldToObject;
-    isect->ObjectToWorld = *shape->ObjectToWorld;
     isect->shapeId = shape->shapeId;
     isect->primitiveId = primitiveId;
     isect->rayEpsilon = rayEpsilon;
@@ -180,6 +290,11 @@ const AreaLight *GeometricPrimitive::GetAreaLight() const {
 }
 
 
+const Material *GeometricPrimitive::GetMaterial() const {
+    return material.GetPtr();
+}
+
+
 BSDF *GeometricPrimitive::GetBSDF(const DifferentialGeometry &dg,
                                   const Transform &ObjectToWorld,
                                   MemoryArena &arena) const {
@@ -197,6 +312,78 @@ BSSRDF *GeometricPrimitive::GetBSSRDF(const DifferentialGeometry &dg,
     return material->GetBSSRDF(dg, dgs, arena);
 }
 
+
+// MeshFacePrimitive Method Definitions
+BBox MeshFacePrimitive::WorldBound() const {
+    return mesh->FaceWorldBound(face);
+}
+
+
+BBox MeshFacePrimitive::ClippedWorldBound(const BBox &clip) const {
+    return mesh->FaceClippedWorldBound(face, clip);
+}
+
+
+bool MeshFacePrimitive::GetTriangleVertices(Point p[3]) const {
+    mesh->GetFaceVertices(face, p);
+    return true;
+}
+
+
+bool MeshFacePrimitive::Intersect(const Ray &r, Intersection *isect) const {
+    float thit, params[2];
+    if (!mesh->IntersectFace(face, r, &thit, params))
+        return false;
+    RecordHit(r, thit, params, isect);
+    return true;
+}
+
+
+void MeshFacePrimitive::RecordHit(const Ray &r, float thit,
+        const float params[2], Intersection *isect) const {
+    // Record hit, leaving geometry for _Intersection::Finalize()_
+    isect->deferredShape = mesh;
+    isect->deferredFace = face;
+    isect->deferredT = thit;
+    isect->deferredParams[0] = params[0];
+    isect->deferredParams[1] = params[1];
+    isect->primitive = this;
+    isect->shapeId = mesh->shapeId;
+    isect->primitiveId = primitiveId;
+    isect->rayEpsilon = 1e-3f * thit;
+    r.maxt = thit;
+}
+
+
+bool MeshFacePrimitive::IntersectP(const Ray &r) const {
+    return mesh->IntersectFaceP(face, r);
+}
+
+
+const AreaLight *MeshFacePrimitive::GetAreaLight() const {
+    return meshPrimitive->GetAreaLight();
+}
+
+
+const Material *MeshFacePrimitive::GetMaterial() const {
+    return meshPrimitive->GetMaterial();
+}
+
+
+BSDF *MeshFacePrimitive::GetBSDF(const DifferentialGeometry &dg,
+                                 const Transform &ObjectToWorld,
+                                 MemoryArena &arena) const {
+    return meshPrimitive->GetBSDF(dg, ObjectToWorld, arena);
+}
+
+
+BSSRDF *MeshFacePrimitive::GetBSSRDF(const DifferentialGeometry &dg,
+                                     const Transform &ObjectToWorld,
+                                     MemoryArena &arena) const {
+    return meshPrimitive->GetBSSRDF(dg, ObjectToWorld, arena);
+}
+
+
 uint32_t GeometricPrimitive::toRawData(Metadata* meta, void* data) const {
 	uint32_t c = shape->toRawData(meta, data);
 	meta->mat = material->Type();
@@ -40,20 +40,29 @@
 #include "pbrt.h"
 #include "shape.h"
 #include "material.h"
+class TriangleMesh;
 
 // Primitive Declarations
 class Primitive : public ReferenceCounted {
 public:
     // Primitive Interface
-    Primitive() : primitiveId(nextprimitiveId++) { }
+    Primitive() : primitiveId(AtomicAdd(&nextprimitiveId, 1)) { }
     virtual ~Primitive();
     virtual BBox WorldBound() const = 0;
+    virtual BBox ClippedWorldBound(const BBox &clip) const;
+    virtual bool GetTriangleVertices(Point p[3]) const;
     virtual bool CanIntersect() const;
     virtual bool Intersect(const Ray &r, Intersection *in) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    virtual void IntersectPacket(const Ray *const *rays, int nRays,
+        Intersection *isects, bool *hits) const;
+    virtual void IntersectPPacket(const Ray *const *rays, int nRays,
+        bool *hits) const;
     virtual void Refine(vector<Reference<Primitive> > &refined) const;
     void FullyRefine(vector<Reference<Primitive> > &refined) const;
+    virtual void Refit(float time0, float time1);
     virtual const AreaLight *GetAreaLight() const = 0;
+    virtual const Material *GetMaterial() const;
     virtual BSDF *GetBSDF(const DifferentialGeometry &dg,
         const Transform &ObjectToWorld, MemoryArena &arena) const = 0;
     virtual BSSRDF *GetBSSRDF(const DifferentialGeometry &dg,
@@ -63,7 +72,7 @@ public:
     const uint32_t primitiveId;
 protected:
     // Primitive Protected Data
-    static uint32_t nextprimitiveId;
+    static AtomicInt32 nextprimitiveId;
 };
 
 
@@ -75,11 +84,14 @@ public:
     bool CanIntersect() const;
     void Refine(vector<Reference<Primitive> > &refined) const;
     virtual BBox WorldBound() const;
+    virtual BBox ClippedWorldBound(const BBox &clip) const;
+    virtual bool GetTriangleVertices(Point p[3]) const;
     virtual bool Intersect(const Ray &r, Intersection *isect) const;
     virtual bool IntersectP(const Ray &r) const;
     GeometricPrimitive(const Reference<Shape> &s,
                        const Reference<Material> &m, AreaLight *a);
     const AreaLight *GetAreaLight() const;
+    const Material *GetMaterial() const;
     BSDF *GetBSDF(const DifferentialGeometry &dg,
                   const Transform &ObjectToWorld, MemoryArena &arena) const;
     BSSRDF *GetBSSRDF(const DifferentialGeometry &dg,
@@ -89,21 +101,54 @@ public:
 private:
     // GeometricPrimitive Private Data
     Reference<Shape> shape;
+    bool deferIntersection;
     Reference<Material> material;
     AreaLight *areaLight;
 };
 
 
 
+// MeshFacePrimitive Declarations
+class MeshFacePrimitive : public Primitive {
+public:
+    // MeshFacePrimitive Public Methods
+    MeshFacePrimitive(const Reference<Primitive> &mp, const TriangleMesh *m,
+                      uint32_t f)
+        : meshPrimitive(mp), mesh(m), face(f) { }
+    BBox WorldBound() const;
+    BBox ClippedWorldBound(const BBox &clip) const;
+    bool GetTriangleVertices(Point p[3]) const;
+    bool Intersect(const Ray &r, Intersection *isect) const;
+    bool IntersectP(const Ray &r) const;
+    void RecordHit(const Ray &r, float thit, const float params[2],
+                   Intersection *isect) const;
+    const TriangleMesh *GetMesh() const { return mesh; }
+    const AreaLight *GetAreaLight() const;
+    const Material *GetMaterial() const;
+    BSDF *GetBSDF(const DifferentialGeometry &dg,
+                  const Transform &ObjectToWorld, MemoryArena &arena) const;
+    BSSRDF *GetBSSRDF(const DifferentialGeometry &dg,
+                      const Transform &ObjectToWorld, MemoryArena &arena) const;
+private:
+    // MeshFacePrimitive Private Data
+    Reference<Primitive> meshPrimitive;
+    const TriangleMesh *mesh;
+    uint32_t face;
+};
+
+
+
 // TransformedPrimitive Declarations
 class TransformedPrimitive : public Primitive {
 public:
     // TransformedPrimitive Public Methods
     TransformedPrimitive(Reference<Primitive> &prim,
                          const AnimatedTransform &w2p)
-        : primitive(prim), WorldToPrimitive(w2p) { }
+        : primitive(prim), WorldToPrimitive(w2p), boundTime0(-INFINITY),
+          boundTime1(INFINITY) { }
     bool Intersect(const Ray &r, Intersection *in) const;
     bool IntersectP(const Ray &r) const;
+    void Refit(float time0, float time1);
     const AreaLight *GetAreaLight() const { return NULL; }
     BSDF *GetBSDF(const DifferentialGeometry &dg,
                   const Transform &ObjectToWorld, MemoryArena &arena) const {
@@ -114,12 +159,14 @@ public:
         return NULL;
     }
     BBox WorldBound() const {
-        return WorldToPrimitive.MotionBounds(primitive->WorldBound(), true);
+        return WorldToPrimitive.MotionBounds(primitive->WorldBound(),
+                                             boundTime0, boundTime1, true);
     }
 private:
     // TransformedPrimitive Private Data
     Reference<Primitive> primitive;
     const AnimatedTransform WorldToPrimitive;
+    float boundTime0, boundTime1;
 };
 
 
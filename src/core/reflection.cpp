@@ -36,6 +36,7 @@
 #include "spectrum.h"
 #include "sampler.h"
 #include "montecarlo.h"
+#include "stats.h"
 #include <stdarg.h>
 
 // BxDF Local Definitions
@@ -498,6 +499,10 @@ Spectrum BxDF::rho(int nSamples, const float *samples1,
 
 
 
+// BSDF Statistics
+STAT_COUNTER("Shading/BSDF samples", nBSDFSamples);
+STAT_COUNTER("Shading/BSDF evaluations", nBSDFEvaluations);
+
 // BSDF Method Definitions
 BSDFSampleOffsets::BSDFSampleOffsets(int count, Sample *sample) {
     nSamples = count;
@@ -523,6 +528,7 @@ Spectrum BSDF::Sample_f(const Vector &woW, Vector *wiW,
                         const BSDFSample &bsdfSample, float *pdf,
                         BxDFType flags, BxDFType *sampledType) const {
     PBRT_STARTED_BSDF_SAMPLE();
+    STAT_INC(nBSDFSamples);
     // Choose which _BxDF_ to sample
     int matchingComps = NumComponents(flags);
     if (matchingComps == 0) {
@@ -612,6 +618,7 @@ BSDF::BSDF(const DifferentialGeometry &dg, const Normal &ngeom,
 Spectrum BSDF::f(const Vector &woW, const Vector &wiW,
                  BxDFType flags) const {
     PBRT_STARTED_BSDF_EVAL();
+    STAT_INC(nBSDFEvaluations);
     Vector wi = WorldToLocal(wiW), wo = WorldToLocal(woW);
     if (Dot(wiW, ng) * Dot(woW, ng) > 0) // ignore BTDFs
         flags = BxDFType(flags & ~BSDF_TRANSMISSION);
@@ -33,9 +33,34 @@
 // core/renderer.cpp*
 #include "stdafx.h"
 #include "renderer.h"
+#include "spectrum.h"
+#include "sampler.h"
+#include "intersection.h"
+
+// Renderer Statistics
+STAT_COUNTER("Rays/Camera rays", nCameraRays);
+STAT_TIMER("Time/Integrator preprocessing", integratorPreprocessTime);
+STAT_TIMER("Time/Rendering", renderingTime);
+STAT_TIMER("Time/Image output", imageOutputTime);
 
 // Renderer Method Definitions
 Renderer::~Renderer() {
 }
 
 
+void Renderer::LiPacket(const Scene *scene, const RayDifferential *rays,
+        const float *rayWeights, const Sample *samples, int nRays, RNG &rng,
+        MemoryArena &arena, Spectrum *Ls, Intersection *isects,
+        Spectrum *Ts) const {
+    for (int i = 0; i < nRays; ++i) {
+        if (rayWeights[i] > 0.f)
+            Ls[i] = rayWeights[i] * Li(scene, rays[i], &samples[i], rng,
+                                       arena, &isects[i], &Ts[i]);
+        else {
+            Ls[i] = 0.f;
+            Ts[i] = 1.f;
+        }
+    }
+}
+
+
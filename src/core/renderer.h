@@ -38,6 +38,7 @@
 
 // core/renderer.h*
 #include "pbrt.h"
+#include "stats.h"
 
 // Renderer Declarations
 class Renderer {
@@ -48,11 +49,19 @@ public:
     virtual Spectrum Li(const Scene *scene, const RayDifferential &ray,
         const Sample *sample, RNG &rng, MemoryArena &arena,
         Intersection *isect = NULL, Spectrum *T = NULL) const = 0;
+    virtual void LiPacket(const Scene *scene, const RayDifferential *rays,
+        const float *rayWeights, const Sample *samples, int nRays, RNG &rng,
+        MemoryArena &arena, Spectrum *Ls, Intersection *isects,
+        Spectrum *Ts) const;
     virtual Spectrum Transmittance(const Scene *scene,
         const RayDifferential &ray, const Sample *sample,
         RNG &rng, MemoryArena &arena) const = 0;
 };
 
 
+STAT_EXTERN(nCameraRays);
+STAT_EXTERN(integratorPreprocessTime);
+STAT_EXTERN(renderingTime);
+STAT_EXTERN(imageOutputTime);
 
 #endif // PBRT_CORE_RENDERER_H
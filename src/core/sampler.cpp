@@ -52,16 +52,23 @@ bool Sampler::ReportResults(Sample *samples, const RayDifferential *rays,
 }
 
 
-void Sampler::ComputeSubWindow(int num, int count, int *newXStart,
-        int *newXEnd, int *newYStart, int *newYEnd) const {
+void Sampler::SubWindowGrid(int count, int *nx, int *ny) const {
     // Determine how many tiles to use in each dimension, _nx_ and _ny_
     int dx = xPixelEnd - xPixelStart, dy = yPixelEnd - yPixelStart;
-    int nx = count, ny = 1;
-    while ((nx & 0x1) == 0 && 2 * dx * ny < dy * nx) {
-        nx >>= 1;
-        ny <<= 1;
+    *nx = count;
+    *ny = 1;
+    while ((*nx & 0x1) == 0 && 2 * dx * *ny < dy * *nx) {
+        *nx >>= 1;
+        *ny <<= 1;
     }
-    Assert(nx * ny == count);
+    Assert(*nx * *ny == count);
+}
+
+
+void Sampler::ComputeSubWindow(int num, int count, int *newXStart,
+        int *newXEnd, int *newYStart, int *newYEnd) const {
+    int nx, ny;
+    SubWindowGrid(count, &nx, &ny);
 
     // Compute $x$ and $y$ pixel sample range for sub-window
     int xo = num % nx, yo = num / nx;
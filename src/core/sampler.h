@@ -53,8 +53,10 @@ public:
     virtual int MaximumSampleCount() = 0;
     virtual bool ReportResults(Sample *samples, const RayDifferential *rays,
         const Spectrum *Ls, const Intersection *isects, int count);
+    virtual bool AdaptsToResults() const { return false; }
     virtual Sampler *GetSubSampler(int num, int count) = 0;
     virtual int RoundSize(int size) const = 0;
+    void SubWindowGrid(int count, int *nx, int *ny) const;
 
     // Sampler Public Data
     const int xPixelStart, xPixelEnd, yPixelStart, yPixelEnd;
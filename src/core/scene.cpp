@@ -41,6 +41,10 @@
 #include "progressreporter.h"
 #include "renderer.h"
 
+// Scene Statistics
+STAT_COUNTER("Rays/Intersection rays", nIntersectionRays);
+STAT_COUNTER("Rays/Shadow rays", nShadowRays);
+
 // Scene Method Definitions
 Scene::~Scene() {
     delete aggregate;
@@ -66,3 +70,11 @@ const BBox &Scene::WorldBound() const {
 }
 
 
+void Scene::Refit(float time0, float time1) {
+    // Update aggregate and scene bounds for rays between _time0_ and _time1_
+    aggregate->Refit(time0, time1);
+    bound = aggregate->WorldBound();
+    if (volumeRegion) bound = Union(bound, volumeRegion->WorldBound());
+}
+
+
@@ -39,9 +39,13 @@
 // core/scene.h*
 #include "pbrt.h"
 #include "primitive.h"
+#include "intersection.h"
 #include "integrator.h"
+#include "stats.h"
 
 // Scene Declarations
+STAT_EXTERN(nIntersectionRays);
+STAT_EXTERN(nShadowRays);
 class Scene {
 public:
     // Scene Public Methods
@@ -50,16 +54,36 @@ public:
     bool Intersect(const Ray &ray, Intersection *isect) const {
         PBRT_STARTED_RAY_INTERSECTION(const_cast<Ray *>(&ray));
         bool hit = aggregate->Intersect(ray, isect);
+        if (hit) isect->Finalize(ray);
+        STAT_INC(nIntersectionRays);
+        if (PbrtOptions.numa) NumaCountRays(1);
         PBRT_FINISHED_RAY_INTERSECTION(const_cast<Ray *>(&ray), isect, int(hit));
         return hit;
     }
     bool IntersectP(const Ray &ray) const {
         PBRT_STARTED_RAY_INTERSECTIONP(const_cast<Ray *>(&ray));
         bool hit = aggregate->IntersectP(ray);
+        STAT_INC(nShadowRays);
+        if (PbrtOptions.numa) NumaCountRays(1);
         PBRT_FINISHED_RAY_INTERSECTIONP(const_cast<Ray *>(&ray), int(hit));
         return hit;
     }
+    void IntersectPacket(const Ray *const *rays, int nRays,
+                         Intersection *isects, bool *hits) const {
+        aggregate->IntersectPacket(rays, nRays, isects, hits);
+        for (int i = 0; i < nRays; ++i)
+            if (hits[i]) isects[i].Finalize(*rays[i]);
+        STAT_ADD(nIntersectionRays, nRays);
+        if (PbrtOptions.numa) NumaCountRays(nRays);
+    }
+    void IntersectPPacket(const Ray *const *rays, int nRays,
+                          bool *hits) const {
+        aggregate->IntersectPPacket(rays, nRays, hits);
+        STAT_ADD(nShadowRays, nRays);
+        if (PbrtOptions.numa) NumaCountRays(nRays);
+    }
     const BBox &WorldBound() const;
+    void Refit(float time0, float time1);
 
     // Scene Public Data
     Primitive *aggregate;
@@ -42,18 +42,28 @@ Shape::~Shape() {
 Shape::Shape(const Transform *o2w, const Transform *w2o, bool ro)
     : ObjectToWorld(o2w), WorldToObject(w2o), ReverseOrientation(ro),
       TransformSwapsHandedness(o2w->SwapsHandedness()),
-      shapeId(nextshapeId++) {
+      shapeId(AtomicAdd(&nextshapeId, 1)) {
     // Update shape creation statistics
     PBRT_CREATED_SHAPE(this);
 }
 
 
-uint32_t Shape::nextshapeId = 1;
+AtomicInt32 Shape::nextshapeId = 0;
 BBox Shape::WorldBound() const {
     return (*ObjectToWorld)(ObjectBound());
 }
 
 
+BBox Shape::ClippedWorldBound(const BBox &clip) const {
+    return ::Intersect(WorldBound(), clip);
+}
+
+
+bool Shape::GetTriangleVertices(Point p[3]) const {
+    return false;
+}
+
+
 bool Shape::CanIntersect() const {
     return true;
 }
@@ -77,6 +87,19 @@ bool Shape::IntersectP(const Ray &ray) const {
 }
 
 
+bool Shape::IntersectDeferred(const Ray &ray, float *tHit, float *rayEpsilon,
+                              float params[2]) const {
+    Severe("Unimplemented Shape::IntersectDeferred() method called");
+    return false;
+}
+
+
+void Shape::GetDifferentialGeometry(const Ray &ray, float tHit,
+        uint32_t face, const float params[2], DifferentialGeometry *dg) const {
+    Severe("Unimplemented Shape::GetDifferentialGeometry() method called");
+}
+
+
 float Shape::Area() const {
     Severe("Unimplemented Shape::Area() method called");
     return 0.;
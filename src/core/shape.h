@@ -53,11 +53,18 @@ public:
     virtual ~Shape();
     virtual BBox ObjectBound() const = 0;
     virtual BBox WorldBound() const;
+    virtual BBox ClippedWorldBound(const BBox &clip) const;
+    virtual bool GetTriangleVertices(Point p[3]) const;
     virtual bool CanIntersect() const;
     virtual void Refine(vector<Reference<Shape> > &refined) const;
     virtual bool Intersect(const Ray &ray, float *tHit,
                            float *rayEpsilon, DifferentialGeometry *dg) const;
     virtual bool IntersectP(const Ray &ray) const;
+    virtual bool DefersIntersection() const { return false; }
+    virtual bool IntersectDeferred(const Ray &ray, float *tHit,
+                                   float *rayEpsilon, float params[2]) const;
+    virtual void GetDifferentialGeometry(const Ray &ray, float tHit,
+        uint32_t face, const float params[2], DifferentialGeometry *dg) const;
     virtual void GetShadingGeometry(const Transform &obj2world,
             const DifferentialGeometry &dg,
             DifferentialGeometry *dgShading) const {
@@ -84,7 +91,7 @@ public:
     const Transform *ObjectToWorld, *WorldToObject;
     const bool ReverseOrientation, TransformSwapsHandedness;
     const uint32_t shapeId;
-    static uint32_t nextshapeId;
+    static AtomicInt32 nextshapeId;
 };
 
 
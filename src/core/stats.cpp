@@ -0,0 +1,303 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/stats.cpp*
+#include "stdafx.h"
+#include "stats.h"
+#include <map>
+using std::map;
+#ifdef PBRT_HAS_STATS
+#include "parallel.h"
+#ifndef PBRT_THREAD_LOCAL
+#include <pthread.h>
+#endif
+
+// Statistics Local Declarations
+static const int maxStatSlots = 512;
+
+// Nothing here may need dynamic initialization: statistics can be
+// updated by the constructors of other files' globals
+static AtomicInt32 statsLock = 0;
+struct StatsLock {
+    StatsLock() {
+        while (AtomicCompareAndSwap(&statsLock, 1, 0) != 0)
+            ;
+    }
+    ~StatsLock() {
+        AtomicMemoryBarrier();
+        statsLock = 0;
+    }
+};
+
+
+static vector<StatInfo *> *registeredStats = NULL;
+static int nStatSlots = 0;
+
+// Every thread's values are kept for the life of the program; threads
+// may exit before the report is generated
+static vector<int64_t *> *threadValues = NULL;
+#ifdef PBRT_THREAD_LOCAL
+PBRT_THREAD_LOCAL int64_t *statsThreadValues = NULL;
+#else
+static pthread_key_t statsKey;
+static bool statsKeyCreated = false;
+#endif // PBRT_THREAD_LOCAL
+static int statSlotCount(StatType type) {
+    switch (type) {
+        case STAT_TYPE_DISTRIBUTION: return 4;
+        case STAT_TYPE_PERCENT:      return 2;
+        default:                     return 1;
+    }
+}
+
+
+
+// Statistics Method Definitions
+void StatRegister(StatInfo &stat) {
+    StatsLock lock;
+    if (stat.slot >= 0) return;
+    if (nStatSlots + statSlotCount(stat.type) > maxStatSlots)
+        Severe("Too many statistics registered; increase maxStatSlots "
+               "in core/stats.cpp.");
+    if (!registeredStats) registeredStats = new vector<StatInfo *>;
+    registeredStats->push_back(&stat);
+    int slot = nStatSlots;
+    nStatSlots += statSlotCount(stat.type);
+    AtomicMemoryBarrier();
+    stat.slot = slot;
+}
+
+
+int64_t *StatsAllocThreadValues() {
+    int64_t *values = new int64_t[maxStatSlots];
+    memset(values, 0, maxStatSlots * sizeof(int64_t));
+    StatsLock lock;
+    if (!threadValues) threadValues = new vector<int64_t *>;
+    threadValues->push_back(values);
+#ifdef PBRT_THREAD_LOCAL
+    statsThreadValues = values;
+#else
+    if (!statsKeyCreated) {
+        if (pthread_key_create(&statsKey, NULL) != 0)
+            Severe("Error from pthread_key_create: %s", strerror(errno));
+        statsKeyCreated = true;
+    }
+    pthread_setspecific(statsKey, values);
+#endif
+    return values;
+}
+
+
+#ifndef PBRT_THREAD_LOCAL
+int64_t *StatsThreadValues() {
+    int64_t *v = statsKeyCreated ?
+        (int64_t *)pthread_getspecific(statsKey) : NULL;
+    return v ? v : StatsAllocThreadValues();
+}
+
+
+#endif // !PBRT_THREAD_LOCAL
+static void mergeStats(vector<const StatInfo *> &stats,
+                       vector<int64_t> &merged) {
+    StatsLock lock;
+    if (registeredStats)
+        stats.assign(registeredStats->begin(), registeredStats->end());
+    merged.assign(nStatSlots, 0);
+    for (uint32_t i = 0; i < stats.size(); ++i) {
+        const StatInfo *stat = stats[i];
+        int64_t *m = &merged[stat->slot];
+        for (uint32_t t = 0; threadValues && t < threadValues->size(); ++t) {
+            const int64_t *v = (*threadValues)[t] + stat->slot;
+            if (stat->type == STAT_TYPE_DISTRIBUTION) {
+                if (v[0] == 0) continue;
+                if (m[0] == 0 || v[2] < m[2]) m[2] = v[2];
+                if (m[0] == 0 || v[3] > m[3]) m[3] = v[3];
+                m[0] += v[0];
+                m[1] += v[1];
+            }
+            else
+                for (int j = 0; j < statSlotCount(stat->type); ++j)
+                    m[j] += v[j];
+        }
+    }
+}
+
+
+// Statistics sorted by category, then by description
+typedef map<string, map<string, const StatInfo *> > StatCategoryMap;
+static void sortStats(StatCategoryMap &sorted, vector<int64_t> &merged) {
+    vector<const StatInfo *> stats;
+    mergeStats(stats, merged);
+    for (uint32_t i = 0; i < stats.size(); ++i) {
+        const StatInfo *stat = stats[i];
+        // Skip statistics that weren't updated since the last reset
+        bool used = false;
+        for (int j = 0; j < statSlotCount(stat->type); ++j)
+            if (merged[stat->slot + j] != 0) used = true;
+        if (!used) continue;
+        string title(stat->title);
+        size_t slash = title.find('/');
+        if (slash == string::npos)
+            sorted[""][title] = stat;
+        else
+            sorted[title.substr(0, slash)][title.substr(slash + 1)] = stat;
+    }
+}
+
+
+static void writeJSONString(FILE *f, const string &s) {
+    putc('"', f);
+    for (uint32_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"' || s[i] == '\\') putc('\\', f);
+        putc(s[i], f);
+    }
+    putc('"', f);
+}
+
+
+
+// Statistics Function Definitions
+void StatsReport(FILE *dest) {
+    vector<int64_t> merged;
+    StatCategoryMap sorted;
+    sortStats(sorted, merged);
+    fprintf(dest, "Statistics:\n");
+    for (StatCategoryMap::iterator c = sorted.begin(); c != sorted.end(); ++c) {
+        fprintf(dest, "  %s\n", c->first.c_str());
+        for (map<string, const StatInfo *>::iterator s = c->second.begin();
+             s != c->second.end(); ++s) {
+            // Print statistic padded out to the results column
+            fprintf(dest, "    %-42s", s->first.c_str());
+            const int64_t *v = &merged[s->second->slot];
+            switch (s->second->type) {
+            case STAT_TYPE_COUNTER:
+                fprintf(dest, "%15lld\n", (long long)v[0]);
+                break;
+            case STAT_TYPE_MEMORY:
+                fprintf(dest, "%11.2f MiB\n", v[0] / (1024. * 1024.));
+                break;
+            case STAT_TYPE_DISTRIBUTION:
+                fprintf(dest, "%15.3f avg [range %lld - %lld]\n",
+                        double(v[1]) / double(v[0]), (long long)v[2],
+                        (long long)v[3]);
+                break;
+            case STAT_TYPE_PERCENT:
+                fprintf(dest, "%15lld / %lld (%.2f%%)\n", (long long)v[0],
+                        (long long)v[1],
+                        v[1] ? 100. * double(v[0]) / double(v[1]) : 0.);
+                break;
+            case STAT_TYPE_TIMER:
+                fprintf(dest, "%13.3f s\n", v[0] * 1e-6);
+                break;
+            }
+        }
+    }
+}
+
+
+bool StatsWriteJSON(const string &filename) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        Error("Unable to open statistics file \"%s\"", filename.c_str());
+        return false;
+    }
+    vector<int64_t> merged;
+    StatCategoryMap sorted;
+    sortStats(sorted, merged);
+    fprintf(f, "{\n");
+    bool firstCategory = true;
+    for (StatCategoryMap::iterator c = sorted.begin(); c != sorted.end(); ++c) {
+        fprintf(f, "%s  ", firstCategory ? "" : ",\n");
+        firstCategory = false;
+        writeJSONString(f, c->first);
+        fprintf(f, ": {");
+        bool first = true;
+        for (map<string, const StatInfo *>::iterator s = c->second.begin();
+             s != c->second.end(); ++s) {
+            fprintf(f, "%s\n    ", first ? "" : ",");
+            first = false;
+            writeJSONString(f, s->first);
+            const int64_t *v = &merged[s->second->slot];
+            switch (s->second->type) {
+            case STAT_TYPE_COUNTER:
+            case STAT_TYPE_MEMORY:
+                fprintf(f, ": %lld", (long long)v[0]);
+                break;
+            case STAT_TYPE_DISTRIBUTION:
+                fprintf(f, ": { \"count\": %lld, \"sum\": %lld, \"min\": %lld, "
+                        "\"max\": %lld }", (long long)v[0], (long long)v[1],
+                        (long long)v[2], (long long)v[3]);
+                break;
+            case STAT_TYPE_PERCENT:
+                fprintf(f, ": { \"numerator\": %lld, \"denominator\": %lld }",
+                        (long long)v[0], (long long)v[1]);
+                break;
+            case STAT_TYPE_TIMER:
+                fprintf(f, ": %.6f", v[0] * 1e-6);
+                break;
+            }
+        }
+        fprintf(f, "\n  }");
+    }
+    fprintf(f, "\n}\n");
+    fclose(f);
+    return true;
+}
+
+
+void StatsReset() {
+    StatsLock lock;
+    for (uint32_t t = 0; threadValues && t < threadValues->size(); ++t)
+        memset((*threadValues)[t], 0, maxStatSlots * sizeof(int64_t));
+}
+
+
+#else
+
+// Statistics Disabled Function Definitions
+void StatsReport(FILE *dest) {
+    fprintf(dest, "Statistics: pbrt was compiled with PBRT_NO_STATS defined.\n");
+}
+
+
+bool StatsWriteJSON(const string &filename) {
+    Warning("pbrt was compiled with PBRT_NO_STATS defined; not writing "
+            "statistics to \"%s\".", filename.c_str());
+    return false;
+}
+
+
+void StatsReset() {
+}
+
+
+#endif // PBRT_HAS_STATS
@@ -0,0 +1,194 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_STATS_H
+#define PBRT_CORE_STATS_H
+
+// core/stats.h*
+#include "pbrt.h"
+
+// Render statistics are compiled in unless _PBRT_NO_STATS_ is defined.
+// Each statistic is defined once at file scope with one of the
+// _STAT_COUNTER()_-style macros, using a "Category/Description" title, and
+// updated with _STAT_INC()_ and friends.  Updates go to a block of values
+// private to the calling thread, so they need no atomics or locks; the
+// blocks are only summed when a report is generated, after rendering.
+// Statistics are assigned their slots in the blocks the first time they
+// are updated, so they may be used during static initialization.
+#ifndef PBRT_NO_STATS
+#define PBRT_HAS_STATS
+#endif
+
+// Statistics Function Declarations
+void StatsReport(FILE *dest);
+bool StatsWriteJSON(const string &filename);
+void StatsReset();
+
+#ifdef PBRT_HAS_STATS
+#include "timer.h"
+
+// Statistics Declarations
+enum StatType {
+    STAT_TYPE_COUNTER, STAT_TYPE_MEMORY, STAT_TYPE_DISTRIBUTION,
+    STAT_TYPE_PERCENT, STAT_TYPE_TIMER
+};
+
+
+struct StatInfo {
+    // _StatInfo_s are constant-initialized aggregates; _slot_ is -1 until
+    // the statistic is first updated
+    const char *title;
+    StatType type;
+    volatile int slot;
+};
+
+
+void StatRegister(StatInfo &stat);
+
+
+int64_t *StatsAllocThreadValues();
+#ifdef PBRT_THREAD_LOCAL
+extern PBRT_THREAD_LOCAL int64_t *statsThreadValues;
+inline int64_t *StatsThreadValues() {
+    int64_t *v = statsThreadValues;
+    return v ? v : StatsAllocThreadValues();
+}
+#else
+// No compiler-supported thread-local storage; use the threads API
+int64_t *StatsThreadValues();
+#endif // PBRT_THREAD_LOCAL
+
+
+inline int64_t *StatValues(StatInfo &stat) {
+    if (stat.slot < 0) StatRegister(stat);
+    return StatsThreadValues() + stat.slot;
+}
+
+
+inline void StatAdd(StatInfo &stat, int64_t n) {
+    *StatValues(stat) += n;
+}
+
+
+inline void StatReportValue(StatInfo &stat, int64_t v) {
+    // Distributions store count, sum, minimum and maximum
+    int64_t *d = StatValues(stat);
+    if (d[0] == 0 || v < d[2]) d[2] = v;
+    if (d[0] == 0 || v > d[3]) d[3] = v;
+    ++d[0];
+    d[1] += v;
+}
+
+
+inline void StatPercentAdd(StatInfo &stat, int64_t num, int64_t denom) {
+    int64_t *d = StatValues(stat);
+    d[0] += num;
+    d[1] += denom;
+}
+
+
+class StatTally {
+public:
+    // StatTally Public Methods
+    StatTally(StatInfo &s) : stat(s), count(0) { }
+    ~StatTally() {
+        if (stat.type == STAT_TYPE_DISTRIBUTION) StatReportValue(stat, count);
+        else StatAdd(stat, count);
+    }
+    StatTally &operator++() { ++count; return *this; }
+    StatTally &operator+=(int64_t n) { count += n; return *this; }
+private:
+    // StatTally Private Data
+    StatInfo &stat;
+    int64_t count;
+};
+
+
+class StatTimedScope {
+public:
+    // StatTimedScope Public Methods
+    StatTimedScope(StatInfo &s) : stat(s) { timer.Start(); }
+    ~StatTimedScope() {
+        // Timers accumulate elapsed microseconds
+        StatAdd(stat, int64_t(timer.Time() * 1e6));
+    }
+private:
+    // StatTimedScope Private Data
+    StatInfo &stat;
+    Timer timer;
+};
+
+
+#define STAT_COUNTER(title, var) \
+    StatInfo var = { title, STAT_TYPE_COUNTER, -1 }
+#define STAT_MEMORY_COUNTER(title, var) \
+    StatInfo var = { title, STAT_TYPE_MEMORY, -1 }
+#define STAT_INT_DISTRIBUTION(title, var) \
+    StatInfo var = { title, STAT_TYPE_DISTRIBUTION, -1 }
+#define STAT_PERCENT(title, var) \
+    StatInfo var = { title, STAT_TYPE_PERCENT, -1 }
+#define STAT_TIMER(title, var) \
+    StatInfo var = { title, STAT_TYPE_TIMER, -1 }
+#define STAT_EXTERN(var) extern StatInfo var
+#define STAT_INC(var) StatAdd(var, 1)
+#define STAT_ADD(var, n) StatAdd(var, n)
+#define STAT_REPORT_VALUE(var, v) StatReportValue(var, v)
+#define STAT_PERCENT_ADD(var, num, denom) StatPercentAdd(var, num, denom)
+#define STAT_TALLY(var, name) StatTally name(var)
+#define STAT_TIMED_SCOPE(var) StatTimedScope var##Scope(var)
+#else
+
+// Statistics Disabled Declarations
+struct StatNullTally {
+    StatNullTally &operator++() { return *this; }
+    StatNullTally &operator+=(int64_t) { return *this; }
+};
+
+
+#define STAT_COUNTER(title, var)
+#define STAT_MEMORY_COUNTER(title, var)
+#define STAT_INT_DISTRIBUTION(title, var)
+#define STAT_PERCENT(title, var)
+#define STAT_TIMER(title, var)
+#define STAT_EXTERN(var)
+#define STAT_INC(var)
+#define STAT_ADD(var, n)
+#define STAT_REPORT_VALUE(var, v)
+#define STAT_PERCENT_ADD(var, num, denom)
+#define STAT_TALLY(var, name) StatNullTally name
+#define STAT_TIMED_SCOPE(var)
+#endif // PBRT_HAS_STATS
+
+#endif // PBRT_CORE_STATS_H
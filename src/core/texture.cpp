@@ -34,6 +34,7 @@
 #include "stdafx.h"
 #include "texture.h"
 #include "shape.h"
+#include "stats.h"
 
 // Texture Inline Functions
 inline float SmoothStep(float min, float max, float value) {
@@ -82,6 +83,11 @@ static int NoisePerm[2 * NOISE_PERM_SIZE] = {
 
 
 
+// MIPMap Statistics
+STAT_COUNTER("Texture/Trilinear MIPMap lookups", nTrilinearLookups);
+STAT_COUNTER("Texture/EWA MIPMap lookups", nEWALookups);
+STAT_MEMORY_COUNTER("Memory/MIPMap texels", mipmapBytes);
+
 // Texture Method Definitions
 UVMapping2D::UVMapping2D(float ssu, float ssv, float ddu, float ddv)
     : su(ssu), sv(ssv), du(ddu), dv(ddv) { }
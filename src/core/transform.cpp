@@ -391,12 +391,21 @@ void AnimatedTransform::Interpolate(float time, Transform *t) const {
 
 BBox AnimatedTransform::MotionBounds(const BBox &b,
                                      bool useInverse) const {
+    return MotionBounds(b, startTime, endTime, useInverse);
+}
+
+
+BBox AnimatedTransform::MotionBounds(const BBox &b, float time0,
+                                     float time1, bool useInverse) const {
     if (!actuallyAnimated) return Inverse(*startTransform)(b);
+    // Bound motion between _time0_ and _time1_, within the animated range
+    time0 = Clamp(time0, startTime, endTime);
+    time1 = Clamp(time1, startTime, endTime);
     BBox ret;
     const int nSteps = 128;
     for (int i = 0; i < nSteps; ++i) {
         Transform t;
-        float time = Lerp(float(i)/float(nSteps-1), startTime, endTime);
+        float time = Lerp(float(i)/float(nSteps-1), time0, time1);
         Interpolate(time, &t);
         if (useInverse) t = Inverse(t);
         ret = Union(ret, t(b));
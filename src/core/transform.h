@@ -315,6 +315,8 @@ public:
     Vector operator()(float time, const Vector &v) const;
     Ray operator()(const Ray &r) const;
     BBox MotionBounds(const BBox &b, bool useInverse) const;
+    BBox MotionBounds(const BBox &b, float time0, float time1,
+                      bool useInverse) const;
     bool HasScale() const { return startTransform->HasScale() || endTransform->HasScale(); }
 
     const Transform *startTransform, *endTransform;
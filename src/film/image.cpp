@@ -54,18 +54,7 @@ ImageFilm::ImageFilm(int xres, int yres, Filter *filt, const float crop[4],
     pixels = new BlockedArray<Pixel>(xPixelCount, yPixelCount);
 
     // Precompute filter weight table
-#define FILTER_TABLE_SIZE 16
-    filterTable = new float[FILTER_TABLE_SIZE * FILTER_TABLE_SIZE];
-    float *ftp = filterTable;
-    for (int y = 0; y < FILTER_TABLE_SIZE; ++y) {
-        float fy = ((float)y + .5f) *
-                   filter->yWidth / FILTER_TABLE_SIZE;
-        for (int x = 0; x < FILTER_TABLE_SIZE; ++x) {
-            float fx = ((float)x + .5f) *
-                       filter->xWidth / FILTER_TABLE_SIZE;
-            *ftp++ = filter->Evaluate(fx, fy);
-        }
-    }
+    filterTable = ComputeFilterTable(filter);
 
     // Possibly open window for image display
     if (openWindow || PbrtOptions.openWindow) {
@@ -153,6 +142,49 @@ void ImageFilm::Splat(const CameraSample &sample, const Spectrum &L) {
 }
 
 
+FilmTile *ImageFilm::GetFilmTile(int xstart, int xend,
+                                 int ystart, int yend) {
+    int extent[4] = { xPixelStart, xPixelStart + xPixelCount,
+                      yPixelStart, yPixelStart + yPixelCount };
+    return new ImageFilmTile(this, filter, filterTable, extent, xstart, xend,
+                             ystart, yend);
+}
+
+
+void ImageFilm::MergeFilmTile(FilmTile *t) {
+    ImageFilmTile *tile = (ImageFilmTile *)t;
+    // Find interior pixels that samples of other tiles can't reach
+    int ix0 = Ceil2Int(tile->xSampleStart - 0.5f + filter->xWidth);
+    int ix1 = Ceil2Int(tile->xSampleEnd   - 0.5f - filter->xWidth);
+    int iy0 = Ceil2Int(tile->ySampleStart - 0.5f + filter->yWidth);
+    int iy1 = Ceil2Int(tile->ySampleEnd   - 0.5f - filter->yWidth);
+    const float *tp = tile->pixels;
+    for (int y = 0; y < tile->yPixelCount; ++y) {
+        int py = tile->yPixelStart + y;
+        for (int x = 0; x < tile->xPixelCount; ++x, tp += 4) {
+            if (tp[0] == 0.f && tp[1] == 0.f && tp[2] == 0.f && tp[3] == 0.f)
+                continue;
+            int px = tile->xPixelStart + x;
+            Pixel &pixel = (*pixels)(px - xPixelStart, py - yPixelStart);
+            // Pixels in the padding ring overlap neighboring tiles
+            if (px >= ix0 && px < ix1 && py >= iy0 && py < iy1) {
+                pixel.Lxyz[0] += tp[0];
+                pixel.Lxyz[1] += tp[1];
+                pixel.Lxyz[2] += tp[2];
+                pixel.weightSum += tp[3];
+            }
+            else {
+                AtomicAdd(&pixel.Lxyz[0], tp[0]);
+                AtomicAdd(&pixel.Lxyz[1], tp[1]);
+                AtomicAdd(&pixel.Lxyz[2], tp[2]);
+                AtomicAdd(&pixel.weightSum, tp[3]);
+            }
+        }
+    }
+    delete tile;
+}
+
+
 void ImageFilm::GetSampleExtent(int *xstart, int *xend,
                                 int *ystart, int *yend) const {
     *xstart = Floor2Int(xPixelStart + 0.5f - filter->xWidth);
@@ -174,34 +206,80 @@ void ImageFilm::GetPixelExtent(int *xstart, int *xend,
 }
 
 
-void ImageFilm::WriteImage(float splatScale) {
+void ImageFilm::RGBRow::operator()(int y) const {
+    int offset = y * film->xPixelCount;
+    for (int x = 0; x < film->xPixelCount; ++x) {
+        // Convert pixel XYZ color to RGB
+        const Pixel &pixel = (*film->pixels)(x, y);
+        XYZToRGB(pixel.Lxyz, &rgb[3*offset]);
+
+        // Normalize pixel with weight sum
+        float weightSum = pixel.weightSum;
+        if (weightSum != 0.f) {
+            float invWt = 1.f / weightSum;
+            rgb[3*offset  ] = max(0.f, rgb[3*offset  ] * invWt);
+            rgb[3*offset+1] = max(0.f, rgb[3*offset+1] * invWt);
+            rgb[3*offset+2] = max(0.f, rgb[3*offset+2] * invWt);
+        }
+
+        // Add splat value at pixel
+        float splatRGB[3];
+        XYZToRGB(pixel.splatXYZ, splatRGB);
+        rgb[3*offset  ] += splatScale * splatRGB[0];
+        rgb[3*offset+1] += splatScale * splatRGB[1];
+        rgb[3*offset+2] += splatScale * splatRGB[2];
+        ++offset;
+    }
+}
+
+
+bool ImageFilm::GetPixelValues(float *rgb, float splatScale) const {
     // Convert image to RGB and compute final pixel values
-    int nPix = xPixelCount * yPixelCount;
-    float *rgb = new float[3*nPix];
-    int offset = 0;
+    RGBRow rgbRow;
+    rgbRow.film = this;
+    rgbRow.rgb = rgb;
+    rgbRow.splatScale = splatScale;
+    ParallelFor(0, yPixelCount, max(1, 16384 / xPixelCount), rgbRow);
+    return true;
+}
+
+
+bool ImageFilm::GetRawPixels(vector<float> *data) const {
+    // Copy $L_{xyz}$, weight sum, and splat values of each pixel
+    data->resize(7 * xPixelCount * yPixelCount);
+    float *dp = &(*data)[0];
     for (int y = 0; y < yPixelCount; ++y) {
-        for (int x = 0; x < xPixelCount; ++x) {
-            // Convert pixel XYZ color to RGB
-            XYZToRGB((*pixels)(x, y).Lxyz, &rgb[3*offset]);
-
-            // Normalize pixel with weight sum
-            float weightSum = (*pixels)(x, y).weightSum;
-            if (weightSum != 0.f) {
-                float invWt = 1.f / weightSum;
-                rgb[3*offset  ] = max(0.f, rgb[3*offset  ] * invWt);
-                rgb[3*offset+1] = max(0.f, rgb[3*offset+1] * invWt);
-                rgb[3*offset+2] = max(0.f, rgb[3*offset+2] * invWt);
-            }
+        for (int x = 0; x < xPixelCount; ++x, dp += 7) {
+            const Pixel &pixel = (*pixels)(x, y);
+            memcpy(dp, pixel.Lxyz, 3 * sizeof(float));
+            dp[3] = pixel.weightSum;
+            memcpy(dp + 4, pixel.splatXYZ, 3 * sizeof(float));
+        }
+    }
+    return true;
+}
 
-            // Add splat value at pixel
-            float splatRGB[3];
-            XYZToRGB((*pixels)(x, y).splatXYZ, splatRGB);
-            rgb[3*offset  ] += splatScale * splatRGB[0];
-            rgb[3*offset+1] += splatScale * splatRGB[1];
-            rgb[3*offset+2] += splatScale * splatRGB[2];
-            ++offset;
+
+bool ImageFilm::SetRawPixels(const vector<float> &data) {
+    if (data.size() != size_t(7 * xPixelCount * yPixelCount))
+        return false;
+    const float *dp = &data[0];
+    for (int y = 0; y < yPixelCount; ++y) {
+        for (int x = 0; x < xPixelCount; ++x, dp += 7) {
+            Pixel &pixel = (*pixels)(x, y);
+            memcpy(pixel.Lxyz, dp, 3 * sizeof(float));
+            pixel.weightSum = dp[3];
+            memcpy(pixel.splatXYZ, dp + 4, 3 * sizeof(float));
         }
     }
+    return true;
+}
+
+
+void ImageFilm::WriteImage(float splatScale) {
+    int nPix = xPixelCount * yPixelCount;
+    float *rgb = new float[3*nPix];
+    GetPixelValues(rgb, splatScale);
 
     // Write RGB image
     ::WriteImage(filename, rgb, NULL, xPixelCount, yPixelCount,
@@ -217,6 +295,107 @@ void ImageFilm::UpdateDisplay(int x0, int y0, int x1, int y1,
 }
 
 
+// ImageFilmTile Method Definitions
+ImageFilmTile::ImageFilmTile(Film *f, const Filter *filt, const float *ft,
+        const int extent[4], int xstart, int xend, int ystart, int yend) {
+    film = f;
+    filter = filt;
+    filterTable = ft;
+    memcpy(filmExtent, extent, 4 * sizeof(int));
+    xSampleStart = xstart;
+    xSampleEnd = xend;
+    ySampleStart = ystart;
+    ySampleEnd = yend;
+
+    // Pad tile by filter extent of samples in $[$_xstart_,_xend_$)$
+    int x0 = Ceil2Int (xstart - 0.5f - filter->xWidth);
+    int x1 = Floor2Int(xend   - 0.5f + filter->xWidth);
+    int y0 = Ceil2Int (ystart - 0.5f - filter->yWidth);
+    int y1 = Floor2Int(yend   - 0.5f + filter->yWidth);
+    xPixelStart = max(x0, filmExtent[0]);
+    yPixelStart = max(y0, filmExtent[2]);
+    xPixelCount = max(0, min(x1, filmExtent[1] - 1) - xPixelStart + 1);
+    yPixelCount = max(0, min(y1, filmExtent[3] - 1) - yPixelStart + 1);
+
+    // Allocate $L_{xyz}$ and weight sum for each pixel of tile
+    int nPixels = xPixelCount * yPixelCount;
+    pixels = AllocAligned<float>(4 * max(nPixels, 1));
+    memset(pixels, 0, 4 * max(nPixels, 1) * sizeof(float));
+}
+
+
+void ImageFilmTile::AddSample(const CameraSample &sample,
+                              const Spectrum &L) {
+    // Compute sample's raster extent
+    float dimageX = sample.imageX - 0.5f;
+    float dimageY = sample.imageY - 0.5f;
+    int x0 = Ceil2Int (dimageX - filter->xWidth);
+    int x1 = Floor2Int(dimageX + filter->xWidth);
+    int y0 = Ceil2Int (dimageY - filter->yWidth);
+    int y1 = Floor2Int(dimageY + filter->yWidth);
+    x0 = max(x0, filmExtent[0]);
+    x1 = min(x1, filmExtent[1] - 1);
+    y0 = max(y0, filmExtent[2]);
+    y1 = min(y1, filmExtent[3] - 1);
+    if ((x1-x0) < 0 || (y1-y0) < 0)
+    {
+        PBRT_SAMPLE_OUTSIDE_IMAGE_EXTENT(const_cast<CameraSample *>(&sample));
+        return;
+    }
+    if (x0 < xPixelStart || x1 >= xPixelStart + xPixelCount ||
+        y0 < yPixelStart || y1 >= yPixelStart + yPixelCount) {
+        // Add sample outside the tile's extent directly to the image
+        film->AddSample(sample, L);
+        return;
+    }
+
+    // Loop over filter support and add sample to tile pixels
+    float xyz[3];
+    L.ToXYZ(xyz);
+    int *ifx = ALLOCA(int, x1 - x0 + 1);
+    for (int x = x0; x <= x1; ++x) {
+        float fx = fabsf((x - dimageX) *
+                         filter->invXWidth * FILTER_TABLE_SIZE);
+        ifx[x-x0] = min(Floor2Int(fx), FILTER_TABLE_SIZE-1);
+    }
+    int *ify = ALLOCA(int, y1 - y0 + 1);
+    for (int y = y0; y <= y1; ++y) {
+        float fy = fabsf((y - dimageY) *
+                         filter->invYWidth * FILTER_TABLE_SIZE);
+        ify[y-y0] = min(Floor2Int(fy), FILTER_TABLE_SIZE-1);
+    }
+    for (int y = y0; y <= y1; ++y) {
+        const float *filterRow = &filterTable[ify[y-y0] * FILTER_TABLE_SIZE];
+        float *tp = &pixels[4 * ((y - yPixelStart) * xPixelCount +
+                                 (x0 - xPixelStart))];
+        for (int x = x0; x <= x1; ++x, tp += 4) {
+            float filterWt = filterRow[ifx[x-x0]];
+            tp[0] += filterWt * xyz[0];
+            tp[1] += filterWt * xyz[1];
+            tp[2] += filterWt * xyz[2];
+            tp[3] += filterWt;
+        }
+    }
+}
+
+
+float *ComputeFilterTable(const Filter *filter) {
+    // Tabulate filter over the positive quadrant of its extent
+    float *filterTable = new float[FILTER_TABLE_SIZE * FILTER_TABLE_SIZE];
+    float *ftp = filterTable;
+    for (int y = 0; y < FILTER_TABLE_SIZE; ++y) {
+        float fy = ((float)y + .5f) *
+                   filter->yWidth / FILTER_TABLE_SIZE;
+        for (int x = 0; x < FILTER_TABLE_SIZE; ++x) {
+            float fx = ((float)x + .5f) *
+                       filter->xWidth / FILTER_TABLE_SIZE;
+            *ftp++ = filter->Evaluate(fx, fy);
+        }
+    }
+    return filterTable;
+}
+
+
 ImageFilm *CreateImageFilm(const ParamSet &params, Filter *filter) {
     string filename = params.FindOneString("filename", "");
     if (PbrtOptions.imageFile != "") {
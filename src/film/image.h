@@ -56,9 +56,14 @@ public:
     }
     void AddSample(const CameraSample &sample, const Spectrum &L);
     void Splat(const CameraSample &sample, const Spectrum &L);
+    FilmTile *GetFilmTile(int xstart, int xend, int ystart, int yend);
+    void MergeFilmTile(FilmTile *tile);
     void GetSampleExtent(int *xstart, int *xend, int *ystart, int *yend) const;
     void GetPixelExtent(int *xstart, int *xend, int *ystart, int *yend) const;
     void WriteImage(float splatScale);
+    bool GetPixelValues(float *rgb, float splatScale) const;
+    bool GetRawPixels(vector<float> *data) const;
+    bool SetRawPixels(const vector<float> &data);
     void UpdateDisplay(int x0, int y0, int x1, int y1, float splatScale);
 private:
     // ImageFilm Private Data
@@ -78,9 +83,41 @@ private:
     };
     BlockedArray<Pixel> *pixels;
     float *filterTable;
+    struct RGBRow {
+        void operator()(int y) const;
+        const ImageFilm *film;
+        float *rgb, splatScale;
+    };
 };
 
 
+// ImageFilmTile Declarations
+class ImageFilmTile : public FilmTile {
+public:
+    // ImageFilmTile Public Methods
+    ImageFilmTile(Film *film, const Filter *filter, const float *filterTable,
+                  const int filmExtent[4], int xstart, int xend,
+                  int ystart, int yend);
+    ~ImageFilmTile() { FreeAligned(pixels); }
+    void AddSample(const CameraSample &sample, const Spectrum &L);
+
+    // ImageFilmTile Public Data
+    int xSampleStart, xSampleEnd, ySampleStart, ySampleEnd;
+    int xPixelStart, yPixelStart, xPixelCount, yPixelCount;
+    float *pixels;
+private:
+    // ImageFilmTile Private Data
+    Film *film;
+    const Filter *filter;
+    const float *filterTable;
+    int filmExtent[4];
+};
+
+
+#define FILTER_TABLE_SIZE 16
+float *ComputeFilterTable(const Filter *filter);
+
+
 ImageFilm *CreateImageFilm(const ParamSet &params, Filter *filter);
 
 #endif // PBRT_FILM_IMAGE_H
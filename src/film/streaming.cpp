@@ -0,0 +1,373 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// film/streaming.cpp*
+#include "stdafx.h"
+#include "film/streaming.h"
+#include "spectrum.h"
+#include "imageio.h"
+#include "paramset.h"
+#include "stats.h"
+
+// StreamingFilm Local Declarations
+STAT_INT_DISTRIBUTION("Memory/Streaming film blocks in memory", residentBlocks);
+
+// StreamingFilm Method Definitions
+StreamingFilm::StreamingFilm(int xres, int yres, Filter *filt,
+                             const float crop[4], const string &fn, int bs)
+    : Film(xres, yres) {
+    filter = filt;
+    memcpy(cropWindow, crop, 4 * sizeof(float));
+    filename = fn;
+    // Compute film image extent
+    xPixelStart = Ceil2Int(xResolution * cropWindow[0]);
+    xPixelCount = max(1, Ceil2Int(xResolution * cropWindow[1]) - xPixelStart);
+    yPixelStart = Ceil2Int(yResolution * cropWindow[2]);
+    yPixelCount = max(1, Ceil2Int(yResolution * cropWindow[3]) - yPixelStart);
+    filterTable = ComputeFilterTable(filter);
+    GetSampleExtent(&sampleExtent[0], &sampleExtent[1], &sampleExtent[2],
+                    &sampleExtent[3]);
+
+    // Divide image into blocks that are written once all their samples are in
+    blockSize = bs;
+    xBlocks = (xPixelCount + blockSize - 1) / blockSize;
+    yBlocks = (yPixelCount + blockSize - 1) / blockSize;
+    blocks.resize(xBlocks * yBlocks);
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+        int x0, x1, y0, y1;
+        blockSampleBounds(b, &x0, &x1, &y0, &y1);
+        blocks[b].fullCoverage = int64_t(max(0, x1 - x0)) *
+                                 int64_t(max(0, y1 - y0));
+    }
+    nResidentBlocks = 0;
+    warnedWritten = false;
+    blockMutex = Mutex::Create();
+    writerMutex = Mutex::Create();
+    writer = NULL;
+}
+
+
+StreamingFilm::~StreamingFilm() {
+    for (uint32_t b = 0; b < blocks.size(); ++b)
+        delete[] blocks[b].pixels;
+    delete writer;
+    Mutex::Destroy(blockMutex);
+    Mutex::Destroy(writerMutex);
+    delete filter;
+    delete[] filterTable;
+}
+
+
+void StreamingFilm::blockBounds(int b, int *x0, int *x1,
+                                int *y0, int *y1) const {
+    *x0 = xPixelStart + (b % xBlocks) * blockSize;
+    *x1 = min(*x0 + blockSize, xPixelStart + xPixelCount);
+    *y0 = yPixelStart + (b / xBlocks) * blockSize;
+    *y1 = min(*y0 + blockSize, yPixelStart + yPixelCount);
+}
+
+
+void StreamingFilm::blockSampleBounds(int b, int *x0, int *x1,
+                                      int *y0, int *y1) const {
+    // Find pixel cells of samples whose filter extent may reach block _b_
+    int px0, px1, py0, py1;
+    blockBounds(b, &px0, &px1, &py0, &py1);
+    *x0 = max(Floor2Int(px0 + 0.5f - filter->xWidth) - 1, sampleExtent[0]);
+    *x1 = min(Floor2Int(px1 - 0.5f + filter->xWidth) + 2, sampleExtent[1]);
+    *y0 = max(Floor2Int(py0 + 0.5f - filter->yWidth) - 1, sampleExtent[2]);
+    *y1 = min(Floor2Int(py1 - 0.5f + filter->yWidth) + 2, sampleExtent[3]);
+}
+
+
+StreamingFilm::Pixel *StreamingFilm::lookupPixel(int x, int y) {
+    // Find block holding pixel $(x,y)$, allocating its pixels if needed
+    int bx = (x - xPixelStart) / blockSize, by = (y - yPixelStart) / blockSize;
+    Block &block = blocks[by * xBlocks + bx];
+    if (block.written) {
+        if (!warnedWritten)
+            Warning("Ignoring samples for part of the streaming film's image "
+                    "that has already been written.");
+        warnedWritten = true;
+        return NULL;
+    }
+    if (!block.pixels) {
+        block.pixels = new Pixel[blockSize * blockSize];
+        ++nResidentBlocks;
+        STAT_REPORT_VALUE(residentBlocks, nResidentBlocks);
+    }
+    return &block.pixels[(y - yPixelStart - by * blockSize) * blockSize +
+                         (x - xPixelStart - bx * blockSize)];
+}
+
+
+void StreamingFilm::AddSample(const CameraSample &sample,
+                              const Spectrum &L) {
+    // Filter sample into a tile covering just its pixel, then add that
+    int x = Floor2Int(sample.imageX), y = Floor2Int(sample.imageY);
+    int extent[4] = { xPixelStart, xPixelStart + xPixelCount,
+                      yPixelStart, yPixelStart + yPixelCount };
+    ImageFilmTile tile(this, filter, filterTable, extent, x, x+1, y, y+1);
+    tile.AddSample(sample, L);
+    MutexLock lock(*blockMutex);
+    const float *tp = tile.pixels;
+    for (int ty = 0; ty < tile.yPixelCount; ++ty) {
+        for (int tx = 0; tx < tile.xPixelCount; ++tx, tp += 4) {
+            if (tp[0] == 0.f && tp[1] == 0.f && tp[2] == 0.f && tp[3] == 0.f)
+                continue;
+            Pixel *pixel = lookupPixel(tile.xPixelStart + tx,
+                                       tile.yPixelStart + ty);
+            if (!pixel) continue;
+            for (int i = 0; i < 3; ++i)
+                pixel->Lxyz[i] += tp[i];
+            pixel->weightSum += tp[3];
+        }
+    }
+}
+
+
+void StreamingFilm::Splat(const CameraSample &sample, const Spectrum &L) {
+    if (L.HasNaNs()) {
+        Warning("StreamingFilm ignoring splatted spectrum with NaN values");
+        return;
+    }
+    float xyz[3];
+    L.ToXYZ(xyz);
+    int x = Floor2Int(sample.imageX), y = Floor2Int(sample.imageY);
+    if (x < xPixelStart || x - xPixelStart >= xPixelCount ||
+        y < yPixelStart || y - yPixelStart >= yPixelCount) return;
+    MutexLock lock(*blockMutex);
+    Pixel *pixel = lookupPixel(x, y);
+    if (!pixel) return;
+    for (int i = 0; i < 3; ++i)
+        pixel->splatXYZ[i] += xyz[i];
+}
+
+
+FilmTile *StreamingFilm::GetFilmTile(int xstart, int xend,
+                                     int ystart, int yend) {
+    int extent[4] = { xPixelStart, xPixelStart + xPixelCount,
+                      yPixelStart, yPixelStart + yPixelCount };
+    return new ImageFilmTile(this, filter, filterTable, extent, xstart, xend,
+                             ystart, yend);
+}
+
+
+void StreamingFilm::MergeFilmTile(FilmTile *t) {
+    ImageFilmTile *tile = (ImageFilmTile *)t;
+    vector<int> finished;
+    {
+    MutexLock lock(*blockMutex);
+    // Add tile's pixels to image blocks
+    const float *tp = tile->pixels;
+    for (int y = 0; y < tile->yPixelCount; ++y) {
+        for (int x = 0; x < tile->xPixelCount; ++x, tp += 4) {
+            if (tp[0] == 0.f && tp[1] == 0.f && tp[2] == 0.f && tp[3] == 0.f)
+                continue;
+            Pixel *pixel = lookupPixel(tile->xPixelStart + x,
+                                       tile->yPixelStart + y);
+            if (!pixel) continue;
+            pixel->Lxyz[0] += tp[0];
+            pixel->Lxyz[1] += tp[1];
+            pixel->Lxyz[2] += tp[2];
+            pixel->weightSum += tp[3];
+        }
+    }
+
+    // Account for tile's samples in blocks they may reach
+    int bx0 = max(0, Floor2Int(tile->xSampleStart - filter->xWidth) - 4 -
+                     xPixelStart) / blockSize;
+    int bx1 = min(xBlocks - 1, max(0, Ceil2Int(tile->xSampleEnd +
+                  filter->xWidth) + 4 - xPixelStart) / blockSize);
+    int by0 = max(0, Floor2Int(tile->ySampleStart - filter->yWidth) - 4 -
+                     yPixelStart) / blockSize;
+    int by1 = min(yBlocks - 1, max(0, Ceil2Int(tile->ySampleEnd +
+                  filter->yWidth) + 4 - yPixelStart) / blockSize);
+    for (int by = by0; by <= by1; ++by) {
+        for (int bx = bx0; bx <= bx1; ++bx) {
+            int b = by * xBlocks + bx, x0, x1, y0, y1;
+            blockSampleBounds(b, &x0, &x1, &y0, &y1);
+            int dx = min(x1, tile->xSampleEnd) - max(x0, tile->xSampleStart);
+            int dy = min(y1, tile->ySampleEnd) - max(y0, tile->ySampleStart);
+            if (dx <= 0 || dy <= 0) continue;
+            Block &block = blocks[b];
+            block.coverage += int64_t(dx) * int64_t(dy);
+            if (!block.written && block.coverage >= block.fullCoverage) {
+                // All samples that can reach block have been merged
+                block.written = true;
+                finished.push_back(b);
+            }
+        }
+    }
+    }
+    delete tile;
+    writeBlocks(finished, 1.f);
+}
+
+
+void StreamingFilm::writeBlocks(const vector<int> &finished,
+                                float splatScale) {
+    if (finished.size() == 0) return;
+    {
+    MutexLock lock(*writerMutex);
+    if (!writer)
+        writer = CreateImageTileWriter(filename, xPixelCount, yPixelCount,
+            xResolution, yResolution, xPixelStart, yPixelStart, blockSize);
+    vector<float> rgb(3 * blockSize * blockSize);
+    for (uint32_t i = 0; i < finished.size(); ++i) {
+        // Compute final pixel values of block; blocks never reached are black
+        int x0, x1, y0, y1;
+        blockBounds(finished[i], &x0, &x1, &y0, &y1);
+        const Pixel *pixels = blocks[finished[i]].pixels;
+        float *p = &rgb[0];
+        for (int y = 0; y < y1 - y0; ++y) {
+            for (int x = 0; x < x1 - x0; ++x, p += 3) {
+                if (!pixels) {
+                    p[0] = p[1] = p[2] = 0.f;
+                    continue;
+                }
+                const Pixel &pixel = pixels[y * blockSize + x];
+                XYZToRGB(pixel.Lxyz, p);
+                float weightSum = pixel.weightSum;
+                if (weightSum != 0.f) {
+                    float invWt = 1.f / weightSum;
+                    p[0] = max(0.f, p[0] * invWt);
+                    p[1] = max(0.f, p[1] * invWt);
+                    p[2] = max(0.f, p[2] * invWt);
+                }
+                float splatRGB[3];
+                XYZToRGB(pixel.splatXYZ, splatRGB);
+                p[0] += splatScale * splatRGB[0];
+                p[1] += splatScale * splatRGB[1];
+                p[2] += splatScale * splatRGB[2];
+            }
+        }
+        writer->WriteTile(x0 - xPixelStart, y0 - yPixelStart, x1 - x0,
+                          y1 - y0, &rgb[0]);
+    }
+    }
+
+    // Free memory of written blocks
+    MutexLock lock(*blockMutex);
+    for (uint32_t i = 0; i < finished.size(); ++i) {
+        Block &block = blocks[finished[i]];
+        if (block.pixels) {
+            delete[] block.pixels;
+            block.pixels = NULL;
+            --nResidentBlocks;
+        }
+    }
+}
+
+
+void StreamingFilm::GetSampleExtent(int *xstart, int *xend,
+                                    int *ystart, int *yend) const {
+    *xstart = Floor2Int(xPixelStart + 0.5f - filter->xWidth);
+    *xend   = Ceil2Int(xPixelStart + 0.5f + xPixelCount +
+                       filter->xWidth);
+
+    *ystart = Floor2Int(yPixelStart + 0.5f - filter->yWidth);
+    *yend   = Ceil2Int(yPixelStart + 0.5f + yPixelCount +
+                       filter->yWidth);
+}
+
+
+void StreamingFilm::GetPixelExtent(int *xstart, int *xend,
+                                   int *ystart, int *yend) const {
+    *xstart = xPixelStart;
+    *xend   = xPixelStart + xPixelCount;
+    *ystart = yPixelStart;
+    *yend   = yPixelStart + yPixelCount;
+}
+
+
+void StreamingFilm::WriteImage(float splatScale) {
+    // Write blocks that are still waiting for samples
+    vector<int> remaining;
+    {
+    MutexLock lock(*blockMutex);
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+        if (!blocks[b].written) {
+            blocks[b].written = true;
+            remaining.push_back(b);
+        }
+    }
+    }
+    writeBlocks(remaining, splatScale);
+
+    // Finish writing image file
+    MutexLock lock(*writerMutex);
+    delete writer;
+    writer = NULL;
+}
+
+
+StreamingFilm *CreateStreamingFilm(const ParamSet &params, Filter *filter) {
+    string filename = params.FindOneString("filename", "");
+    if (PbrtOptions.imageFile != "") {
+        if (filename != "") {
+            Warning("Output filename supplied on command line, \"%s\", ignored "
+                    "due to filename provided in scene description file, \"%s\".",
+                    PbrtOptions.imageFile.c_str(), filename.c_str());
+        }
+        else
+            filename = PbrtOptions.imageFile;
+    }
+    if (filename == "")
+#ifdef PBRT_HAS_OPENEXR
+        filename = "pbrt.exr";
+#else
+        filename = "pbrt.pfm";
+#endif
+
+    int xres = params.FindOneInt("xresolution", 640);
+    int yres = params.FindOneInt("yresolution", 480);
+    if (PbrtOptions.quickRender) xres = max(1, xres / 4);
+    if (PbrtOptions.quickRender) yres = max(1, yres / 4);
+    float crop[4] = { 0, 1, 0, 1 };
+    int cwi;
+    const float *cr = params.FindFloat("cropwindow", &cwi);
+    if (cr && cwi == 4) {
+        crop[0] = Clamp(min(cr[0], cr[1]), 0., 1.);
+        crop[1] = Clamp(max(cr[0], cr[1]), 0., 1.);
+        crop[2] = Clamp(min(cr[2], cr[3]), 0., 1.);
+        crop[3] = Clamp(max(cr[2], cr[3]), 0., 1.);
+    }
+    int blockSize = params.FindOneInt("blocksize", 64);
+    if (blockSize < 1) {
+        Error("\"blocksize\" must be positive; using 64.");
+        blockSize = 64;
+    }
+    return new StreamingFilm(xres, yres, filter, crop, filename, blockSize);
+}
+
+
@@ -50,6 +50,7 @@ public:
     void RequestSamples(Sampler *sampler, Sample *sample, const Scene *scene);
     PathIntegrator(int md) { maxDepth = md; }
 private:
+    friend class WavefrontRenderer;
     // PathIntegrator Private Data
     int maxDepth;
 #define SAMPLE_DEPTH 3
@@ -37,6 +37,7 @@
 #include "montecarlo.h"
 #include "paramset.h"
 #include "imageio.h"
+#include "parallel.h"
 
 // InfiniteAreaLight Utility Classes
 struct InfiniteAreaCube {
@@ -57,6 +58,23 @@ struct InfiniteAreaCube {
 };
 
 
+struct InfiniteAreaImageRow {
+    // InfiniteAreaImageRow Public Methods
+    void operator()(int v) const {
+        float vp = (float)v / (float)height;
+        float sinTheta = sinf(M_PI * float(v+.5f)/float(height));
+        for (int u = 0; u < width; ++u) {
+            float up = (float)u / (float)width;
+            img[u+v*width] = radianceMap->Lookup(up, vp, filter).y();
+            img[u+v*width] *= sinTheta;
+        }
+    }
+    const MIPMap<RGBSpectrum> *radianceMap;
+    float *img, filter;
+    int width, height;
+};
+
+
 
 // InfiniteAreaLight Method Definitions
 InfiniteAreaLight::~InfiniteAreaLight() {
@@ -89,15 +107,13 @@ InfiniteAreaLight::InfiniteAreaLight(const Transform &light2world,
     // Compute scalar-valued image _img_ from environment map
     float filter = 1.f / max(width, height);
     float *img = new float[width*height];
-    for (int v = 0; v < height; ++v) {
-        float vp = (float)v / (float)height;
-        float sinTheta = sinf(M_PI * float(v+.5f)/float(height));
-        for (int u = 0; u < width; ++u) {
-            float up = (float)u / (float)width;
-            img[u+v*width] = radianceMap->Lookup(up, vp, filter).y();
-            img[u+v*width] *= sinTheta;
-        }
-    }
+    InfiniteAreaImageRow imageRow;
+    imageRow.radianceMap = radianceMap;
+    imageRow.img = img;
+    imageRow.filter = filter;
+    imageRow.width = width;
+    imageRow.height = height;
+    ParallelFor(0, height, max(1, 4096 / width), imageRow);
 
     // Compute sampling distributions for rows and columns of image
     distribution = new Distribution2D(img, width, height);
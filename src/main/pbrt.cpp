@@ -48,9 +48,21 @@ int main(int argc, char *argv[]) {
         else if (!strcmp(argv[i], "--quick")) options.quickRender = true;
         else if (!strcmp(argv[i], "--quiet")) options.quiet = true;
         else if (!strcmp(argv[i], "--verbose")) options.verbose = true;
+        else if (!strcmp(argv[i], "--pin-threads")) options.pinThreads = true;
+        else if (!strcmp(argv[i], "--numa")) options.numa = options.pinThreads = true;
+        else if (!strcmp(argv[i], "--stats")) options.printStats = true;
+        else if (!strcmp(argv[i], "--stats-json")) options.statsFile = argv[++i];
+        else if (!strcmp(argv[i], "--time-limit")) options.timeLimit = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--checkpoint")) options.checkpointFile = argv[++i];
+        else if (!strcmp(argv[i], "--checkpoint-interval")) options.checkpointInterval = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--resume")) options.resume = true;
+        else if (!strcmp(argv[i], "--frames")) options.nFrames = atoi(argv[++i]);
         else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
             printf("usage: pbrt [--ncores n] [--outfile filename] [--quick] [--quiet] "
-                   "[--verbose] [--help] <filename.pbrt> ...\n");
+                   "[--verbose] [--pin-threads] [--numa] [--stats] "
+                   "[--stats-json filename] [--time-limit seconds] "
+                   "[--checkpoint filename] [--checkpoint-interval seconds] "
+                   "[--resume] [--frames n] [--help] <filename.pbrt> ...\n");
             return 0;
         }
         else filenames.push_back(argv[i]);
@@ -39,6 +39,7 @@
 #include "montecarlo.h"
 #include "primitive.h"
 #include "intersection.h"
+#include "timer.h"
 
 // AggregateTest Method Definitions
 AggregateTest::AggregateTest(int niters,
@@ -67,6 +68,8 @@ void AggregateTest::Render(const Scene *scene) {
                 bbox.pMin[bbox.MaximumExtent()]);
     Point lastHit;
     float lastEps = 0.f;
+    vector<Ray> testRays;
+    testRays.reserve(nIterations);
     for (int i = 0; i < nIterations; ++i) {
         // Choose random rays, _rayAccel_ and _rayAll_ for testing
 
@@ -88,6 +91,7 @@ void AggregateTest::Render(const Scene *scene) {
         else if (rng.RandomFloat() < .25) eps = 1e-3f;
         Ray rayAccel(org, dir, eps);
         Ray rayAll = rayAccel;
+        testRays.push_back(rayAccel);
 
         // Compute intersections using accelerator and exhaustive testing
         Intersection isectAccel, isectAll;
@@ -116,6 +120,28 @@ void AggregateTest::Render(const Scene *scene) {
         prog.Update();
     }
     prog.Done();
+
+    // Measure accelerator throughput for the test rays
+    Timer timer;
+    timer.Start();
+    for (uint32_t i = 0; i < testRays.size(); ++i) {
+        Ray ray = testRays[i];
+        Intersection isect;
+        scene->Intersect(ray, &isect);
+    }
+    double intersectTime = timer.Time();
+    timer.Reset();
+    timer.Start();
+    for (uint32_t i = 0; i < testRays.size(); ++i)
+        scene->IntersectP(testRays[i]);
+    double intersectPTime = timer.Time();
+    if (!PbrtOptions.quiet) {
+        printf("Accelerator throughput: %.3f M rays/sec (Intersect), "
+               "%.3f M rays/sec (IntersectP)\n",
+               testRays.size() / max(intersectTime, 1e-6) * 1e-6,
+               testRays.size() / max(intersectPTime, 1e-6) * 1e-6);
+        fflush(stdout);
+    }
 }
 
 
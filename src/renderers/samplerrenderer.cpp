@@ -41,6 +41,7 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "intersection.h"
+#include <signal.h>
 
 static uint32_t hash(char *key, uint32_t len)
 {
@@ -56,21 +57,76 @@ static uint32_t hash(char *key, uint32_t len)
     return hash;
 } 
 
+// SamplerRendererTask Local Declarations
+STAT_INT_DISTRIBUTION("Rendering/Tile time (microseconds)", tileTime);
+STAT_COUNTER("Rendering/Tile regions split off to idle threads", nTileSplits);
+STAT_PERCENT("Rendering/Thread utilization", threadUtilization);
+STAT_COUNTER("Rendering/Progressive passes", nProgressivePasses);
+
+// Progressive rendering finishes early after SIGINT or SIGTERM
+static volatile sig_atomic_t stopSignaled = 0;
+static void stopRenderingHandler(int) {
+    stopSignaled = 1;
+}
+
+// Tiles are recursively halved into regions of at most this many pixels
+static const int maxRegionPixels = 64;
+static int regionPixels(const Sampler *s) {
+    return (s->xPixelEnd - s->xPixelStart) * (s->yPixelEnd - s->yPixelStart);
+}
+
+
+// Map distance _d_ along the Hilbert curve over an _n_ x _n_ grid to $(x,y)$
+static void hilbertPoint(int n, int d, int *x, int *y) {
+    *x = *y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            swap(*x, *y);
+        }
+        *x += s * rx;
+        *y += s * ry;
+        d /= 4;
+    }
+}
+
+
+
 // SamplerRendererTask Definitions
+bool SamplerRendererTask::stopRequested() {
+    return stopSignaled ||
+           (timeBudget > 0. && budgetTimer.Time() >= timeBudget);
+}
+
+
 void SamplerRendererTask::Run() {
     PBRT_STARTED_RENDERTASK(taskNum);
+    Timer timer;
+    timer.Start();
     // Get sub-_Sampler_ for _SamplerRendererTask_
-    Sampler *sampler = mainSampler->GetSubSampler(taskNum, taskCount);
+    bool wholeTile = (region == NULL);
+    Sampler *sampler = wholeTile ?
+        mainSampler->GetSubSampler(taskNum, taskCount) : region;
+    region = NULL;
     if (!sampler)
     {
-        reporter.Update();
+        if (wholeTile) reporter.Update();
         PBRT_FINISHED_RENDERTASK(taskNum);
         return;
     }
+    if (tile) {
+        tile->xStart = sampler->xPixelStart;
+        tile->xEnd = sampler->xPixelEnd;
+        tile->yStart = sampler->yPixelStart;
+        tile->yEnd = sampler->yPixelEnd;
+    }
 
     // Declare local variables used for rendering loop
     MemoryArena arena;
-    RNG rng(taskNum);
 
     // Allocate space for samples and intersections
     int maxSamples = sampler->MaximumSampleCount();
@@ -79,101 +135,378 @@ void SamplerRendererTask::Run() {
     Spectrum *Ls = new Spectrum[maxSamples];
     Spectrum *Ts = new Spectrum[maxSamples];
     Intersection *isects = new Intersection[maxSamples];
+    float *rayWeights = new float[maxSamples];
+    const Ray **packet = new const Ray *[maxSamples];
+    bool *hits = new bool[maxSamples];
+
+    // Render regions of the tile, handing pending ones to idle threads
+    vector<std::pair<Sampler *, uint32_t> > todo;
+    todo.push_back(std::make_pair(sampler, regionNode));
+    vector<Task *> splitTasks;
+    // Idle workers aren't counted as busy until they start running the
+    // region they were given, so give away at most one region per region
+    // rendered here
+    bool maySplit = true;
+    while (todo.size() > 0) {
+        if (stopRequested()) {
+            // Leave the rest of the tile unrendered
+            for (uint32_t i = 0; i < todo.size(); ++i)
+                delete todo[i].first;
+            break;
+        }
+        if (maySplit && todo.size() > 1 && NumIdleWorkers() > 0) {
+            // Enqueue the largest pending region as a new task
+            SamplerRendererTask *split = new SamplerRendererTask(*this);
+            split->tile = NULL;
+            split->region = todo[0].first;
+            split->regionNode = todo[0].second;
+            split->busyTime = 0.;
+            split->nSplits = 0;
+            todo.erase(todo.begin());
+            splitTasks.push_back(split);
+            EnqueueTasks(vector<Task *>(1, split));
+            maySplit = false;
+            continue;
+        }
+        sampler = todo.back().first;
+        uint32_t node = todo.back().second;
+        todo.pop_back();
+        if (regionPixels(sampler) > maxRegionPixels) {
+            // Halve region; the first half is rendered next
+            Sampler *second = sampler->GetSubSampler(1, 2);
+            Sampler *first = sampler->GetSubSampler(0, 2);
+            delete sampler;
+            if (second) todo.push_back(std::make_pair(second, 2 * node + 1));
+            if (first) todo.push_back(std::make_pair(first, 2 * node));
+            continue;
+        }
+        if (checkpoint && checkpoint->RegionDone(taskNum, node)) {
+            // Region was already rendered before the checkpoint was written
+            delete sampler;
+            continue;
+        }
 
-    // Get samples from _Sampler_ and update image
-    int sampleCount;
-    while ((sampleCount = sampler->GetMoreSamples(samples, rng)) > 0) {
-        // Generate camera rays and compute radiance along rays
-        for (int i = 0; i < sampleCount; ++i) {
-            // Find camera ray for _sample[i]_
-            PBRT_STARTED_GENERATING_CAMERA_RAY(&samples[i]);
-            float rayWeight = camera->GenerateRayDifferential(samples[i], &rays[i]);
-            rays[i].ScaleDifferentials(1.f / sqrtf(sampler->samplesPerPixel));
-            PBRT_FINISHED_GENERATING_CAMERA_RAY(&samples[i], &rays[i], rayWeight);
-
-            // Evaluate radiance along camera ray
-            PBRT_STARTED_CAMERA_RAY_INTEGRATION(&rays[i], &samples[i]);
-            if (visualizeObjectIds) {
-                if (rayWeight > 0.f && scene->Intersect(rays[i], &isects[i])) {
-                    // random shading based on shape id...
-                    uint32_t ids[2] = { isects[i].shapeId, isects[i].primitiveId };
-                    uint32_t h = hash((char *)ids, sizeof(ids));
-                    float rgb[3] = { float(h & 0xff), float((h >> 8) & 0xff),
-                                     float((h >> 16) & 0xff) };
-                    Ls[i] = Spectrum::FromRGB(rgb);
-                    Ls[i] /= 255.f;
-                }
-                else
-                    Ls[i] = 0.f;
-            }
-            else {
-            if (rayWeight > 0.f)
-                Ls[i] = rayWeight * renderer->Li(scene, rays[i], &samples[i], rng,
-                                                 arena, &isects[i], &Ts[i]);
-            else {
-                Ls[i] = 0.f;
-                Ts[i] = 1.f;
+        // Seed _rng_ from the region, independent of which thread renders it
+        uint32_t ids[3] = { uint32_t(taskNum), node, uint32_t(iteration) };
+        RNG rng(hash((char *)ids, sizeof(ids)));
+
+        // Accumulate region's samples in a private tile of the film
+        FilmTile *filmTile = camera->film->GetFilmTile(sampler->xPixelStart,
+            sampler->xPixelEnd, sampler->yPixelStart, sampler->yPixelEnd);
+
+        // Get samples from _Sampler_ and update image
+        int sampleCount;
+        while ((sampleCount = sampler->GetMoreSamples(samples, rng)) > 0) {
+            // Generate camera rays for samples
+            for (int i = 0; i < sampleCount; ++i) {
+                // Find camera ray for _sample[i]_
+                PBRT_STARTED_GENERATING_CAMERA_RAY(&samples[i]);
+                rayWeights[i] = camera->GenerateRayDifferential(samples[i], &rays[i]);
+                rays[i].ScaleDifferentials(1.f / sqrtf(sampler->samplesPerPixel));
+                PBRT_FINISHED_GENERATING_CAMERA_RAY(&samples[i], &rays[i], rayWeights[i]);
             }
+            STAT_ADD(nCameraRays, sampleCount);
 
-            // Issue warning if unexpected radiance value returned
-            if (Ls[i].HasNaNs()) {
-                Error("Not-a-number radiance value returned "
-                      "for image sample.  Setting to black.");
-                Ls[i] = Spectrum(0.f);
-            }
-            else if (Ls[i].y() < -1e-5) {
-                Error("Negative luminance value, %f, returned"
-                      "for image sample.  Setting to black.", Ls[i].y());
-                Ls[i] = Spectrum(0.f);
-            }
-            else if (isinf(Ls[i].y())) {
-                Error("Infinite luminance value returned"
-                      "for image sample.  Setting to black.");
-                Ls[i] = Spectrum(0.f);
+            // Evaluate radiance along camera rays
+            if (visualizeObjectIds) {
+                for (int i = 0; i < sampleCount; ++i)
+                    packet[i] = &rays[i];
+                scene->IntersectPacket(packet, sampleCount, isects, hits);
+                for (int i = 0; i < sampleCount; ++i) {
+                    if (rayWeights[i] > 0.f && hits[i]) {
+                        // random shading based on shape id...
+                        uint32_t ids[2] = { isects[i].shapeId, isects[i].primitiveId };
+                        uint32_t h = hash((char *)ids, sizeof(ids));
+                        float rgb[3] = { float(h & 0xff), float((h >> 8) & 0xff),
+                                         float((h >> 16) & 0xff) };
+                        Ls[i] = Spectrum::FromRGB(rgb);
+                        Ls[i] /= 255.f;
+                    }
+                    else
+                        Ls[i] = 0.f;
+                }
             }
+            else
+                renderer->LiPacket(scene, rays, rayWeights, samples, sampleCount,
+                                   rng, arena, Ls, isects, Ts);
+
+            for (int i = 0; i < sampleCount; ++i) {
+                PBRT_STARTED_CAMERA_RAY_INTEGRATION(&rays[i], &samples[i]);
+                if (!visualizeObjectIds) {
+                // Issue warning if unexpected radiance value returned
+                if (Ls[i].HasNaNs()) {
+                    Error("Not-a-number radiance value returned "
+                          "for image sample.  Setting to black.");
+                    Ls[i] = Spectrum(0.f);
+                }
+                else if (Ls[i].y() < -1e-5) {
+                    Error("Negative luminance value, %f, returned"
+                          "for image sample.  Setting to black.", Ls[i].y());
+                    Ls[i] = Spectrum(0.f);
+                }
+                else if (isinf(Ls[i].y())) {
+                    Error("Infinite luminance value returned"
+                          "for image sample.  Setting to black.");
+                    Ls[i] = Spectrum(0.f);
+                }
+                }
+                PBRT_FINISHED_CAMERA_RAY_INTEGRATION(&rays[i], &samples[i], &Ls[i]);
             }
-            PBRT_FINISHED_CAMERA_RAY_INTEGRATION(&rays[i], &samples[i], &Ls[i]);
-        }
 
-        // Report sample results to _Sampler_, add contributions to image
-        if (sampler->ReportResults(samples, rays, Ls, isects, sampleCount))
-        {
-            for (int i = 0; i < sampleCount; ++i)
+            // Report sample results to _Sampler_, add contributions to image
+            if (sampler->ReportResults(samples, rays, Ls, isects, sampleCount))
             {
-                PBRT_STARTED_ADDING_IMAGE_SAMPLE(&samples[i], &rays[i], &Ls[i], &Ts[i]);
-                camera->film->AddSample(samples[i], Ls[i]);
-                PBRT_FINISHED_ADDING_IMAGE_SAMPLE();
+                for (int i = 0; i < sampleCount; ++i)
+                {
+                    PBRT_STARTED_ADDING_IMAGE_SAMPLE(&samples[i], &rays[i], &Ls[i], &Ts[i]);
+                    filmTile->AddSample(samples[i], Ls[i]);
+                    PBRT_FINISHED_ADDING_IMAGE_SAMPLE();
+                }
             }
+
+            // Free _MemoryArena_ memory from computing image sample values
+            arena.FreeAll();
         }
 
-        // Free _MemoryArena_ memory from computing image sample values
-        arena.FreeAll();
+        // Clean up after finishing region of image
+        if (checkpoint) checkpoint->MergeRegion(filmTile, taskNum, node);
+        else camera->film->MergeFilmTile(filmTile);
+        camera->film->UpdateDisplay(sampler->xPixelStart,
+            sampler->yPixelStart, sampler->xPixelEnd+1, sampler->yPixelEnd+1);
+        delete sampler;
+        maySplit = true;
     }
-
-    // Clean up after _SamplerRendererTask_ is done with its image region
-    camera->film->UpdateDisplay(sampler->xPixelStart,
-        sampler->yPixelStart, sampler->xPixelEnd+1, sampler->yPixelEnd+1);
-    delete sampler;
     delete[] samples;
     delete[] rays;
     delete[] Ls;
     delete[] Ts;
     delete[] isects;
-    reporter.Update();
+    delete[] rayWeights;
+    delete[] packet;
+    delete[] hits;
+    busyTime += timer.Time();
+
+    // Wait for regions given to other threads and gather their timings
+    if (splitTasks.size() > 0) {
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < splitTasks.size(); ++i) {
+            SamplerRendererTask *split = (SamplerRendererTask *)splitTasks[i];
+            busyTime += split->busyTime;
+            nSplits += 1 + split->nSplits;
+            delete split;
+        }
+        STAT_ADD(nTileSplits, splitTasks.size());
+    }
+    if (wholeTile) {
+        double wallTime = timer.Time();
+        STAT_REPORT_VALUE(tileTime, int64_t(wallTime * 1e6));
+        if (tile) {
+            tile->wallTime += wallTime;
+            tile->busyTime += busyTime;
+            tile->nSplits += nSplits;
+        }
+        reporter.Update();
+    }
     PBRT_FINISHED_RENDERTASK(taskNum);
 }
 
 
+// SamplerRendererCheckpoint Local Declarations
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key;
+    uint32_t iteration;
+    uint32_t nRegions;
+    uint32_t nPixelValues;
+    uint32_t pad;
+};
+
+
+static const char checkpointMagic[8] = { 'p', 'b', 'r', 't', 'C', 'K', 'P', 0 };
+static const uint32_t checkpointVersion = 1;
+static inline uint64_t regionId(int taskNum, uint32_t node) {
+    return (uint64_t(taskNum) << 32) | node;
+}
+
+
+
+// SamplerRendererCheckpoint Method Definitions
+SamplerRendererCheckpoint::SamplerRendererCheckpoint(const string &fn,
+        float interv, Film *f, uint32_t k)
+    : filename(fn), interval(interv), film(f), key(k) {
+    filmMutex = RWMutex::Create();
+    regionMutex = Mutex::Create();
+    fileMutex = Mutex::Create();
+    iteration = 0;
+    writeRequested = stopWriter = false;
+    timer.Start();
+    writerThread = (interval > 0.f) ? Thread::Create(writerEntry, this) : NULL;
+}
+
+
+SamplerRendererCheckpoint::~SamplerRendererCheckpoint() {
+    if (writerThread) {
+        stopWriter = true;
+        writeSemaphore.Post();
+        Thread::Join(writerThread);
+    }
+    RWMutex::Destroy(filmMutex);
+    Mutex::Destroy(regionMutex);
+    Mutex::Destroy(fileMutex);
+}
+
+
+void SamplerRendererCheckpoint::writerEntry(void *arg) {
+    SamplerRendererCheckpoint *ckpt = (SamplerRendererCheckpoint *)arg;
+    while (true) {
+        // Wait for a rendering task to find that a checkpoint is due
+        ckpt->writeSemaphore.Wait();
+        if (ckpt->stopWriter) break;
+        ckpt->Write();
+        MutexLock lock(*ckpt->regionMutex);
+        ckpt->timer.Reset();
+        ckpt->timer.Start();
+        ckpt->writeRequested = false;
+    }
+}
+
+
+bool SamplerRendererCheckpoint::Read(int *it) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        Warning("Unable to open checkpoint file \"%s\"; rendering from the "
+                "start.", filename.c_str());
+        return false;
+    }
+    // Read and validate checkpoint contents
+    CheckpointHeader header;
+    vector<uint64_t> regions;
+    vector<float> pixels;
+    bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+        memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) == 0 &&
+        header.version == checkpointVersion && header.key == key;
+    if (valid) {
+        regions.resize(header.nRegions);
+        pixels.resize(header.nPixelValues);
+        valid = (header.nRegions == 0 ||
+                 fread(&regions[0], sizeof(uint64_t), regions.size(), f) ==
+                     regions.size()) &&
+                (header.nPixelValues == 0 ||
+                 fread(&pixels[0], sizeof(float), pixels.size(), f) ==
+                     pixels.size());
+    }
+    fclose(f);
+    if (!valid || !film->SetRawPixels(pixels)) {
+        Warning("Checkpoint file \"%s\" is invalid or was written for "
+                "different rendering settings; rendering from the start.",
+                filename.c_str());
+        return false;
+    }
+
+    // Continue from iteration and regions recorded in checkpoint
+    iteration = *it = header.iteration;
+    doneRegions = skipRegions = regions;
+    sort(skipRegions.begin(), skipRegions.end());
+    Info("Resuming render from checkpoint \"%s\" (iteration %d, %d regions "
+         "done)", filename.c_str(), iteration, int(regions.size()));
+    return true;
+}
+
+
+bool SamplerRendererCheckpoint::RegionDone(int taskNum, uint32_t node) const {
+    return std::binary_search(skipRegions.begin(), skipRegions.end(),
+                              regionId(taskNum, node));
+}
+
+
+void SamplerRendererCheckpoint::MergeRegion(FilmTile *tile, int taskNum,
+                                            uint32_t node) {
+    // Merge _tile_ and record its region together, so checkpoints see both
+    RWMutexLock lock(*filmMutex, READ);
+    film->MergeFilmTile(tile);
+    MutexLock regionLock(*regionMutex);
+    doneRegions.push_back(regionId(taskNum, node));
+
+    // Wake writer thread if it's time for another checkpoint
+    if (writerThread && !writeRequested && timer.Time() >= interval) {
+        writeRequested = true;
+        writeSemaphore.Post();
+    }
+}
+
+
+void SamplerRendererCheckpoint::FinishIteration(int nextIteration) {
+    RWMutexLock lock(*filmMutex, WRITE);
+    iteration = nextIteration;
+    doneRegions.clear();
+    skipRegions.clear();
+}
+
+
+void SamplerRendererCheckpoint::Write() {
+    MutexLock fileLock(*fileMutex);
+    // Copy film and progress while no regions are being merged
+    vector<float> pixels;
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.key = key;
+    vector<uint64_t> regions;
+    {
+    RWMutexLock lock(*filmMutex, WRITE);
+    if (!film->GetRawPixels(&pixels)) {
+        Warning("Film doesn't support checkpoints; not writing \"%s\".",
+                filename.c_str());
+        return;
+    }
+    regions = doneRegions;
+    header.iteration = iteration;
+    }
+    header.nRegions = regions.size();
+    header.nPixelValues = pixels.size();
+
+    // Write checkpoint to temporary file and move it into place
+    string tmpName = filename + ".tmp";
+    FILE *f = fopen(tmpName.c_str(), "wb");
+    if (!f) {
+        Warning("Unable to create checkpoint file \"%s\".", tmpName.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        (regions.size() == 0 ||
+         fwrite(&regions[0], sizeof(uint64_t), regions.size(), f) ==
+             regions.size()) &&
+        (pixels.size() == 0 ||
+         fwrite(&pixels[0], sizeof(float), pixels.size(), f) == pixels.size());
+    if (fclose(f) != 0) ok = false;
+#if defined(PBRT_IS_WINDOWS)
+    if (ok) remove(filename.c_str());
+#endif
+    if (!ok || rename(tmpName.c_str(), filename.c_str()) != 0) {
+        Warning("Unable to write checkpoint file \"%s\".", filename.c_str());
+        remove(tmpName.c_str());
+    }
+}
+
+
 
 // SamplerRenderer Method Definitions
 SamplerRenderer::SamplerRenderer(Sampler *s, Camera *c,
                                  SurfaceIntegrator *si, VolumeIntegrator *vi,
-                                 bool visIds) {
+                                 bool visIds, const string &tl, bool prog,
+                                 int maxp, float noise) {
     sampler = s;
     camera = c;
     surfaceIntegrator = si;
     volumeIntegrator = vi;
     visualizeObjectIds = visIds;
+    tileLog = tl;
+    progressive = prog;
+    maxPasses = maxp;
+    noiseThreshold = noise;
+    checkpoint = NULL;
 }
 
 
@@ -187,10 +520,15 @@ SamplerRenderer::~SamplerRenderer() {
 
 void SamplerRenderer::Render(const Scene *scene) {
     PBRT_FINISHED_PARSING();
+    Timer timer;
+    timer.Start();
     // Allow integrators to do preprocessing for the scene
     PBRT_STARTED_PREPROCESSING();
+    {
+    STAT_TIMED_SCOPE(integratorPreprocessTime);
     surfaceIntegrator->Preprocess(scene, camera, this);
     volumeIntegrator->Preprocess(scene, camera, this);
+    }
     PBRT_FINISHED_PREPROCESSING();
     PBRT_STARTED_RENDERING();
     // Allocate and initialize _sample_
@@ -201,24 +539,250 @@ void SamplerRenderer::Render(const Scene *scene) {
 
     // Compute number of _SamplerRendererTask_s to create for rendering
     int nPixels = camera->film->xResolution * camera->film->yResolution;
-    int nTasks = max(32 * NumSystemCores(), nPixels / (16*16));
+    int nTasks;
+    if (PbrtOptions.checkpointFile != "")
+        // Keep the tiling independent of the core count, so that renders
+        // can be resumed on a different machine
+        nTasks = max(64, nPixels / (32*32));
+    else
+        nTasks = max(8 * NumSystemCores(), nPixels / (32*32));
     nTasks = RoundUpPow2(nTasks);
-    ProgressReporter reporter(nTasks, "Rendering");
-    vector<Task *> renderTasks;
-    for (int i = 0; i < nTasks; ++i)
-        renderTasks.push_back(new SamplerRendererTask(scene, this, camera,
-                                                      reporter, sampler, sample, 
-                                                      visualizeObjectIds, 
-                                                      nTasks-1-i, nTasks));
+
+    // Order tiles along a Hilbert curve so that nearby tiles run together
+    int nx, ny;
+    sampler->SubWindowGrid(nTasks, &nx, &ny);
+    int n = RoundUpPow2(max(nx, ny));
+    vector<SamplerRendererTile> tiles(nTasks);
+    vector<int> tileOrder;
+    for (int d = 0; d < n * n && int(tileOrder.size()) < nTasks; ++d) {
+        int x, y;
+        hilbertPoint(n, d, &x, &y);
+        if (x >= nx || y >= ny) continue;
+        int taskNum = y * nx + x;
+        tiles[taskNum].order = tileOrder.size();
+        tileOrder.push_back(taskNum);
+    }
+    Assert(int(tileOrder.size()) == nTasks);
+
+    // Set up checkpointing, resuming an earlier render if requested
+    int firstIteration = 0;
+    if (PbrtOptions.checkpointFile != "") {
+        int settings[10] = { camera->film->xResolution,
+            camera->film->yResolution, 0, 0, 0, 0, nTasks,
+            sampler->samplesPerPixel, maxRegionPixels, int(progressive) };
+        camera->film->GetPixelExtent(&settings[2], &settings[3],
+                                     &settings[4], &settings[5]);
+        checkpoint = new SamplerRendererCheckpoint(PbrtOptions.checkpointFile,
+            PbrtOptions.checkpointInterval, camera->film,
+            hash((char *)settings, sizeof(settings)));
+        if (PbrtOptions.resume)
+            checkpoint->Read(&firstIteration);
+    }
+
+    // Finish early after SIGINT or SIGTERM if the render can be continued
+    stopSignaled = 0;
+    void (*prevIntHandler)(int) = SIG_DFL, (*prevTermHandler)(int) = SIG_DFL;
+    bool catchSignals = (progressive || checkpoint);
+    if (catchSignals) {
+        prevIntHandler = signal(SIGINT, stopRenderingHandler);
+        prevTermHandler = signal(SIGTERM, stopRenderingHandler);
+    }
+    NumaResetRayCounts();
+    double renderTime = 0.;
+    if (progressive)
+        renderProgressive(scene, sample, tileOrder, tiles, timer, &renderTime,
+                          firstIteration);
+    else if (firstIteration > 0)
+        Info("Checkpoint \"%s\" holds a finished image; not rendering.",
+             PbrtOptions.checkpointFile.c_str());
+    else {
+        ProgressReporter reporter(nTasks, "Rendering");
+        renderTime = renderIteration(scene, sample, tileOrder, tiles, 0,
+                                     reporter, 0.);
+        reporter.Done();
+        if (checkpoint && !stopSignaled)
+            checkpoint->FinishIteration(1);
+    }
+    if (catchSignals) {
+        signal(SIGINT, prevIntHandler);
+        signal(SIGTERM, prevTermHandler);
+    }
+    if (checkpoint) {
+        // Save final state so that the render can be continued later
+        checkpoint->Write();
+        if (stopSignaled)
+            Info("Rendering stopped; continue it with --resume --checkpoint "
+                 "\"%s\"", PbrtOptions.checkpointFile.c_str());
+        delete checkpoint;
+        checkpoint = NULL;
+    }
+    NumaReportRayCounts();
+    reportTiles(tiles, renderTime);
+    PBRT_FINISHED_RENDERING();
+    // Clean up after rendering and store final image
+    delete sample;
+    if (!progressive) {
+        STAT_TIMED_SCOPE(imageOutputTime);
+        camera->film->WriteImage();
+    }
+}
+
+
+double SamplerRenderer::renderIteration(const Scene *scene, Sample *sample,
+        const vector<int> &tileOrder, vector<SamplerRendererTile> &tiles,
+        int iteration, ProgressReporter &reporter, double timeBudget) {
+    // Create tasks for all tiles; they're started from the end of the vector
+    int nTasks = tileOrder.size();
+    vector<Task *> renderTasks(nTasks);
+    for (int i = 0; i < nTasks; ++i) {
+        int taskNum = tileOrder[i];
+        renderTasks[nTasks-1-i] = new SamplerRendererTask(scene, this,
+            camera, reporter, sampler, sample, visualizeObjectIds,
+            taskNum, nTasks, &tiles[taskNum], iteration, timeBudget,
+            checkpoint);
+    }
+    Timer timer;
+    timer.Start();
+    {
+    STAT_TIMED_SCOPE(renderingTime);
     EnqueueTasks(renderTasks);
     WaitForAllTasks();
+    }
     for (uint32_t i = 0; i < renderTasks.size(); ++i)
         delete renderTasks[i];
-    reporter.Done();
-    PBRT_FINISHED_RENDERING();
-    // Clean up after rendering and store final image
-    delete sample;
-    camera->film->WriteImage();
+    return timer.Time();
+}
+
+
+void SamplerRenderer::renderProgressive(const Scene *scene, Sample *sample,
+        const vector<int> &tileOrder, vector<SamplerRendererTile> &tiles,
+        Timer &timer, double *renderTime, int firstIteration) {
+    // Allocate storage for noise estimates, if needed
+    int x0, x1, y0, y1;
+    camera->film->GetPixelExtent(&x0, &x1, &y0, &y1);
+    vector<float> rgb, prevRgb;
+    bool estimateNoise = (noiseThreshold > 0.f), havePrevRgb = false;
+    if (estimateNoise) {
+        rgb.resize(3 * (x1 - x0) * (y1 - y0));
+        prevRgb.resize(rgb.size());
+    }
+
+    // Render passes that each double the number of samples per pixel
+    float timeLimit = PbrtOptions.timeLimit;
+    int nTasks = tileOrder.size(), iteration = 0;
+    bool wroteImage = false;
+    for (int pass = 0; maxPasses == 0 || pass < maxPasses; ++pass) {
+        int nIterations = (pass == 0) ? 1 : (1 << (pass - 1));
+        if (iteration + nIterations <= firstIteration) {
+            // Skip passes restored from the checkpoint
+            iteration += nIterations;
+            continue;
+        }
+        char title[32];
+        sprintf(title, "Pass %d", pass + 1);
+        ProgressReporter reporter(nTasks * nIterations, title);
+        bool finished = true;
+        for (int i = 0; i < nIterations && finished; ++i) {
+            if (iteration < firstIteration) {
+                ++iteration;
+                continue;
+            }
+            double budget = 0.;
+            if (timeLimit > 0.f) {
+                budget = timeLimit - timer.Time();
+                if (budget <= 0.) { finished = false; break; }
+            }
+            *renderTime += renderIteration(scene, sample, tileOrder, tiles,
+                                           iteration++, reporter, budget);
+            if (stopSignaled ||
+                (timeLimit > 0.f && timer.Time() >= timeLimit))
+                finished = false;
+            else if (checkpoint)
+                checkpoint->FinishIteration(iteration);
+        }
+        reporter.Done();
+        {
+        STAT_TIMED_SCOPE(imageOutputTime);
+        camera->film->WriteImage();
+        wroteImage = true;
+        }
+        if (!finished) {
+            Info("Stopped rendering during pass %d after %.1fs", pass + 1,
+                 timer.Time());
+            break;
+        }
+        STAT_INC(nProgressivePasses);
+
+        // Estimate noise from the change since the previous pass
+        float noise = -1.f;
+        if (estimateNoise && !camera->film->GetPixelValues(&rgb[0])) {
+            Warning("Film doesn't provide pixel values; ignoring "
+                    "\"noisethreshold\".");
+            estimateNoise = false;
+        }
+        if (estimateNoise) {
+            if (havePrevRgb) {
+                // The last pass took as many samples as all earlier ones
+                double sumDiff2 = 0., sum = 0.;
+                for (uint32_t i = 0; i < rgb.size(); ++i) {
+                    sumDiff2 += (rgb[i] - prevRgb[i]) * (rgb[i] - prevRgb[i]);
+                    sum += rgb[i];
+                }
+                noise = (sum > 0.) ? sqrt(sumDiff2 * rgb.size()) / sum : 0.f;
+            }
+            rgb.swap(prevRgb);
+            havePrevRgb = true;
+        }
+        int spp = sampler->samplesPerPixel * iteration;
+        if (noise >= 0.f)
+            Info("Pass %d: %d samples per pixel, %.1fs, relative noise %.4f",
+                 pass + 1, spp, timer.Time(), noise);
+        else
+            Info("Pass %d: %d samples per pixel, %.1fs", pass + 1, spp,
+                 timer.Time());
+        if (noise >= 0.f && noise <= noiseThreshold) break;
+    }
+    if (!wroteImage) {
+        // All passes were restored from the checkpoint
+        STAT_TIMED_SCOPE(imageOutputTime);
+        camera->film->WriteImage();
+    }
+}
+
+
+void SamplerRenderer::reportTiles(const vector<SamplerRendererTile> &tiles,
+                                  double renderTime) const {
+    // Compute thread utilization and find slowest tile
+    double busyTime = 0., maxTime = 0.;
+    int nSplits = 0;
+    for (uint32_t i = 0; i < tiles.size(); ++i) {
+        busyTime += tiles[i].busyTime;
+        maxTime = max(maxTime, tiles[i].wallTime);
+        nSplits += tiles[i].nSplits;
+    }
+    double availableTime = renderTime * NumSystemCores();
+    STAT_PERCENT_ADD(threadUtilization, int64_t(busyTime * 1e6),
+                     int64_t(availableTime * 1e6));
+    Info("Rendered %d tiles in %.2fs: %.1f%% thread utilization, "
+         "%d regions split off, slowest tile %.3fs", int(tiles.size()),
+         renderTime, availableTime > 0. ? 100. * busyTime / availableTime : 0.,
+         nSplits, maxTime);
+
+    // Write per-tile timings to _tileLog_, if requested
+    if (tileLog == "") return;
+    FILE *f = fopen(tileLog.c_str(), "w");
+    if (!f) {
+        Error("Unable to open tile log file \"%s\"", tileLog.c_str());
+        return;
+    }
+    fprintf(f, "tile,order,x0,x1,y0,y1,wall,busy,splits\n");
+    for (uint32_t i = 0; i < tiles.size(); ++i) {
+        const SamplerRendererTile &t = tiles[i];
+        fprintf(f, "%d,%d,%d,%d,%d,%d,%f,%f,%d\n", int(i), t.order,
+                t.xStart, t.xEnd, t.yStart, t.yEnd, t.wallTime, t.busyTime,
+                t.nSplits);
+    }
+    fclose(f);
 }
 
 
@@ -232,9 +796,46 @@ Spectrum SamplerRenderer::Li(const Scene *scene,
     if (!T) T = &localT;
     Intersection localIsect;
     if (!isect) isect = &localIsect;
+    bool hit = scene->Intersect(ray, isect);
+    return shade(scene, ray, hit, *isect, sample, rng, arena, T);
+}
+
+
+void SamplerRenderer::LiPacket(const Scene *scene,
+        const RayDifferential *rays, const float *rayWeights,
+        const Sample *samples, int nRays, RNG &rng, MemoryArena &arena,
+        Spectrum *Ls, Intersection *isects, Spectrum *Ts) const {
+    // Find first intersections for camera rays as a single packet
+    const Ray **packet = (const Ray **)arena.Alloc(nRays *
+                                                   sizeof(const Ray *));
+    bool *hits = ALLOCA(bool, nRays);
+    for (int i = 0; i < nRays; ++i) {
+        Assert(rays[i].time == samples[i].time);
+        Assert(!rays[i].HasNaNs());
+        packet[i] = &rays[i];
+    }
+    scene->IntersectPacket(packet, nRays, isects, hits);
+
+    // Shade camera rays using packet intersections
+    for (int i = 0; i < nRays; ++i) {
+        if (rayWeights[i] > 0.f)
+            Ls[i] = rayWeights[i] * shade(scene, rays[i], hits[i], isects[i],
+                                          &samples[i], rng, arena, &Ts[i]);
+        else {
+            Ls[i] = 0.f;
+            Ts[i] = 1.f;
+        }
+    }
+}
+
+
+Spectrum SamplerRenderer::shade(const Scene *scene,
+        const RayDifferential &ray, bool hit, const Intersection &isect,
+        const Sample *sample, RNG &rng, MemoryArena &arena,
+        Spectrum *T) const {
     Spectrum Li = 0.f;
-    if (scene->Intersect(ray, isect))
-        Li = surfaceIntegrator->Li(scene, this, ray, *isect, sample,
+    if (hit)
+        Li = surfaceIntegrator->Li(scene, this, ray, isect, sample,
                                    rng, arena);
     else {
         // Handle ray that doesn't intersect any geometry
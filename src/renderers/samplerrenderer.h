@@ -40,27 +40,104 @@
 #include "pbrt.h"
 #include "renderer.h"
 #include "parallel.h"
+#include "timer.h"
+class FilmTile;
+
+// SamplerRendererTile Declarations
+struct SamplerRendererTile {
+    SamplerRendererTile() {
+        order = xStart = xEnd = yStart = yEnd = nSplits = 0;
+        wallTime = busyTime = 0.;
+    }
+    int order, xStart, xEnd, yStart, yEnd;
+    double wallTime, busyTime;
+    int nSplits;
+};
+
+
+
+// SamplerRendererCheckpoint Declarations
+class SamplerRendererCheckpoint {
+public:
+    // SamplerRendererCheckpoint Public Methods
+    SamplerRendererCheckpoint(const string &filename, float interval,
+                              Film *film, uint32_t key);
+    ~SamplerRendererCheckpoint();
+    bool Read(int *iteration);
+    bool RegionDone(int taskNum, uint32_t node) const;
+    void MergeRegion(FilmTile *tile, int taskNum, uint32_t node);
+    void FinishIteration(int nextIteration);
+    void Write();
+private:
+    // SamplerRendererCheckpoint Private Methods
+    static void writerEntry(void *arg);
+
+    // SamplerRendererCheckpoint Private Data
+    string filename;
+    float interval;
+    Film *film;
+    uint32_t key;
+
+    // Regions of the image merged into _film_ in the current iteration
+    RWMutex *filmMutex;
+    Mutex *regionMutex, *fileMutex;
+    int iteration;
+    vector<uint64_t> doneRegions, skipRegions;
+
+    // Background thread that writes periodic checkpoints
+    Timer timer;
+    bool writeRequested;
+    volatile bool stopWriter;
+    Semaphore writeSemaphore;
+    Thread *writerThread;
+};
+
+
 
 // SamplerRenderer Declarations
 class SamplerRenderer : public Renderer {
 public:
     // SamplerRenderer Public Methods
     SamplerRenderer(Sampler *s, Camera *c, SurfaceIntegrator *si,
-                    VolumeIntegrator *vi, bool visIds);
+                    VolumeIntegrator *vi, bool visIds,
+                    const string &tileLog = "", bool progressive = false,
+                    int maxPasses = 0, float noiseThreshold = 0.f);
     ~SamplerRenderer();
     void Render(const Scene *scene);
     Spectrum Li(const Scene *scene, const RayDifferential &ray,
         const Sample *sample, RNG &rng, MemoryArena &arena,
         Intersection *isect = NULL, Spectrum *T = NULL) const;
+    void LiPacket(const Scene *scene, const RayDifferential *rays,
+        const float *rayWeights, const Sample *samples, int nRays, RNG &rng,
+        MemoryArena &arena, Spectrum *Ls, Intersection *isects,
+        Spectrum *Ts) const;
     Spectrum Transmittance(const Scene *scene, const RayDifferential &ray,
         const Sample *sample, RNG &rng, MemoryArena &arena) const;
 private:
+    // SamplerRenderer Private Methods
+    Spectrum shade(const Scene *scene, const RayDifferential &ray,
+        bool hit, const Intersection &isect, const Sample *sample,
+        RNG &rng, MemoryArena &arena, Spectrum *T) const;
+    double renderIteration(const Scene *scene, Sample *sample,
+        const vector<int> &tileOrder, vector<SamplerRendererTile> &tiles,
+        int iteration, ProgressReporter &reporter, double timeBudget);
+    void renderProgressive(const Scene *scene, Sample *sample,
+        const vector<int> &tileOrder, vector<SamplerRendererTile> &tiles,
+        Timer &timer, double *renderTime, int firstIteration);
+    void reportTiles(const vector<SamplerRendererTile> &tiles,
+                     double renderTime) const;
+
     // SamplerRenderer Private Data
     bool visualizeObjectIds;
+    string tileLog;
+    bool progressive;
+    int maxPasses;
+    float noiseThreshold;
     Sampler *sampler;
     Camera *camera;
     SurfaceIntegrator *surfaceIntegrator;
     VolumeIntegrator *volumeIntegrator;
+    SamplerRendererCheckpoint *checkpoint;
 };
 
 
@@ -71,14 +148,24 @@ public:
     // SamplerRendererTask Public Methods
     SamplerRendererTask(const Scene *sc, Renderer *ren, Camera *c,
                         ProgressReporter &pr, Sampler *ms, Sample *sam, 
-                        bool visIds, int tn, int tc)
+                        bool visIds, int tn, int tc,
+                        SamplerRendererTile *t = NULL, int it = 0,
+                        double budget = 0.,
+                        SamplerRendererCheckpoint *ckpt = NULL)
       : reporter(pr)
     {
         scene = sc; renderer = ren; camera = c; mainSampler = ms;
         origSample = sam; visualizeObjectIds = visIds; taskNum = tn; taskCount = tc;
+        tile = t; region = NULL; regionNode = 1;
+        busyTime = 0.; nSplits = 0;
+        iteration = it; timeBudget = budget; checkpoint = ckpt;
+        budgetTimer.Start();
     }
     void Run();
 private:
+    // SamplerRendererTask Private Methods
+    bool stopRequested();
+
     // SamplerRendererTask Private Data
     const Scene *scene;
     const Renderer *renderer;
@@ -88,6 +175,19 @@ private:
     Sample *origSample;
     bool visualizeObjectIds;
     int taskNum, taskCount;
+    SamplerRendererTile *tile;
+
+    // Part of the tile split off to this task, or _NULL_ for the whole tile
+    Sampler *region;
+    uint32_t regionNode;
+    double busyTime;
+    int nSplits;
+
+    // Progressive rendering pass and remaining time, if limited
+    int iteration;
+    Timer budgetTimer;
+    double timeBudget;
+    SamplerRendererCheckpoint *checkpoint;
 };
 
 
@@ -0,0 +1,598 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// renderers/wavefront.cpp*
+#include "stdafx.h"
+#include "renderers/wavefront.h"
+#include "integrators/path.h"
+#include "scene.h"
+#include "film.h"
+#include "volume.h"
+#include "sampler.h"
+#include "integrator.h"
+#include "progressreporter.h"
+#include "camera.h"
+#include "intersection.h"
+#include "reflection.h"
+#include "light.h"
+#include "montecarlo.h"
+#include "paramset.h"
+
+// Rays are handed to the accelerator in packets of at most this size
+static const int WavefrontPacketSize = 64;
+
+// WavefrontQueue Method Definitions
+WavefrontQueue::WavefrontQueue(int cap, bool keepCameraIsects) {
+    capacity = cap;
+    nPaths = nActive = nShade = nShadowRays = nLightRays = 0;
+    samples = NULL;
+    rays = new RayDifferential[capacity];
+    beta = new Spectrum[capacity];
+    L = new Spectrum[capacity];
+    isects = new Intersection[capacity];
+    cameraIsects = keepCameraIsects ? new Intersection[capacity] : NULL;
+    hits = new bool[capacity];
+    specularBounce = new bool[capacity];
+    bsdfs = new BSDF *[capacity];
+    packet = new const Ray *[capacity];
+    active = new int[capacity];
+    shadeOrder = new int[capacity];
+    shadeKeys = new std::pair<const Material *, int>[capacity];
+    shadowPath = new int[capacity];
+    shadowRays = new Ray[capacity];
+    shadowL = new Spectrum[capacity];
+    shadowHits = new bool[capacity];
+    lightPath = new int[capacity];
+    lightRays = new RayDifferential[capacity];
+    lightRayLight = new const Light *[capacity];
+    lightRayScale = new Spectrum[capacity];
+    lightIsects = new Intersection[capacity];
+    lightHits = new bool[capacity];
+}
+
+
+WavefrontQueue::~WavefrontQueue() {
+    delete[] rays;
+    delete[] beta;
+    delete[] L;
+    delete[] isects;
+    delete[] cameraIsects;
+    delete[] hits;
+    delete[] specularBounce;
+    delete[] bsdfs;
+    delete[] packet;
+    delete[] active;
+    delete[] shadeOrder;
+    delete[] shadeKeys;
+    delete[] shadowPath;
+    delete[] shadowRays;
+    delete[] shadowL;
+    delete[] shadowHits;
+    delete[] lightPath;
+    delete[] lightRays;
+    delete[] lightRayLight;
+    delete[] lightRayScale;
+    delete[] lightIsects;
+    delete[] lightHits;
+}
+
+
+// Hits are left unfinalized; callers call _Intersection::Finalize()_ only
+// for the hits whose geometry they need
+static void IntersectRays(const Scene *scene, const Ray **rays, int nRays,
+        Intersection *isects, bool *hits, bool coherent) {
+    if (coherent) {
+        for (int i = 0; i < nRays; i += WavefrontPacketSize)
+            scene->aggregate->IntersectPacket(rays + i,
+                min(WavefrontPacketSize, nRays - i), isects + i, hits + i);
+    }
+    else
+        for (int i = 0; i < nRays; ++i)
+            hits[i] = scene->aggregate->Intersect(*rays[i], &isects[i]);
+    STAT_ADD(nIntersectionRays, nRays);
+    if (PbrtOptions.numa) NumaCountRays(nRays);
+}
+
+
+static void IntersectPRays(const Scene *scene, const Ray **rays, int nRays,
+        bool *hits, bool coherent) {
+    if (coherent) {
+        for (int i = 0; i < nRays; i += WavefrontPacketSize)
+            scene->IntersectPPacket(rays + i,
+                min(WavefrontPacketSize, nRays - i), hits + i);
+    }
+    else
+        for (int i = 0; i < nRays; ++i)
+            hits[i] = scene->IntersectP(*rays[i]);
+}
+
+
+
+// WavefrontRendererTask Definitions
+void WavefrontRendererTask::Run() {
+    PBRT_STARTED_RENDERTASK(taskNum);
+    // Get sub-_Sampler_ for _WavefrontRendererTask_
+    Sampler *sampler = mainSampler->GetSubSampler(taskNum, taskCount);
+    if (!sampler)
+    {
+        reporter.Update();
+        PBRT_FINISHED_RENDERTASK(taskNum);
+        return;
+    }
+
+    // Declare local variables used for rendering loop
+    MemoryArena arena;
+    RNG rng(taskNum);
+
+    // Allocate path queue big enough for at least one batch of samples
+    int maxSamples = sampler->MaximumSampleCount();
+    int nSamples = (sampler->xPixelEnd - sampler->xPixelStart) *
+                   (sampler->yPixelEnd - sampler->yPixelStart) *
+                   sampler->samplesPerPixel;
+    WavefrontQueue q(max(min(queueSize, nSamples), maxSamples),
+                     sampler->AdaptsToResults());
+    Sample *samples = origSample->Duplicate(q.capacity);
+    q.samples = samples;
+    vector<int> batchStart;
+    FilmTile *filmTile = camera->film->GetFilmTile(sampler->xPixelStart,
+        sampler->xPixelEnd, sampler->yPixelStart, sampler->yPixelEnd);
+
+    // Fill the queue with samples from _Sampler_ and trace them together
+    bool moreSamples = true;
+    while (moreSamples) {
+        // Gather camera samples until the queue can't hold another batch
+        q.nPaths = 0;
+        batchStart.clear();
+        while (q.nPaths + maxSamples <= q.capacity) {
+            int sampleCount = sampler->GetMoreSamples(&samples[q.nPaths], rng);
+            if (sampleCount == 0) {
+                moreSamples = false;
+                break;
+            }
+            batchStart.push_back(q.nPaths);
+            q.nPaths += sampleCount;
+            // Samplers that adapt need each batch's results before the next
+            if (sampler->AdaptsToResults()) break;
+        }
+        if (q.nPaths == 0) break;
+        batchStart.push_back(q.nPaths);
+
+        // Generate camera rays for queued samples
+        q.nActive = 0;
+        for (int i = 0; i < q.nPaths; ++i) {
+            PBRT_STARTED_GENERATING_CAMERA_RAY(&samples[i]);
+            float rayWeight = camera->GenerateRayDifferential(samples[i],
+                                                              &q.rays[i]);
+            q.rays[i].ScaleDifferentials(1.f / sqrtf(sampler->samplesPerPixel));
+            PBRT_FINISHED_GENERATING_CAMERA_RAY(&samples[i], &q.rays[i], rayWeight);
+            q.beta[i] = rayWeight;
+            q.L[i] = 0.f;
+            q.specularBounce[i] = false;
+            if (rayWeight > 0.f) q.active[q.nActive++] = i;
+            else if (q.cameraIsects) q.cameraIsects[i] = Intersection();
+        }
+        STAT_ADD(nCameraRays, q.nPaths);
+
+        // Run the path tracing stages until all paths have terminated
+        renderer->TracePaths(scene, q, rng, arena);
+
+        for (int i = 0; i < q.nPaths; ++i) {
+            // Issue warning if unexpected radiance value returned
+            Spectrum &L = q.L[i];
+            if (L.HasNaNs()) {
+                Error("Not-a-number radiance value returned "
+                      "for image sample.  Setting to black.");
+                L = Spectrum(0.f);
+            }
+            else if (L.y() < -1e-5) {
+                Error("Negative luminance value, %f, returned"
+                      "for image sample.  Setting to black.", L.y());
+                L = Spectrum(0.f);
+            }
+            else if (isinf(L.y())) {
+                Error("Infinite luminance value returned"
+                      "for image sample.  Setting to black.");
+                L = Spectrum(0.f);
+            }
+        }
+
+        // Report each batch's results to _Sampler_, add them to image
+        for (uint32_t b = 0; b+1 < batchStart.size(); ++b) {
+            int start = batchStart[b], count = batchStart[b+1] - start;
+            if (sampler->ReportResults(&samples[start], &q.rays[start],
+                    &q.L[start], q.cameraIsects ? &q.cameraIsects[start] : NULL,
+                    count)) {
+                for (int i = start; i < start + count; ++i) {
+                    PBRT_STARTED_ADDING_IMAGE_SAMPLE(&samples[i], &q.rays[i], &q.L[i], &q.beta[i]);
+                    filmTile->AddSample(samples[i], q.L[i]);
+                    PBRT_FINISHED_ADDING_IMAGE_SAMPLE();
+                }
+            }
+        }
+
+        // Free _MemoryArena_ memory from computing image sample values
+        arena.FreeAll();
+    }
+
+    // Clean up after _WavefrontRendererTask_ is done with its image region
+    camera->film->MergeFilmTile(filmTile);
+    camera->film->UpdateDisplay(sampler->xPixelStart,
+        sampler->yPixelStart, sampler->xPixelEnd+1, sampler->yPixelEnd+1);
+    delete sampler;
+    delete[] samples;
+    reporter.Update();
+    PBRT_FINISHED_RENDERTASK(taskNum);
+}
+
+
+
+// WavefrontRenderer Method Definitions
+WavefrontRenderer::WavefrontRenderer(Sampler *s, Camera *c,
+        PathIntegrator *pi, VolumeIntegrator *vi, int qs) {
+    sampler = s;
+    camera = c;
+    pathIntegrator = pi;
+    volumeIntegrator = vi;
+    queueSize = qs;
+}
+
+
+WavefrontRenderer::~WavefrontRenderer() {
+    delete sampler;
+    delete camera;
+    delete pathIntegrator;
+    delete volumeIntegrator;
+}
+
+
+void WavefrontRenderer::Render(const Scene *scene) {
+    PBRT_FINISHED_PARSING();
+    // Allow integrators to do preprocessing for the scene
+    PBRT_STARTED_PREPROCESSING();
+    {
+    STAT_TIMED_SCOPE(integratorPreprocessTime);
+    pathIntegrator->Preprocess(scene, camera, this);
+    volumeIntegrator->Preprocess(scene, camera, this);
+    }
+    PBRT_FINISHED_PREPROCESSING();
+    PBRT_STARTED_RENDERING();
+    // Allocate and initialize _sample_
+    Sample *sample = new Sample(sampler, pathIntegrator,
+                                volumeIntegrator, scene);
+
+    // Create and launch _WavefrontRendererTask_s for rendering image
+    int nPixels = camera->film->xResolution * camera->film->yResolution;
+    int nTasks = max(32 * NumSystemCores(), nPixels / (16*16));
+    nTasks = RoundUpPow2(nTasks);
+    ProgressReporter reporter(nTasks, "Rendering");
+    vector<Task *> renderTasks;
+    for (int i = 0; i < nTasks; ++i)
+        renderTasks.push_back(new WavefrontRendererTask(scene, this, camera,
+                                                        reporter, sampler,
+                                                        sample, queueSize,
+                                                        nTasks-1-i, nTasks));
+    NumaResetRayCounts();
+    {
+    STAT_TIMED_SCOPE(renderingTime);
+    EnqueueTasks(renderTasks);
+    WaitForAllTasks();
+    }
+    for (uint32_t i = 0; i < renderTasks.size(); ++i)
+        delete renderTasks[i];
+    reporter.Done();
+    NumaReportRayCounts();
+    PBRT_FINISHED_RENDERING();
+    // Clean up after rendering and store final image
+    delete sample;
+    STAT_TIMED_SCOPE(imageOutputTime);
+    camera->film->WriteImage();
+}
+
+
+Spectrum WavefrontRenderer::Li(const Scene *scene,
+        const RayDifferential &ray, const Sample *sample, RNG &rng,
+        MemoryArena &arena, Intersection *isect, Spectrum *T) const {
+    Assert(ray.time == sample->time);
+    Assert(!ray.HasNaNs());
+    // Trace a single path through the wavefront stages
+    WavefrontQueue q(1, isect != NULL);
+    q.samples = sample;
+    q.nPaths = q.nActive = 1;
+    q.active[0] = 0;
+    q.rays[0] = ray;
+    q.beta[0] = 1.f;
+    q.L[0] = 0.f;
+    q.specularBounce[0] = false;
+    TracePaths(scene, q, rng, arena);
+    if (isect) *isect = q.cameraIsects[0];
+    if (T) *T = 1.f;
+    return q.L[0];
+}
+
+
+Spectrum WavefrontRenderer::Transmittance(const Scene *scene,
+        const RayDifferential &ray, const Sample *sample, RNG &rng,
+        MemoryArena &arena) const {
+    return volumeIntegrator->Transmittance(scene, this, ray, sample,
+                                           rng, arena);
+}
+
+
+void WavefrontRenderer::TracePaths(const Scene *scene, WavefrontQueue &q,
+        RNG &rng, MemoryArena &arena) const {
+    for (int depth = 0; q.nActive > 0; ++depth) {
+        intersectStage(scene, q, depth, rng, arena);
+        shadeStage(q, arena);
+        lightStage(scene, q, depth, rng);
+        shadowStage(scene, q, depth == 0, rng, arena);
+        continueStage(q, depth, rng);
+    }
+}
+
+
+void WavefrontRenderer::intersectStage(const Scene *scene, WavefrontQueue &q,
+        int depth, RNG &rng, MemoryArena &arena) const {
+    // Find closest hits for all active paths
+    for (int j = 0; j < q.nActive; ++j)
+        q.packet[j] = &q.rays[q.active[j]];
+    IntersectRays(scene, q.packet, q.nActive, q.isects, q.hits, depth == 0);
+
+    // Add emitted and volume radiance for intersected rays
+    for (int j = 0; j < q.nActive; ++j) {
+        int i = q.active[j];
+        const RayDifferential &ray = q.rays[i];
+        if (q.hits[j]) q.isects[j].Finalize(ray);
+        if (depth == 0) {
+            if (q.cameraIsects) q.cameraIsects[i] = q.isects[j];
+            if (scene->volumeRegion) {
+                // Account for participating media along camera ray
+                Spectrum T;
+                Spectrum Lvi = volumeIntegrator->Li(scene, this, ray,
+                    &q.samples[i], rng, &T, arena);
+                q.L[i] += q.beta[i] * Lvi;
+                q.beta[i] *= T;
+            }
+        }
+        if (!q.hits[j]) {
+            // Handle path that doesn't intersect any geometry
+            if (depth == 0 || q.specularBounce[i])
+                for (uint32_t k = 0; k < scene->lights.size(); ++k)
+                    q.L[i] += q.beta[i] * scene->lights[k]->Le(ray);
+            continue;
+        }
+        if (depth > 0 && scene->volumeRegion)
+            q.beta[i] *= Transmittance(scene, ray, NULL, rng, arena);
+        if (depth == 0 || q.specularBounce[i])
+            q.L[i] += q.beta[i] * q.isects[j].Le(-ray.d);
+    }
+}
+
+
+void WavefrontRenderer::shadeStage(WavefrontQueue &q,
+        MemoryArena &arena) const {
+    // Sort hits by material so each material's BSDFs are built together
+    int nShade = 0;
+    for (int j = 0; j < q.nActive; ++j)
+        if (q.hits[j])
+            q.shadeKeys[nShade++] =
+                std::make_pair(q.isects[j].primitive->GetMaterial(), j);
+    sort(&q.shadeKeys[0], &q.shadeKeys[nShade]);
+    q.nShade = nShade;
+    for (int k = 0; k < nShade; ++k) {
+        int j = q.shadeKeys[k].second;
+        q.shadeOrder[k] = j;
+        q.bsdfs[j] = q.isects[j].GetBSDF(q.rays[q.active[j]], arena);
+    }
+}
+
+
+void WavefrontRenderer::lightStage(const Scene *scene, WavefrontQueue &q,
+        int depth, RNG &rng) const {
+    const PathIntegrator *pi = pathIntegrator;
+    int nLights = int(scene->lights.size());
+    q.nShadowRays = q.nLightRays = 0;
+    if (nLights == 0) return;
+    BxDFType flags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    for (int k = 0; k < q.nShade; ++k) {
+        int j = q.shadeOrder[k], i = q.active[j];
+        const Sample *sample = &q.samples[i];
+        const BSDF *bsdf = q.bsdfs[j];
+        const Point &p = bsdf->dgShading.p;
+        const Normal &n = bsdf->dgShading.nn;
+        Vector wo = -q.rays[i].d;
+        float rayEpsilon = q.isects[j].rayEpsilon, time = q.rays[i].time;
+
+        // Randomly choose a single light to sample, _light_
+        int lightNum;
+        LightSample lightSample;
+        BSDFSample bsdfSample;
+        if (depth < SAMPLE_DEPTH) {
+            lightNum = Floor2Int(sample->oneD[pi->lightNumOffset[depth]][0] *
+                                 nLights);
+            lightSample = LightSample(sample, pi->lightSampleOffsets[depth], 0);
+            bsdfSample = BSDFSample(sample, pi->bsdfSampleOffsets[depth], 0);
+        }
+        else {
+            lightNum = Floor2Int(rng.RandomFloat() * nLights);
+            lightSample = LightSample(rng);
+            bsdfSample = BSDFSample(rng);
+        }
+        lightNum = min(lightNum, nLights-1);
+        const Light *light = scene->lights[lightNum];
+        Spectrum scale = q.beta[i] * float(nLights);
+
+        // Queue shadow ray for light sample
+        Vector wi;
+        float lightPdf, bsdfPdf;
+        VisibilityTester visibility;
+        Spectrum Li = light->Sample_L(p, rayEpsilon, lightSample, time,
+                                      &wi, &lightPdf, &visibility);
+        if (lightPdf > 0. && !Li.IsBlack()) {
+            Spectrum f = bsdf->f(wo, wi, flags);
+            if (!f.IsBlack()) {
+                float weight = 1.f;
+                if (!light->IsDeltaLight()) {
+                    bsdfPdf = bsdf->Pdf(wo, wi, flags);
+                    weight = PowerHeuristic(1, lightPdf, 1, bsdfPdf);
+                }
+                int s = q.nShadowRays++;
+                q.shadowPath[s] = i;
+                q.shadowRays[s] = visibility.r;
+                q.shadowL[s] = scale * f * Li *
+                               (AbsDot(wi, n) * weight / lightPdf);
+            }
+        }
+
+        // Queue BSDF-sampled ray toward light
+        if (light->IsDeltaLight()) continue;
+        BxDFType sampledType;
+        Spectrum f = bsdf->Sample_f(wo, &wi, bsdfSample, &bsdfPdf, flags,
+                                    &sampledType);
+        if (f.IsBlack() || bsdfPdf == 0.) continue;
+        float weight = 1.f;
+        if (!(sampledType & BSDF_SPECULAR)) {
+            lightPdf = light->Pdf(p, wi);
+            if (lightPdf == 0.) continue;
+            weight = PowerHeuristic(1, bsdfPdf, 1, lightPdf);
+        }
+        int s = q.nLightRays++;
+        q.lightPath[s] = i;
+        q.lightRays[s] = RayDifferential(p, wi, rayEpsilon, INFINITY, time);
+        q.lightRayLight[s] = light;
+        q.lightRayScale[s] = scale * f * (AbsDot(wi, n) * weight / bsdfPdf);
+    }
+}
+
+
+void WavefrontRenderer::shadowStage(const Scene *scene, WavefrontQueue &q,
+        bool coherent, RNG &rng, MemoryArena &arena) const {
+    // Trace shadow rays and add unoccluded light samples
+    for (int k = 0; k < q.nShadowRays; ++k)
+        q.packet[k] = &q.shadowRays[k];
+    IntersectPRays(scene, q.packet, q.nShadowRays, q.shadowHits, coherent);
+    for (int k = 0; k < q.nShadowRays; ++k) {
+        if (q.shadowHits[k]) continue;
+        Spectrum Ld = q.shadowL[k];
+        if (scene->volumeRegion)
+            Ld *= Transmittance(scene, RayDifferential(q.shadowRays[k]),
+                                NULL, rng, arena);
+        q.L[q.shadowPath[k]] += Ld;
+    }
+
+    // Trace BSDF-sampled rays and add light they reach
+    for (int k = 0; k < q.nLightRays; ++k)
+        q.packet[k] = &q.lightRays[k];
+    IntersectRays(scene, q.packet, q.nLightRays, q.lightIsects, q.lightHits,
+                  false);
+    for (int k = 0; k < q.nLightRays; ++k) {
+        const RayDifferential &ray = q.lightRays[k];
+        Spectrum Li(0.f);
+        if (q.lightHits[k]) {
+            Intersection &lightIsect = q.lightIsects[k];
+            if (lightIsect.primitive->GetAreaLight() == q.lightRayLight[k]) {
+                lightIsect.Finalize(ray);
+                Li = lightIsect.Le(-ray.d);
+            }
+        }
+        else
+            Li = q.lightRayLight[k]->Le(ray);
+        if (Li.IsBlack()) continue;
+        if (scene->volumeRegion)
+            Li *= Transmittance(scene, ray, NULL, rng, arena);
+        q.L[q.lightPath[k]] += q.lightRayScale[k] * Li;
+    }
+}
+
+
+void WavefrontRenderer::continueStage(WavefrontQueue &q, int depth,
+        RNG &rng) const {
+    const PathIntegrator *pi = pathIntegrator;
+    int nActive = 0;
+    for (int j = 0; j < q.nActive; ++j) {
+        if (!q.hits[j]) continue;
+        int i = q.active[j];
+        // Sample BSDF to get new path direction
+        BSDFSample outgoingBSDFSample;
+        if (depth < SAMPLE_DEPTH)
+            outgoingBSDFSample = BSDFSample(&q.samples[i],
+                pi->pathSampleOffsets[depth], 0);
+        else
+            outgoingBSDFSample = BSDFSample(rng);
+        const BSDF *bsdf = q.bsdfs[j];
+        const Normal &n = bsdf->dgShading.nn;
+        Vector wo = -q.rays[i].d, wi;
+        float pdf;
+        BxDFType flags;
+        Spectrum f = bsdf->Sample_f(wo, &wi, outgoingBSDFSample, &pdf,
+                                    BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0.)
+            continue;
+        q.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+        q.beta[i] *= f * AbsDot(wi, n) / pdf;
+        q.rays[i] = RayDifferential(bsdf->dgShading.p, wi, q.rays[i],
+                                    q.isects[j].rayEpsilon);
+
+        // Possibly terminate the path
+        if (depth > 3) {
+            float continueProbability = min(.5f, q.beta[i].y());
+            if (rng.RandomFloat() > continueProbability)
+                continue;
+            q.beta[i] /= continueProbability;
+        }
+        if (depth == pi->maxDepth)
+            continue;
+        q.active[nActive++] = i;
+    }
+    q.nActive = nActive;
+}
+
+
+WavefrontRenderer *CreateWavefrontRenderer(const ParamSet &params,
+        Sampler *sampler, Camera *camera, SurfaceIntegrator *surfaceIntegrator,
+        VolumeIntegrator *volumeIntegrator) {
+    PathIntegrator *pathIntegrator =
+        dynamic_cast<PathIntegrator *>(surfaceIntegrator);
+    if (!pathIntegrator) {
+        Warning("\"wavefront\" renderer only supports the \"path\" surface "
+                "integrator.  Using \"path\" with default parameters.");
+        delete surfaceIntegrator;
+        ParamSet pathParams;
+        pathIntegrator = CreatePathSurfaceIntegrator(pathParams);
+    }
+    int queueSize = params.FindOneInt("queuesize", 512);
+    if (queueSize < 1) {
+        Warning("\"queuesize\" %d is invalid.  Using 512.", queueSize);
+        queueSize = 512;
+    }
+    return new WavefrontRenderer(sampler, camera, pathIntegrator,
+                                 volumeIntegrator, queueSize);
+}
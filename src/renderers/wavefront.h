@@ -0,0 +1,154 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_RENDERERS_WAVEFRONT_H
+#define PBRT_RENDERERS_WAVEFRONT_H
+
+// renderers/wavefront.h*
+#include "pbrt.h"
+#include "renderer.h"
+#include "parallel.h"
+class PathIntegrator;
+
+// WavefrontQueue Declarations
+struct WavefrontQueue {
+    // WavefrontQueue Public Methods
+    WavefrontQueue(int capacity, bool keepCameraIsects);
+    ~WavefrontQueue();
+
+    // WavefrontQueue Public Data
+    int capacity;
+
+    // Path state, indexed by camera sample
+    int nPaths;
+    const Sample *samples;
+    RayDifferential *rays;
+    Spectrum *beta, *L;
+    bool *specularBounce;
+    Intersection *cameraIsects;
+
+    // Paths still being traced and their current vertices
+    int nActive, *active;
+    Intersection *isects;
+    bool *hits;
+    BSDF **bsdfs;
+    const Ray **packet;
+
+    // Order in which to shade hits, grouped by material
+    int nShade, *shadeOrder;
+    std::pair<const Material *, int> *shadeKeys;
+
+    // Shadow rays for light samples
+    int nShadowRays, *shadowPath;
+    Ray *shadowRays;
+    Spectrum *shadowL;
+    bool *shadowHits;
+
+    // BSDF-sampled rays toward lights
+    int nLightRays, *lightPath;
+    RayDifferential *lightRays;
+    const Light **lightRayLight;
+    Spectrum *lightRayScale;
+    Intersection *lightIsects;
+    bool *lightHits;
+};
+
+
+// WavefrontRenderer Declarations
+class WavefrontRenderer : public Renderer {
+public:
+    // WavefrontRenderer Public Methods
+    WavefrontRenderer(Sampler *s, Camera *c, PathIntegrator *pi,
+                      VolumeIntegrator *vi, int queueSize);
+    ~WavefrontRenderer();
+    void Render(const Scene *scene);
+    Spectrum Li(const Scene *scene, const RayDifferential &ray,
+        const Sample *sample, RNG &rng, MemoryArena &arena,
+        Intersection *isect = NULL, Spectrum *T = NULL) const;
+    Spectrum Transmittance(const Scene *scene, const RayDifferential &ray,
+        const Sample *sample, RNG &rng, MemoryArena &arena) const;
+    void TracePaths(const Scene *scene, WavefrontQueue &q, RNG &rng,
+        MemoryArena &arena) const;
+private:
+    // WavefrontRenderer Private Methods
+    void intersectStage(const Scene *scene, WavefrontQueue &q, int depth,
+        RNG &rng, MemoryArena &arena) const;
+    void shadeStage(WavefrontQueue &q, MemoryArena &arena) const;
+    void lightStage(const Scene *scene, WavefrontQueue &q, int depth,
+        RNG &rng) const;
+    void shadowStage(const Scene *scene, WavefrontQueue &q, bool coherent,
+        RNG &rng, MemoryArena &arena) const;
+    void continueStage(WavefrontQueue &q, int depth, RNG &rng) const;
+
+    // WavefrontRenderer Private Data
+    Sampler *sampler;
+    Camera *camera;
+    PathIntegrator *pathIntegrator;
+    VolumeIntegrator *volumeIntegrator;
+    int queueSize;
+};
+
+
+
+// WavefrontRendererTask Declarations
+class WavefrontRendererTask : public Task {
+public:
+    // WavefrontRendererTask Public Methods
+    WavefrontRendererTask(const Scene *sc, const WavefrontRenderer *ren,
+                          Camera *c, ProgressReporter &pr, Sampler *ms,
+                          Sample *sam, int qs, int tn, int tc)
+      : reporter(pr)
+    {
+        scene = sc; renderer = ren; camera = c; mainSampler = ms;
+        origSample = sam; queueSize = qs; taskNum = tn; taskCount = tc;
+    }
+    void Run();
+private:
+    // WavefrontRendererTask Private Data
+    const Scene *scene;
+    const WavefrontRenderer *renderer;
+    Camera *camera;
+    Sampler *mainSampler;
+    ProgressReporter &reporter;
+    Sample *origSample;
+    int queueSize, taskNum, taskCount;
+};
+
+
+WavefrontRenderer *CreateWavefrontRenderer(const ParamSet &params,
+    Sampler *sampler, Camera *camera, SurfaceIntegrator *surfaceIntegrator,
+    VolumeIntegrator *volumeIntegrator);
+
+#endif // PBRT_RENDERERS_WAVEFRONT_H
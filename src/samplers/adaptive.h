@@ -56,6 +56,7 @@ public:
     int GetMoreSamples(Sample *sample, RNG &rng);
     bool ReportResults(Sample *samples, const RayDifferential *rays,
         const Spectrum *Ls, const Intersection *isects, int count);
+    bool AdaptsToResults() const { return true; }
 private:
     // AdaptiveSampler Private Methods
     bool needsSupersampling(Sample *samples, const RayDifferential *rays,
@@ -37,77 +37,331 @@
 #include "textures/constant.h"
 #include "paramset.h"
 #include "montecarlo.h"
+#include "parallel.h"
+#include "stats.h"
+
+// TriangleMesh Local Declarations
+STAT_MEMORY_COUNTER("Memory/Triangle meshes", triangleMeshBytes);
+STAT_COUNTER("Scene/Compact triangle meshes", nCompactMeshes);
+struct TransformMeshVertex {
+    void operator()(int i) const { p[i] = (*ObjectToWorld)(P[i]); }
+    const Transform *ObjectToWorld;
+    const Point *P;
+    Point *p;
+};
+
+
+struct QuantizeMeshVertex {
+    void operator()(int i) const {
+        for (int axis = 0; axis < 3; ++axis) {
+            float q = scale[axis] > 0.f ?
+                (p[i][axis] - origin[axis]) / scale[axis] : 0.f;
+            pq[3*i+axis] = uint16_t(Clamp(Round2Int(q), 0, 65535));
+        }
+    }
+    const Point *p;
+    Point origin;
+    Vector scale;
+    uint16_t *pq;
+};
+
+
+struct MeshVertexBound {
+    BBox operator()(int i) const {
+        Point p = mesh->vertexPosition(i);
+        return xform ? BBox((*xform)(p)) : BBox(p);
+    }
+    const Transform *xform;
+    const TriangleMesh *mesh;
+};
+
+
+struct BBoxUnion {
+    BBox operator()(const BBox &b1, const BBox &b2) const {
+        return Union(b1, b2);
+    }
+};
+
+
+struct RefineMeshTriangle {
+    void operator()(int i) const {
+        (*refined)[offset + i] = new Triangle(mesh->ObjectToWorld,
+            mesh->WorldToObject, mesh->ReverseOrientation, mesh, i);
+    }
+    TriangleMesh *mesh;
+    vector<Reference<Shape> > *refined;
+    int offset;
+};
+
+
+static inline float SignNotZero(float v) {
+    return v < 0.f ? -1.f : 1.f;
+}
+
+
+static void EncodeOctahedral(const Vector &w, int16_t e[2]) {
+    // Project _w_ onto the octahedron and fold the lower hemisphere over
+    float l1 = fabsf(w.x) + fabsf(w.y) + fabsf(w.z);
+    float u = 0.f, v = 0.f;
+    if (l1 > 0.f) {
+        u = w.x / l1;
+        v = w.y / l1;
+        if (w.z < 0.f) {
+            float uu = u;
+            u = (1.f - fabsf(v)) * SignNotZero(uu);
+            v = (1.f - fabsf(uu)) * SignNotZero(v);
+        }
+    }
+    e[0] = int16_t(Round2Int(Clamp(u, -1.f, 1.f) * 32767.f));
+    e[1] = int16_t(Round2Int(Clamp(v, -1.f, 1.f) * 32767.f));
+}
+
+
+static Vector DecodeOctahedral(const int16_t e[2]) {
+    Vector w(e[0] / 32767.f, e[1] / 32767.f, 0.f);
+    w.z = 1.f - fabsf(w.x) - fabsf(w.y);
+    if (w.z < 0.f) {
+        float x = w.x;
+        w.x = (1.f - fabsf(w.y)) * SignNotZero(x);
+        w.y = (1.f - fabsf(x)) * SignNotZero(w.y);
+    }
+    return Normalize(w);
+}
+
+
+static uint16_t FloatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    uint32_t sign = (bits >> 16) & 0x8000, mant = bits & 0x7fffff;
+    int exp = int((bits >> 23) & 0xff) - 127 + 15;
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if (exp >= 31) return sign | 0x7c00;
+    uint32_t shift = 13;
+    if (exp <= 0) {
+        // Round to a denormalized half, or to zero
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        shift = 14 - exp;
+        exp = 0;
+    }
+    // Round mantissa to nearest, ties to even; a carry bumps the exponent
+    uint32_t h = (uint32_t(exp) << 10) + (mant >> shift);
+    uint32_t rem = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1))) ++h;
+    return sign | h;
+}
+
+
+static float HalfToFloat(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f, mant = h & 0x3ff, bits;
+    if (exp == 0 && mant == 0)
+        bits = sign;
+    else if (exp == 0) {
+        // Normalize denormalized half
+        exp = 127 - 15 + 1;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            --exp;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    else if (exp == 31)
+        bits = sign | 0x7f800000 | (mant << 13);
+    else
+        bits = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+
 
 // TriangleMesh Method Definitions
 TriangleMesh::TriangleMesh(const Transform *o2w, const Transform *w2o,
         bool ro, int nt, int nv, const int *vi, const Point *P,
         const Normal *N, const Vector *S, const float *uv,
-        const Reference<Texture<float> > &atex)
+        const Reference<Texture<float> > &atex, bool compact,
+        bool quantizePositions)
     : Shape(o2w, w2o, ro), alphaTexture(atex) {
     ntris = nt;
     nverts = nv;
-    vertexIndex = new int[3 * ntris];
-    memcpy(vertexIndex, vi, 3 * ntris * sizeof(int));
+    vertexIndex = NULL;
+    vertexIndex16 = NULL;
+    p = NULL;
+    pQuantized = NULL;
+    n = NULL;
+    s = NULL;
+    nOctahedral = sOctahedral = NULL;
+    uvs = NULL;
+    uvHalf = NULL;
+    size_t bytes = 0;
+    if (compact && nverts <= 65536) {
+        // Store vertex indices in 16 bits
+        vertexIndex16 = new uint16_t[3 * ntris];
+        for (int i = 0; i < 3 * ntris; ++i)
+            vertexIndex16[i] = uint16_t(vi[i]);
+        bytes += 3 * ntris * sizeof(uint16_t);
+    }
+    else {
+        vertexIndex = new int[3 * ntris];
+        memcpy(vertexIndex, vi, 3 * ntris * sizeof(int));
+        bytes += 3 * ntris * sizeof(int);
+    }
     // Copy _uv_, _N_, and _S_ vertex data, if present
-    if (uv) {
+    if (uv && compact) {
+        uvHalf = new uint16_t[2*nverts];
+        for (int i = 0; i < 2*nverts; ++i)
+            uvHalf[i] = FloatToHalf(uv[i]);
+        bytes += 2*nverts*sizeof(uint16_t);
+    }
+    else if (uv) {
         uvs = new float[2*nverts];
         memcpy(uvs, uv, 2*nverts*sizeof(float));
+        bytes += 2*nverts*sizeof(float);
     }
-    else uvs = NULL;
-    p = new Point[nverts];
-    if (N) {
+    if (N && compact) {
+        nOctahedral = new int16_t[2*nverts];
+        for (int i = 0; i < nverts; ++i)
+            EncodeOctahedral(Vector(N[i]), &nOctahedral[2*i]);
+        bytes += 2*nverts*sizeof(int16_t);
+    }
+    else if (N) {
         n = new Normal[nverts];
         memcpy(n, N, nverts*sizeof(Normal));
+        bytes += nverts*sizeof(Normal);
     }
-    else n = NULL;
-    if (S) {
+    if (S && compact) {
+        sOctahedral = new int16_t[2*nverts];
+        for (int i = 0; i < nverts; ++i)
+            EncodeOctahedral(S[i], &sOctahedral[2*i]);
+        bytes += 2*nverts*sizeof(int16_t);
+    }
+    else if (S) {
         s = new Vector[nverts];
         memcpy(s, S, nverts*sizeof(Vector));
+        bytes += nverts*sizeof(Vector);
     }
-    else s = NULL;
 
     // Transform mesh vertices to world space
-    for (int i = 0; i < nverts; ++i)
-        p[i] = (*ObjectToWorld)(P[i]);
+    p = new Point[nverts];
+    if (!quantizePositions)
+        NumaInterleave(p, nverts * sizeof(Point));
+    TransformMeshVertex transformVertex;
+    transformVertex.ObjectToWorld = ObjectToWorld;
+    transformVertex.P = P;
+    transformVertex.p = p;
+    ParallelFor(0, nverts, 16384, transformVertex);
+    if (quantizePositions) {
+        // Quantize world space vertices to 16 bits within the mesh bounds
+        BBox bounds = WorldBound();
+        QuantizeMeshVertex quantizeVertex;
+        quantizeVertex.p = p;
+        quantizeVertex.origin = bounds.pMin;
+        quantizeVertex.scale = (bounds.pMax - bounds.pMin) / 65535.f;
+        quantizeVertex.pq = pQuantized = new uint16_t[3 * nverts];
+        NumaInterleave(pQuantized, 3 * nverts * sizeof(uint16_t));
+        ParallelFor(0, nverts, 16384, quantizeVertex);
+        pOrigin = quantizeVertex.origin;
+        pScale = quantizeVertex.scale;
+        delete[] p;
+        p = NULL;
+        bytes += 3 * nverts * sizeof(uint16_t);
+    }
+    else
+        bytes += nverts * sizeof(Point);
+    if (compact || quantizePositions) STAT_INC(nCompactMeshes);
+    STAT_ADD(triangleMeshBytes, bytes);
 }
 
 
 TriangleMesh::~TriangleMesh() {
     delete[] vertexIndex;
+    delete[] vertexIndex16;
     delete[] p;
+    delete[] pQuantized;
     delete[] s;
+    delete[] sOctahedral;
     delete[] n;
+    delete[] nOctahedral;
     delete[] uvs;
+    delete[] uvHalf;
+}
+
+
+Normal TriangleMesh::vertexNormal(int i) const {
+    if (n) return n[i];
+    return Normal(DecodeOctahedral(&nOctahedral[2*i]));
+}
+
+
+Vector TriangleMesh::vertexTangent(int i) const {
+    if (s) return s[i];
+    return DecodeOctahedral(&sOctahedral[2*i]);
+}
+
+
+void TriangleMesh::GetFaceUVs(uint32_t face, float uv[3][2]) const {
+    int v[3];
+    faceVertexIndices(face, v);
+    if (uvs) {
+        uv[0][0] = uvs[2*v[0]];
+        uv[0][1] = uvs[2*v[0]+1];
+        uv[1][0] = uvs[2*v[1]];
+        uv[1][1] = uvs[2*v[1]+1];
+        uv[2][0] = uvs[2*v[2]];
+        uv[2][1] = uvs[2*v[2]+1];
+    }
+    else if (uvHalf) {
+        for (int i = 0; i < 3; ++i) {
+            uv[i][0] = HalfToFloat(uvHalf[2*v[i]]);
+            uv[i][1] = HalfToFloat(uvHalf[2*v[i]+1]);
+        }
+    }
+    else {
+        uv[0][0] = 0.; uv[0][1] = 0.;
+        uv[1][0] = 1.; uv[1][1] = 0.;
+        uv[2][0] = 1.; uv[2][1] = 1.;
+    }
 }
 
 
 BBox TriangleMesh::ObjectBound() const {
-    BBox objectBounds;
-    for (int i = 0; i < nverts; i++)
-        objectBounds = Union(objectBounds, (*WorldToObject)(p[i]));
-    return objectBounds;
+    MeshVertexBound vertexBound;
+    vertexBound.xform = WorldToObject;
+    vertexBound.mesh = this;
+    return ParallelReduce(0, nverts, 16384, BBox(), vertexBound,
+                          BBoxUnion());
 }
 
 
 BBox TriangleMesh::WorldBound() const {
-    BBox worldBounds;
-    for (int i = 0; i < nverts; i++)
-        worldBounds = Union(worldBounds, p[i]);
-    return worldBounds;
+    MeshVertexBound vertexBound;
+    vertexBound.xform = NULL;
+    vertexBound.mesh = this;
+    return ParallelReduce(0, nverts, 65536, BBox(), vertexBound,
+                          BBoxUnion());
 }
 
 
 void TriangleMesh::Refine(vector<Reference<Shape> > &refined) const {
-    for (int i = 0; i < ntris; ++i)
-        refined.push_back(new Triangle(ObjectToWorld,
-                          WorldToObject, ReverseOrientation,
-                          (TriangleMesh *)this, i));
+    RefineMeshTriangle refineTriangle;
+    refineTriangle.mesh = (TriangleMesh *)this;
+    refineTriangle.refined = &refined;
+    refineTriangle.offset = refined.size();
+    refined.resize(refined.size() + ntris);
+    ParallelFor(0, ntris, 4096, refineTriangle);
 }
 
 #include <iostream>
 
 uint32_t TriangleMesh::toRawData(Metadata* meta, void* data) const {
   std::cout << "mesh " << ntris << " " << nverts << std::endl;
+  if (!vertexIndex || !p || nOctahedral) {
+    Error("Compact triangle meshes aren't supported for GPU rendering");
+    return 0;
+  }
   if (data != NULL) {
 	  meta->type = trianglemesh;
 		std::memcpy( data, (float*)vertexIndex, sizeof(float) * ntris * 3);
@@ -118,34 +372,14 @@ uint32_t TriangleMesh::toRawData(Metadata* meta, void* data) const {
 }
 
 
-BBox Triangle::ObjectBound() const {
-    // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
-    return Union(BBox((*WorldToObject)(p1), (*WorldToObject)(p2)),
-                 (*WorldToObject)(p3));
-}
-
-
-BBox Triangle::WorldBound() const {
-    // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
-    return Union(BBox(p1, p2), p3);
-}
-
-
-bool Triangle::Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
-                         DifferentialGeometry *dg) const {
-    PBRT_RAY_TRIANGLE_INTERSECTION_TEST(const_cast<Ray *>(&ray), const_cast<Triangle *>(this));
+bool TriangleMesh::IntersectFace(uint32_t face, const Ray &ray,
+        float *tHit, float params[2]) const {
     // Compute $\VEC{s}_1$
 
     // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
+    Point pv[3];
+    GetFaceVertices(face, pv);
+    const Point &p1 = pv[0], &p2 = pv[1], &p3 = pv[2];
     Vector e1 = p2 - p1;
     Vector e2 = p3 - p1;
     Vector s1 = Cross(ray.d, e2);
@@ -171,11 +405,77 @@ bool Triangle::Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
     float t = Dot(e2, s2) * invDivisor;
     if (t < ray.mint || t > ray.maxt)
         return false;
+    params[0] = b1;
+    params[1] = b2;
+
+    // Test intersection against alpha texture, if present
+    if (ray.depth != -1 && alphaTexture) {
+        DifferentialGeometry dgLocal;
+        GetDifferentialGeometry(ray, t, face, params, &dgLocal);
+        if (alphaTexture->Evaluate(dgLocal) == 0.f)
+            return false;
+    }
+    *tHit = t;
+    return true;
+}
+
+
+bool TriangleMesh::IntersectFaceP(uint32_t face, const Ray &ray) const {
+    float tHit, params[2];
+    return IntersectFace(face, ray, &tHit, params);
+}
+
+
+BBox TriangleMesh::FaceClippedWorldBound(uint32_t face,
+                                         const BBox &clip) const {
+    // Clip triangle polygon against each plane of _clip_ in turn
+    Point poly[9], clipped[9];
+    GetFaceVertices(face, poly);
+    int nVerts = 3;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+            float plane = clip[side][axis];
+            int nClipped = 0;
+            for (int i = 0; i < nVerts; ++i) {
+                const Point &a = poly[i], &b = poly[(i+1) % nVerts];
+                bool aInside = side ? (a[axis] <= plane) : (a[axis] >= plane);
+                bool bInside = side ? (b[axis] <= plane) : (b[axis] >= plane);
+                if (aInside) clipped[nClipped++] = a;
+                if (aInside != bInside) {
+                    // Add vertex where edge crosses the clipping plane
+                    float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    Point p = a + t * (b - a);
+                    p[axis] = plane;
+                    clipped[nClipped++] = p;
+                }
+            }
+            nVerts = nClipped;
+            for (int i = 0; i < nVerts; ++i)
+                poly[i] = clipped[i];
+        }
+    }
+    BBox bounds;
+    for (int i = 0; i < nVerts; ++i)
+        bounds = Union(bounds, poly[i]);
+    return bounds;
+}
+
+
+void TriangleMesh::GetDifferentialGeometry(const Ray &ray, float t,
+        uint32_t face, const float params[2],
+        DifferentialGeometry *dg) const {
+    // Get triangle vertices in _p1_, _p2_, and _p3_
+    Point pv[3];
+    GetFaceVertices(face, pv);
+    const Point &p1 = pv[0], &p2 = pv[1], &p3 = pv[2];
+    Vector e1 = p2 - p1;
+    Vector e2 = p3 - p1;
+    float b1 = params[0], b2 = params[1];
 
     // Compute triangle partial derivatives
     Vector dpdu, dpdv;
     float uvs[3][2];
-    GetUVs(uvs);
+    GetFaceUVs(face, uvs);
 
     // Compute deltas for triangle partial derivatives
     float du1 = uvs[0][0] - uvs[2][0];
@@ -199,125 +499,32 @@ bool Triangle::Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
     float tu = b0*uvs[0][0] + b1*uvs[1][0] + b2*uvs[2][0];
     float tv = b0*uvs[0][1] + b1*uvs[1][1] + b2*uvs[2][1];
 
-    // Test intersection against alpha texture, if present
-    if (ray.depth != -1) {
-    if (mesh->alphaTexture) {
-        DifferentialGeometry dgLocal(ray(t), dpdu, dpdv,
-                                     Normal(0,0,0), Normal(0,0,0),
-                                     tu, tv, this);
-        if (mesh->alphaTexture->Evaluate(dgLocal) == 0.f)
-            return false;
-    }
-    }
-
     // Fill in _DifferentialGeometry_ from triangle hit
     *dg = DifferentialGeometry(ray(t), dpdu, dpdv,
                                Normal(0,0,0), Normal(0,0,0),
                                tu, tv, this);
-    *tHit = t;
-    *rayEpsilon = 1e-3f * *tHit;
-    PBRT_RAY_TRIANGLE_INTERSECTION_HIT(const_cast<Ray *>(&ray), t);
-    return true;
-}
-
-
-bool Triangle::IntersectP(const Ray &ray) const {
-    PBRT_RAY_TRIANGLE_INTERSECTIONP_TEST(const_cast<Ray *>(&ray), const_cast<Triangle *>(this));
-    // Compute $\VEC{s}_1$
-
-    // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
-    Vector e1 = p2 - p1;
-    Vector e2 = p3 - p1;
-    Vector s1 = Cross(ray.d, e2);
-    float divisor = Dot(s1, e1);
-    
-    if (divisor == 0.)
-        return false;
-    float invDivisor = 1.f / divisor;
-
-    // Compute first barycentric coordinate
-    Vector d = ray.o - p1;
-    float b1 = Dot(d, s1) * invDivisor;
-    if (b1 < 0. || b1 > 1.)
-        return false;
-
-    // Compute second barycentric coordinate
-    Vector s2 = Cross(d, e1);
-    float b2 = Dot(ray.d, s2) * invDivisor;
-    if (b2 < 0. || b1 + b2 > 1.)
-        return false;
-
-    // Compute _t_ to intersection point
-    float t = Dot(e2, s2) * invDivisor;
-    if (t < ray.mint || t > ray.maxt)
-        return false;
-
-    // Test shadow ray intersection against alpha texture, if present
-    if (ray.depth != -1 && mesh->alphaTexture) {
-        // Compute triangle partial derivatives
-        Vector dpdu, dpdv;
-        float uvs[3][2];
-        GetUVs(uvs);
-
-        // Compute deltas for triangle partial derivatives
-        float du1 = uvs[0][0] - uvs[2][0];
-        float du2 = uvs[1][0] - uvs[2][0];
-        float dv1 = uvs[0][1] - uvs[2][1];
-        float dv2 = uvs[1][1] - uvs[2][1];
-        Vector dp1 = p1 - p3, dp2 = p2 - p3;
-        float determinant = du1 * dv2 - dv1 * du2;
-        if (determinant == 0.f) {
-            // Handle zero determinant for triangle partial derivative matrix
-            CoordinateSystem(Normalize(Cross(e2, e1)), &dpdu, &dpdv);
-        }
-        else {
-            float invdet = 1.f / determinant;
-            dpdu = ( dv2 * dp1 - dv1 * dp2) * invdet;
-            dpdv = (-du2 * dp1 + du1 * dp2) * invdet;
-        }
-
-        // Interpolate $(u,v)$ triangle parametric coordinates
-        float b0 = 1 - b1 - b2;
-        float tu = b0*uvs[0][0] + b1*uvs[1][0] + b2*uvs[2][0];
-        float tv = b0*uvs[0][1] + b1*uvs[1][1] + b2*uvs[2][1];
-        DifferentialGeometry dgLocal(ray(t), dpdu, dpdv,
-                                     Normal(0,0,0), Normal(0,0,0),
-                                     tu, tv, this);
-        if (mesh->alphaTexture->Evaluate(dgLocal) == 0.f)
-            return false;
-    }
-    PBRT_RAY_TRIANGLE_INTERSECTIONP_HIT(const_cast<Ray *>(&ray), t);
-    return true;
+    dg->face = face;
 }
 
 
-float Triangle::Area() const {
-    // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
-    return 0.5f * Cross(p2-p1, p3-p1).Length();
-}
-
-
-void Triangle::GetShadingGeometry(const Transform &obj2world,
+void TriangleMesh::GetShadingGeometry(const Transform &obj2world,
         const DifferentialGeometry &dg,
         DifferentialGeometry *dgShading) const {
-    if (!mesh->n && !mesh->s) {
+    bool hasNormals = n || nOctahedral, hasTangents = s || sOctahedral;
+    if (!hasNormals && !hasTangents) {
         *dgShading = dg;
         return;
     }
     // Initialize _Triangle_ shading geometry with _n_ and _s_
+    int v[3];
+    faceVertexIndices(dg.face, v);
 
     // Compute barycentric coordinates for point
     float b[3];
 
     // Initialize _A_ and _C_ matrices for barycentrics
     float uv[3][2];
-    GetUVs(uv);
+    GetFaceUVs(dg.face, uv);
     float A[2][2] =
         { { uv[1][0] - uv[0][0], uv[2][0] - uv[0][0] },
           { uv[1][1] - uv[0][1], uv[2][1] - uv[0][1] } };
@@ -332,13 +539,13 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
     // Use _n_ and _s_ to compute shading tangents for triangle, _ss_ and _ts_
     Normal ns;
     Vector ss, ts;
-    if (mesh->n) ns = Normalize(obj2world(b[0] * mesh->n[v[0]] +
-                                          b[1] * mesh->n[v[1]] +
-                                          b[2] * mesh->n[v[2]]));
+    if (hasNormals) ns = Normalize(obj2world(b[0] * vertexNormal(v[0]) +
+                                             b[1] * vertexNormal(v[1]) +
+                                             b[2] * vertexNormal(v[2])));
     else   ns = dg.nn;
-    if (mesh->s) ss = Normalize(obj2world(b[0] * mesh->s[v[0]] +
-                                          b[1] * mesh->s[v[1]] +
-                                          b[2] * mesh->s[v[2]]));
+    if (hasTangents) ss = Normalize(obj2world(b[0] * vertexTangent(v[0]) +
+                                              b[1] * vertexTangent(v[1]) +
+                                              b[2] * vertexTangent(v[2])));
     else   ss = Normalize(dg.dpdu);
     
     ts = Cross(ss, ns);
@@ -351,16 +558,15 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
     Normal dndu, dndv;
 
     // Compute $\dndu$ and $\dndv$ for triangle shading geometry
-    if (mesh->n) {
-        float uvs[3][2];
-        GetUVs(uvs);
+    if (hasNormals) {
         // Compute deltas for triangle partial derivatives of normal
-        float du1 = uvs[0][0] - uvs[2][0];
-        float du2 = uvs[1][0] - uvs[2][0];
-        float dv1 = uvs[0][1] - uvs[2][1];
-        float dv2 = uvs[1][1] - uvs[2][1];
-        Normal dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-        Normal dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+        float du1 = uv[0][0] - uv[2][0];
+        float du2 = uv[1][0] - uv[2][0];
+        float dv1 = uv[0][1] - uv[2][1];
+        float dv2 = uv[1][1] - uv[2][1];
+        Normal n2 = vertexNormal(v[2]);
+        Normal dn1 = vertexNormal(v[0]) - n2;
+        Normal dn2 = vertexNormal(v[1]) - n2;
         float determinant = du1 * dv2 - dv1 * du2;
         if (determinant == 0.f)
             dndu = dndv = Normal(0,0,0);
@@ -375,11 +581,78 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
     *dgShading = DifferentialGeometry(dg.p, ss, ts,
         (*ObjectToWorld)(dndu), (*ObjectToWorld)(dndv),
         dg.u, dg.v, dg.shape);
+    dgShading->face = dg.face;
     dgShading->dudx = dg.dudx;  dgShading->dvdx = dg.dvdx;
     dgShading->dudy = dg.dudy;  dgShading->dvdy = dg.dvdy;
     dgShading->dpdx = dg.dpdx;  dgShading->dpdy = dg.dpdy;
 }
 
+
+BBox Triangle::ObjectBound() const {
+    // Get triangle vertices in _p1_, _p2_, and _p3_
+    Point p[3];
+    mesh->GetFaceVertices(face, p);
+    return Union(BBox((*WorldToObject)(p[0]), (*WorldToObject)(p[1])),
+                 (*WorldToObject)(p[2]));
+}
+
+
+BBox Triangle::WorldBound() const {
+    return mesh->FaceWorldBound(face);
+}
+
+
+BBox Triangle::ClippedWorldBound(const BBox &clip) const {
+    return mesh->FaceClippedWorldBound(face, clip);
+}
+
+
+bool Triangle::Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
+                         DifferentialGeometry *dg) const {
+    float params[2];
+    if (!IntersectDeferred(ray, tHit, rayEpsilon, params))
+        return false;
+    mesh->GetDifferentialGeometry(ray, *tHit, face, params, dg);
+    return true;
+}
+
+
+bool Triangle::IntersectDeferred(const Ray &ray, float *tHit,
+                                 float *rayEpsilon, float params[2]) const {
+    PBRT_RAY_TRIANGLE_INTERSECTION_TEST(const_cast<Ray *>(&ray), const_cast<Triangle *>(this));
+    if (!mesh->IntersectFace(face, ray, tHit, params))
+        return false;
+    *rayEpsilon = 1e-3f * *tHit;
+    PBRT_RAY_TRIANGLE_INTERSECTION_HIT(const_cast<Ray *>(&ray), *tHit);
+    return true;
+}
+
+
+bool Triangle::IntersectP(const Ray &ray) const {
+    PBRT_RAY_TRIANGLE_INTERSECTIONP_TEST(const_cast<Ray *>(&ray), const_cast<Triangle *>(this));
+    float t, params[2];
+    if (!mesh->IntersectFace(face, ray, &t, params))
+        return false;
+    PBRT_RAY_TRIANGLE_INTERSECTIONP_HIT(const_cast<Ray *>(&ray), t);
+    return true;
+}
+
+
+float Triangle::Area() const {
+    // Get triangle vertices in _p1_, _p2_, and _p3_
+    Point p[3];
+    mesh->GetFaceVertices(face, p);
+    return 0.5f * Cross(p[1]-p[0], p[2]-p[0]).Length();
+}
+
+
+void Triangle::GetShadingGeometry(const Transform &obj2world,
+        const DifferentialGeometry &dg,
+        DifferentialGeometry *dgShading) const {
+    mesh->GetShadingGeometry(obj2world, dg, dgShading);
+}
+
+
 TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o,
         bool reverseOrientation, const ParamSet &params,
         map<string, Reference<Texture<float> > > *floatTextures) {
@@ -389,6 +662,8 @@ TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o
     const float *uvs = params.FindFloat("uv", &nuvi);
     if (!uvs) uvs = params.FindFloat("st", &nuvi);
     bool discardDegnerateUVs = params.FindOneBool("discarddegenerateUVs", false);
+    bool compact = params.FindOneBool("compact", false);
+    bool quantizePositions = params.FindOneBool("quantizepositions", false);
     // XXX should complain if uvs aren't an array of 2...
     if (uvs) {
         if (nuvi < 2 * npi) {
@@ -449,7 +724,7 @@ TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o
     else if (params.FindOneFloat("alpha", 1.f) == 0.f)
         alphaTex = new ConstantTexture<float>(0.f);
     return new TriangleMesh(o2w, w2o, reverseOrientation, nvi/3, npi, vi, P,
-        N, S, uvs, alphaTex);
+        N, S, uvs, alphaTex, compact, quantizePositions);
 }
 
 
@@ -457,9 +732,9 @@ Point Triangle::Sample(float u1, float u2, Normal *Ns) const {
     float b1, b2;
     UniformSampleTriangle(u1, u2, &b1, &b2);
     // Get triangle vertices in _p1_, _p2_, and _p3_
-    const Point &p1 = mesh->p[v[0]];
-    const Point &p2 = mesh->p[v[1]];
-    const Point &p3 = mesh->p[v[2]];
+    Point pv[3];
+    mesh->GetFaceVertices(face, pv);
+    const Point &p1 = pv[0], &p2 = pv[1], &p3 = pv[2];
     Point p = b1 * p1 + b2 * p2 + (1.f - b1 - b2) * p3;
     Normal n = Normal(Cross(p2-p1, p3-p1));
     *Ns = Normalize(n);
@@ -48,17 +48,67 @@ public:
     TriangleMesh(const Transform *o2w, const Transform *w2o, bool ro,
                  int ntris, int nverts, const int *vptr,
                  const Point *P, const Normal *N, const Vector *S,
-                 const float *uv, const Reference<Texture<float> > &atex);
+                 const float *uv, const Reference<Texture<float> > &atex,
+                 bool compact = false, bool quantizePositions = false);
     ~TriangleMesh();
     BBox ObjectBound() const;
     BBox WorldBound() const;
     bool CanIntersect() const { return false; }
     void Refine(vector<Reference<Shape> > &refined) const;
     uint32_t toRawData(Metadata* meta, void* data) const;
+
+    // TriangleMesh Face Methods
+    uint32_t NumFaces() const { return ntris; }
+    bool HasAlphaTexture() const { return alphaTexture; }
+    void GetFaceVertices(uint32_t face, Point p[3]) const {
+        int v[3];
+        faceVertexIndices(face, v);
+        p[0] = vertexPosition(v[0]);
+        p[1] = vertexPosition(v[1]);
+        p[2] = vertexPosition(v[2]);
+    }
+    BBox FaceWorldBound(uint32_t face) const {
+        Point p[3];
+        GetFaceVertices(face, p);
+        return Union(BBox(p[0], p[1]), p[2]);
+    }
+    BBox FaceClippedWorldBound(uint32_t face, const BBox &clip) const;
+    void GetFaceUVs(uint32_t face, float uv[3][2]) const;
+    bool IntersectFace(uint32_t face, const Ray &ray, float *tHit,
+                       float params[2]) const;
+    bool IntersectFaceP(uint32_t face, const Ray &ray) const;
+    void GetDifferentialGeometry(const Ray &ray, float tHit, uint32_t face,
+        const float params[2], DifferentialGeometry *dg) const;
+    void GetShadingGeometry(const Transform &obj2world,
+            const DifferentialGeometry &dg,
+            DifferentialGeometry *dgShading) const;
     friend class Triangle;
+    friend struct MeshVertexBound;
     template <typename T> friend class VertexTexture;
 
 protected:
+    // TriangleMesh Protected Methods
+    void faceVertexIndices(uint32_t face, int v[3]) const {
+        if (vertexIndex16) {
+            v[0] = vertexIndex16[3*face];
+            v[1] = vertexIndex16[3*face+1];
+            v[2] = vertexIndex16[3*face+2];
+        }
+        else {
+            v[0] = vertexIndex[3*face];
+            v[1] = vertexIndex[3*face+1];
+            v[2] = vertexIndex[3*face+2];
+        }
+    }
+    Point vertexPosition(int i) const {
+        if (!pQuantized) return p[i];
+        const uint16_t *q = &pQuantized[3*i];
+        return Point(pOrigin.x + q[0] * pScale.x, pOrigin.y + q[1] * pScale.y,
+                     pOrigin.z + q[2] * pScale.z);
+    }
+    Normal vertexNormal(int i) const;
+    Vector vertexTangent(int i) const;
+
     // TriangleMesh Protected Data
     int ntris, nverts;
     int *vertexIndex;
@@ -67,6 +117,14 @@ protected:
     Vector *s;
     float *uvs;
     Reference<Texture<float> > alphaTexture;
+
+    // Compact representations, used in place of the arrays above
+    uint16_t *vertexIndex16;
+    uint16_t *pQuantized;
+    Point pOrigin;
+    Vector pScale;
+    int16_t *nOctahedral, *sOctahedral;
+    uint16_t *uvHalf;
 };
 
 
@@ -77,29 +135,27 @@ public:
              TriangleMesh *m, int n)
         : Shape(o2w, w2o, ro) {
         mesh = m;
-        v = &mesh->vertexIndex[3*n];
+        face = n;
         PBRT_CREATED_TRIANGLE(this);
     }
     BBox ObjectBound() const;
     BBox WorldBound() const;
+    BBox ClippedWorldBound(const BBox &clip) const;
+    bool GetTriangleVertices(Point p[3]) const {
+        mesh->GetFaceVertices(face, p);
+        return true;
+    }
     bool Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
                    DifferentialGeometry *dg) const;
     bool IntersectP(const Ray &ray) const;
-    void GetUVs(float uv[3][2]) const {
-        if (mesh->uvs) {
-            uv[0][0] = mesh->uvs[2*v[0]];
-            uv[0][1] = mesh->uvs[2*v[0]+1];
-            uv[1][0] = mesh->uvs[2*v[1]];
-            uv[1][1] = mesh->uvs[2*v[1]+1];
-            uv[2][0] = mesh->uvs[2*v[2]];
-            uv[2][1] = mesh->uvs[2*v[2]+1];
-        }
-        else {
-            uv[0][0] = 0.; uv[0][1] = 0.;
-            uv[1][0] = 1.; uv[1][1] = 0.;
-            uv[2][0] = 1.; uv[2][1] = 1.;
-        }
+    bool DefersIntersection() const { return true; }
+    bool IntersectDeferred(const Ray &ray, float *tHit, float *rayEpsilon,
+                           float params[2]) const;
+    void GetDifferentialGeometry(const Ray &ray, float tHit, uint32_t,
+        const float params[2], DifferentialGeometry *dg) const {
+        mesh->GetDifferentialGeometry(ray, tHit, face, params, dg);
     }
+    void GetUVs(float uv[3][2]) const { mesh->GetFaceUVs(face, uv); }
     float Area() const;
     virtual void GetShadingGeometry(const Transform &obj2world,
             const DifferentialGeometry &dg,
@@ -109,7 +165,7 @@ public:
 private:
     // Triangle Private Data
     Reference<TriangleMesh> mesh;
-    int *v;
+    uint32_t face;
 };
 
 